@@ -0,0 +1,283 @@
+/***************************************************************************
+ *   Copyright Simon Persson                                               *
+ *   simonpersson1@gmail.com                                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "backupstatechecker.h"
+#include "hashsplit.h"
+#include "kuptrace.h"
+
+#include <KLocalizedString>
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+
+#include <limits.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define READ_BLOCK_SIZE (1024 * 1024)
+
+// The name bup gives a file or folder inside its trees, files split into
+// chunks are stored as a tree with ".bup" added.
+static QByteArray archiveName(const QString &pName, bool pChunked) {
+	QString lName = pName;
+	if(pChunked) {
+		lName.append(QStringLiteral(".bup"));
+	} else if(pName.endsWith(QStringLiteral(".bup")) ||
+	          pName.left(pName.length() - 1).endsWith(QStringLiteral(".bup"))) {
+		lName.append(QStringLiteral(".bupl"));
+	}
+	return QFile::encodeName(lName);
+}
+
+static bool subTreeId(git_tree *pTree, const QString &pName, git_oid *pOid) {
+	if(pTree == nullptr) {
+		return false;
+	}
+	const git_tree_entry *lEntry = git_tree_entry_byname(pTree, archiveName(pName, false).constData());
+	if(lEntry == nullptr || !S_ISDIR(git_tree_entry_filemode(lEntry))) {
+		return false;
+	}
+	git_oid_cpy(pOid, git_tree_entry_id(lEntry));
+	return true;
+}
+
+BackupStateChecker::BackupStateChecker()
+   : QObject(), mRepository(nullptr), mObjectDatabase(nullptr)
+{
+}
+
+BackupStateChecker::~BackupStateChecker() {
+	if(mObjectDatabase != nullptr) {
+		git_odb_free(mObjectDatabase);
+	}
+	if(mRepository != nullptr) {
+		git_repository_free(mRepository);
+	}
+}
+
+void BackupStateChecker::check(const QString &pPath, const QString &pRepositoryPath,
+                               const QStringList &pExcludedPaths, bool pNotify) {
+	TraceSpan lSpan("BackupStateChecker::check", "daemon");
+	const QString lPath = QDir::cleanPath(QFileInfo(pPath).absoluteFilePath());
+	mExcludedPaths = pExcludedPaths;
+	Counts lCounts = {0, 0, 0, 0};
+
+	git_oid lCommitOid;
+	git_commit *lCommit;
+	if(!openRepository(pRepositoryPath)) {
+		emit checked(pPath, BACKUP_STATE_UNKNOWN, xi18nc("@info", "The backup archive could not be opened."),
+		             pNotify);
+		return;
+	}
+	if(0 != git_reference_name_to_id(&lCommitOid, mRepository, "refs/heads/kup") ||
+	      0 != git_commit_lookup(&lCommit, mRepository, &lCommitOid)) {
+		emit checked(pPath, BACKUP_STATE_UNKNOWN, xi18nc("@info", "No backup has been saved yet."), pNotify);
+		return;
+	}
+	git_oid lTreeOid;
+	git_oid_cpy(&lTreeOid, git_commit_tree_id(lCommit));
+	git_commit_free(lCommit);
+
+	// bup stores the full path from the root folder. Walk down to the parent
+	// folder in the latest backup, as far as it exists.
+	const QStringList lComponents = lPath.split(QLatin1Char('/'), QString::SkipEmptyParts);
+	git_tree *lParentTree = nullptr;
+	bool lParentFound = 0 == git_tree_lookup(&lParentTree, mRepository, &lTreeOid);
+	for(int i = 0; lParentFound && i + 1 < lComponents.count(); ++i) {
+		git_oid lSubTreeOid;
+		lParentFound = subTreeId(lParentTree, lComponents.at(i), &lSubTreeOid);
+		git_tree_free(lParentTree);
+		lParentTree = nullptr;
+		lParentFound = lParentFound && 0 == git_tree_lookup(&lParentTree, mRepository, &lSubTreeOid);
+	}
+
+	const QFileInfo lInfo(lPath);
+	QString lDetails;
+	BackupState lState;
+	if(lInfo.isDir() && !lInfo.isSymLink()) {
+		git_oid lFolderOid;
+		bool lFolderFound;
+		if(lComponents.isEmpty()) {
+			git_oid_cpy(&lFolderOid, &lTreeOid);
+			lFolderFound = true;
+		} else {
+			lFolderFound = lParentFound && subTreeId(lParentTree, lComponents.last(), &lFolderOid);
+		}
+		checkFolder(lPath, lFolderFound ? &lFolderOid : nullptr, lCounts);
+		if(lCounts.mNotBackedUp > 0) {
+			lState = BACKUP_STATE_NOT_BACKED_UP;
+		} else if(lCounts.mContentBackedUp > 0) {
+			lState = BACKUP_STATE_CONTENT_BACKED_UP;
+		} else {
+			lState = BACKUP_STATE_BACKED_UP;
+		}
+		const int lFileCount = lCounts.mBackedUp + lCounts.mContentBackedUp + lCounts.mNotBackedUp;
+		lDetails = xi18ncp("@info", "Checked one file in <filename>%2</filename>.",
+		                   "Checked %1 files in <filename>%2</filename>.", lFileCount, lPath);
+		lDetails.append(QLatin1Char(' '));
+		lDetails.append(xi18nc("@info", "%1 as in the latest backup, %2 only elsewhere in the archive, "
+		                                "%3 not backed up.", lCounts.mBackedUp, lCounts.mContentBackedUp,
+		                       lCounts.mNotBackedUp));
+		if(lCounts.mUnreadable > 0) {
+			lDetails.append(QLatin1Char(' '));
+			lDetails.append(xi18ncp("@info", "One file could not be read.", "%1 files could not be read.",
+			                        lCounts.mUnreadable));
+		}
+	} else {
+		lState = checkFile(lPath, lParentFound ? lParentTree : nullptr, lInfo.fileName(), lCounts);
+		switch(lState) {
+		case BACKUP_STATE_BACKED_UP:
+			lDetails = xi18nc("@info", "<filename>%1</filename> is the same as in the latest backup.", lPath);
+			break;
+		case BACKUP_STATE_CONTENT_BACKED_UP:
+			lDetails = xi18nc("@info", "The content of <filename>%1</filename> is in the backup archive, but not "
+			                           "at this path in the latest backup.", lPath);
+			break;
+		case BACKUP_STATE_NOT_BACKED_UP:
+			lDetails = xi18nc("@info", "<filename>%1</filename> is not backed up.", lPath);
+			break;
+		default:
+			lDetails = xi18nc("@info", "<filename>%1</filename> could not be read.", lPath);
+			break;
+		}
+	}
+	if(lParentTree != nullptr) {
+		git_tree_free(lParentTree);
+	}
+	emit checked(pPath, lState, lDetails, pNotify);
+}
+
+bool BackupStateChecker::openRepository(const QString &pRepositoryPath) {
+	if(mRepository != nullptr && pRepositoryPath == mRepositoryPath) {
+		return true;
+	}
+	if(mObjectDatabase != nullptr) {
+		git_odb_free(mObjectDatabase);
+		mObjectDatabase = nullptr;
+	}
+	if(mRepository != nullptr) {
+		git_repository_free(mRepository);
+		mRepository = nullptr;
+	}
+	if(0 != git_repository_open(&mRepository, QFile::encodeName(pRepositoryPath).constData())) {
+		mRepository = nullptr;
+		return false;
+	}
+	if(0 != git_repository_odb(&mObjectDatabase, mRepository)) {
+		git_repository_free(mRepository);
+		mRepository = nullptr;
+		mObjectDatabase = nullptr;
+		return false;
+	}
+	mRepositoryPath = pRepositoryPath;
+	return true;
+}
+
+bool BackupStateChecker::hashLocalFile(const QString &pPath, git_oid *pOid, bool *pChunked) {
+	QFile lFile(pPath);
+	if(!lFile.open(QIODevice::ReadOnly)) {
+		return false;
+	}
+	HashSplitter lSplitter;
+	QByteArray lBuffer(READ_BLOCK_SIZE, Qt::Uninitialized);
+	qint64 lRead;
+	while((lRead = lFile.read(lBuffer.data(), lBuffer.size())) > 0) {
+		lSplitter.write(lBuffer.constData(), static_cast<size_t>(lRead));
+	}
+	if(lRead < 0) {
+		return false;
+	}
+	unsigned int lMode;
+	lSplitter.finish(pOid, &lMode);
+	*pChunked = lMode == HASHSPLIT_MODE_TREE;
+	return true;
+}
+
+BackupState BackupStateChecker::checkFile(const QString &pPath, git_tree *pParentTree, const QString &pName,
+                                          Counts &pCounts) {
+	git_oid lOid;
+	bool lChunked = false;
+	const QFileInfo lInfo(pPath);
+	if(lInfo.isSymLink()) {
+		// bup stores the link target as it is, in a blob.
+		char lTarget[PATH_MAX];
+		const ssize_t lLength = readlink(QFile::encodeName(pPath).constData(), lTarget, sizeof(lTarget));
+		if(lLength < 0 || 0 != git_odb_hash(&lOid, lTarget, static_cast<size_t>(lLength), GIT_OBJ_BLOB)) {
+			++pCounts.mUnreadable;
+			return BACKUP_STATE_UNKNOWN;
+		}
+	} else if(!hashLocalFile(pPath, &lOid, &lChunked)) {
+		++pCounts.mUnreadable;
+		return BACKUP_STATE_UNKNOWN;
+	}
+
+	const git_tree_entry *lEntry = nullptr;
+	if(pParentTree != nullptr) {
+		lEntry = git_tree_entry_byname(pParentTree, archiveName(pName, lChunked).constData());
+	}
+	if(lEntry != nullptr && git_oid_equal(git_tree_entry_id(lEntry), &lOid)) {
+		++pCounts.mBackedUp;
+		return BACKUP_STATE_BACKED_UP;
+	}
+	// moved, renamed or an older version, found through the pack indexes.
+	if(git_odb_exists(mObjectDatabase, &lOid)) {
+		++pCounts.mContentBackedUp;
+		return BACKUP_STATE_CONTENT_BACKED_UP;
+	}
+	++pCounts.mNotBackedUp;
+	return BACKUP_STATE_NOT_BACKED_UP;
+}
+
+void BackupStateChecker::checkFolder(const QString &pPath, const git_oid *pTree, Counts &pCounts) {
+	git_tree *lTree = nullptr;
+	if(pTree != nullptr && 0 != git_tree_lookup(&lTree, mRepository, pTree)) {
+		lTree = nullptr;
+	}
+	QDir lDir(pPath);
+	if(!lDir.isReadable()) {
+		++pCounts.mUnreadable;
+	}
+	const QFileInfoList lInfos = lDir.entryInfoList(QDir::AllEntries | QDir::Hidden | QDir::System |
+	                                                QDir::NoDotAndDotDot);
+	foreach(const QFileInfo &lInfo, lInfos) {
+		const QString lPath = lInfo.absoluteFilePath();
+		bool lExcluded = false;
+		foreach(const QString &lExcludedPath, mExcludedPaths) {
+			if(lPath == lExcludedPath || lPath.startsWith(lExcludedPath + QLatin1Char('/'))) {
+				lExcluded = true;
+				break;
+			}
+		}
+		if(lExcluded) {
+			continue;
+		}
+		if(lInfo.isSymLink() || lInfo.isFile()) {
+			checkFile(lPath, lTree, lInfo.fileName(), pCounts);
+		} else if(lInfo.isDir()) {
+			git_oid lSubTreeOid;
+			const bool lFound = subTreeId(lTree, lInfo.fileName(), &lSubTreeOid);
+			checkFolder(lPath, lFound ? &lSubTreeOid : nullptr, pCounts);
+		}
+		// sockets, pipes and devices have no content to compare.
+	}
+	if(lTree != nullptr) {
+		git_tree_free(lTree);
+	}
+}
@@ -0,0 +1,75 @@
+/***************************************************************************
+ *   Copyright Simon Persson                                               *
+ *   simonpersson1@gmail.com                                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef BACKUPSTATECHECKER_H
+#define BACKUPSTATECHECKER_H
+
+#include <QObject>
+#include <QStringList>
+
+#include <git2.h>
+
+enum BackupState {
+	BACKUP_STATE_UNKNOWN = 0, // not in a bup backup plan which is available, or could not be read
+	BACKUP_STATE_BACKED_UP, // same content at the same path in the latest backup
+	BACKUP_STATE_CONTENT_BACKED_UP, // the content is in the archive, but not at this path in the latest backup
+	BACKUP_STATE_NOT_BACKED_UP
+};
+
+// Tells if local files are the same as in the latest backup, without reading
+// any file data from the archive. Files are split and hashed locally the same
+// way bup does it, giving the id bup would store them with. That id is then
+// compared to the one at the same path in the latest backup, or looked up in
+// the pack indexes. Meant to live in a worker thread, it has its own
+// repository handle.
+class BackupStateChecker : public QObject {
+	Q_OBJECT
+public:
+	BackupStateChecker();
+	~BackupStateChecker();
+
+public slots:
+	// pExcludedPaths are skipped when checking a folder, they are never backed up.
+	void check(const QString &pPath, const QString &pRepositoryPath, const QStringList &pExcludedPaths,
+	           bool pNotify);
+
+signals:
+	void checked(const QString &pPath, int pState, const QString &pDetails, bool pNotify);
+
+protected:
+	struct Counts {
+		int mBackedUp;
+		int mContentBackedUp;
+		int mNotBackedUp;
+		int mUnreadable;
+	};
+
+	bool openRepository(const QString &pRepositoryPath);
+	bool hashLocalFile(const QString &pPath, git_oid *pOid, bool *pChunked);
+	BackupState checkFile(const QString &pPath, git_tree *pParentTree, const QString &pName, Counts &pCounts);
+	void checkFolder(const QString &pPath, const git_oid *pTree, Counts &pCounts);
+
+	git_repository *mRepository;
+	git_odb *mObjectDatabase;
+	QString mRepositoryPath;
+	QStringList mExcludedPaths;
+};
+
+#endif // BACKUPSTATECHECKER_H
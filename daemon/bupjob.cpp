@@ -19,6 +19,7 @@
  ***************************************************************************/
 
 #include "bupjob.h"
+#include "kuptrace.h"
 
 #include <signal.h>
 
@@ -35,6 +36,7 @@ BupJob::BupJob(const BackupPlan &pBackupPlan, const QString &pDestinationPath, c
 	mSaveProcess.setOutputChannelMode(KProcess::SeparateChannels);
 	mPar2Process.setOutputChannelMode(KProcess::SeparateChannels);
 	setCapabilities(KJob::Suspendable);
+	mPhaseStartTime = 0;
 }
 
 void BupJob::performJob() {
@@ -64,7 +66,10 @@ void BupJob::performJob() {
 	lInitProcess << QStringLiteral("-d") << mDestinationPath;
 	lInitProcess << QStringLiteral("init");
 	mLogStream << quoteArgs(lInitProcess.program()) << endl;
-	if(lInitProcess.execute() != 0) {
+	const qint64 lInitStartTime = traceTime();
+	const int lInitExitCode = lInitProcess.execute();
+	traceSpan("bup init", "daemon", lInitStartTime);
+	if(lInitExitCode != 0) {
 		mLogStream << QString::fromUtf8(lInitProcess.readAllStandardError()) << endl;
 		mLogStream << endl << QStringLiteral("Kup did not successfully complete the bup backup job: "
 		                                     "failed to initialize backup destination.") << endl;
@@ -89,11 +94,13 @@ void BupJob::performJob() {
 }
 
 void BupJob::slotCheckingStarted() {
+	mPhaseStartTime = traceTime();
 	makeNice(mFsckProcess.pid());
 	emit description(this, i18n("Checking backup integrity"));
 }
 
 void BupJob::slotCheckingDone(int pExitCode, QProcess::ExitStatus pExitStatus) {
+	traceSpan("bup fsck", "daemon", mPhaseStartTime);
 	mLogStream << QString::fromUtf8(mFsckProcess.readAllStandardError());
 	if(pExitStatus != QProcess::NormalExit || pExitCode != 0) {
 		mLogStream << endl << QStringLiteral("Kup did not successfully complete the bup backup job: "
@@ -127,11 +134,13 @@ void BupJob::slotCheckingDone(int pExitCode, QProcess::ExitStatus pExitStatus) {
 }
 
 void BupJob::slotIndexingStarted() {
+	mPhaseStartTime = traceTime();
 	makeNice(mIndexProcess.pid());
 	emit description(this, i18n("Checking what to copy"));
 }
 
 void BupJob::slotIndexingDone(int pExitCode, QProcess::ExitStatus pExitStatus) {
+	traceSpan("bup index", "daemon", mPhaseStartTime);
 	mLogStream << QString::fromUtf8(mIndexProcess.readAllStandardError());
 	if(pExitStatus != QProcess::NormalExit || pExitCode != 0) {
 		mLogStream << endl << QStringLiteral("Kup did not successfully complete the bup backup job: failed to index everything.") << endl;
@@ -155,11 +164,13 @@ void BupJob::slotIndexingDone(int pExitCode, QProcess::ExitStatus pExitStatus) {
 }
 
 void BupJob::slotSavingStarted() {
+	mPhaseStartTime = traceTime();
 	makeNice(mSaveProcess.pid());
 	emit description(this, i18n("Saving backup"));
 }
 
 void BupJob::slotSavingDone(int pExitCode, QProcess::ExitStatus pExitStatus) {
+	traceSpan("bup save", "daemon", mPhaseStartTime);
 	mLogStream << QString::fromUtf8(mSaveProcess.readAllStandardError());
 	if(pExitStatus != QProcess::NormalExit || pExitCode != 0) {
 		mLogStream << endl << QStringLiteral("Kup did not successfully complete the bup backup job: "
@@ -185,11 +196,13 @@ void BupJob::slotSavingDone(int pExitCode, QProcess::ExitStatus pExitStatus) {
 }
 
 void BupJob::slotRecoveryInfoStarted() {
+	mPhaseStartTime = traceTime();
 	makeNice(mPar2Process.pid());
 	emit description(this, i18n("Generating recovery information"));
 }
 
 void BupJob::slotRecoveryInfoDone(int pExitCode, QProcess::ExitStatus pExitStatus) {
+	traceSpan("bup fsck -g", "daemon", mPhaseStartTime);
 	mLogStream << QString::fromUtf8(mPar2Process.readAllStandardError());
 	if(pExitStatus != QProcess::NormalExit || pExitCode != 0) {
 		mLogStream << endl << QStringLiteral("Kup did not successfully complete the bup backup job: "
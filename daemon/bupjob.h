@@ -56,6 +56,7 @@ protected:
 	KProcess mSaveProcess;
 	KProcess mPar2Process;
 	QElapsedTimer mInfoRateLimiter;
+	qint64 mPhaseStartTime;
 };
 
 #endif /*BUPJOB_H*/
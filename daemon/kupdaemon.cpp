@@ -21,11 +21,13 @@
 #include "kupdaemon.h"
 #include "kupsettings.h"
 #include "backupplan.h"
+#include "backupstatechecker.h"
 #include "edexecutor.h"
 #include "fsexecutor.h"
 
 #include <QApplication>
 #include <QDBusConnection>
+#include <QDir>
 #include <QFileInfo>
 #include <QJsonArray>
 #include <QJsonDocument>
@@ -35,10 +37,12 @@
 #include <QMessageBox>
 #include <QPushButton>
 #include <QSessionManager>
+#include <QThread>
 #include <QTimer>
 
 #include <KIdleTime>
 #include <KLocalizedString>
+#include <KNotification>
 #include <KUiServerJobTracker>
 
 KupDaemon::KupDaemon() {
@@ -47,9 +51,29 @@ KupDaemon::KupDaemon() {
 	mSettings = new KupSettings(mConfig, this);
 	mJobTracker = new KUiServerJobTracker(this);
 	mLocalServer = new QLocalServer(this);
+
+	// hashing big files takes a while, keep it away from the event loop.
+	mStateCheckThread = new QThread(this);
+	mStateChecker = new BackupStateChecker;
+	mStateChecker->moveToThread(mStateCheckThread);
+	connect(mStateCheckThread, &QThread::finished, mStateChecker, &QObject::deleteLater);
+	// queued to this thread, the notification and the D-Bus signal belong here.
+	connect(mStateChecker, &BackupStateChecker::checked, this,
+	        [this](const QString &pPath, int pState, const QString &pDetails, bool pNotify) {
+		emit backupStateChecked(pPath, pState, pDetails);
+		if(pNotify) {
+			KNotification *lNotification = new KNotification(QStringLiteral("BackupStateChecked"));
+			lNotification->setTitle(xi18nc("@title:window", "Backup Check"));
+			lNotification->setText(pDetails);
+			lNotification->sendEvent();
+		}
+	});
+	mStateCheckThread->start();
 }
 
 KupDaemon::~KupDaemon() {
+	mStateCheckThread->quit();
+	mStateCheckThread->wait();
 	while(!mExecutors.isEmpty()) {
 		delete mExecutors.takeFirst();
 	}
@@ -91,7 +115,8 @@ void KupDaemon::setupGuiStuff() {
 	QDBusConnection lDBus = QDBusConnection::sessionBus();
 	if(lDBus.isConnected()) {
 		if(lDBus.registerService(KUP_DBUS_SERVICE_NAME)) {
-			lDBus.registerObject(KUP_DBUS_OBJECT_PATH, this, QDBusConnection::ExportAllSlots);
+			lDBus.registerObject(KUP_DBUS_OBJECT_PATH, this,
+			                     QDBusConnection::ExportAllSlots | QDBusConnection::ExportAllSignals);
 		}
 	}
 	QString lSocketName = QStringLiteral("kup-daemon-");
@@ -150,6 +175,39 @@ void KupDaemon::runIntegrityCheck(QString pPath) {
 	}
 }
 
+// Exposed over DBus, for file managers wanting to show if files are backed up.
+void KupDaemon::checkBackupState(QString pPath) {
+	startBackupStateCheck(pPath, false);
+}
+
+void KupDaemon::startBackupStateCheck(const QString &pPath, bool pNotify) {
+	const QString lPath = QDir::cleanPath(QFileInfo(pPath).absoluteFilePath());
+	foreach(PlanExecutor *lExecutor, mExecutors) {
+		if(lExecutor->mPlan->mBackupType != BackupPlan::BupType || !lExecutor->destinationAvailable()) {
+			continue;
+		}
+		foreach(const QString &lIncludedPath, lExecutor->mPlan->mPathsIncluded) {
+			if(lPath == lIncludedPath || lPath.startsWith(lIncludedPath + QLatin1Char('/')) ||
+			      lIncludedPath == QStringLiteral("/")) {
+				QMetaObject::invokeMethod(mStateChecker, "check", Qt::QueuedConnection, Q_ARG(QString, lPath),
+				                          Q_ARG(QString, lExecutor->mDestinationPath),
+				                          Q_ARG(QStringList, lExecutor->mPlan->mPathsExcluded),
+				                          Q_ARG(bool, pNotify));
+				return;
+			}
+		}
+	}
+	const QString lDetails = xi18nc("@info", "<filename>%1</filename> is not included in any backup plan "
+	                                         "with its destination available.", lPath);
+	emit backupStateChecked(pPath, BACKUP_STATE_UNKNOWN, lDetails);
+	if(pNotify) {
+		KNotification *lNotification = new KNotification(QStringLiteral("BackupStateChecked"));
+		lNotification->setTitle(xi18nc("@title:window", "Backup Check"));
+		lNotification->setText(lDetails);
+		lNotification->sendEvent();
+	}
+}
+
 void KupDaemon::registerJob(KJob *pJob) {
 	mJobTracker->registerJob(pJob);
 }
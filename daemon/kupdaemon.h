@@ -26,6 +26,7 @@
 #define KUP_DBUS_SERVICE_NAME QStringLiteral("org.kde.kupdaemon")
 #define KUP_DBUS_OBJECT_PATH QStringLiteral("/DaemonControl")
 
+class BackupStateChecker;
 class KupSettings;
 class PlanExecutor;
 
@@ -35,6 +36,7 @@ class KUiServerJobTracker;
 class QLocalServer;
 class QLocalSocket;
 class QSessionManager;
+class QThread;
 class QTimer;
 
 class KupDaemon : public QObject
@@ -49,10 +51,18 @@ public:
 	void slotShutdownRequest(QSessionManager &pManager);
 	void registerJob(KJob *pJob);
 	void unregisterJob(KJob *pJob);
+	// Starts a check of a local file or folder against the latest backup of
+	// the plan it belongs to, the result comes with backupStateChecked().
+	void startBackupStateCheck(const QString &pPath, bool pNotify);
 
 public slots:
 	void reloadConfig();
 	void runIntegrityCheck(QString pPath);
+	void checkBackupState(QString pPath);
+
+signals:
+	// pState is one of the BackupState values.
+	void backupStateChecked(QString pPath, int pState, QString pDetails);
 
 private:
 	void setupExecutors();
@@ -68,6 +78,8 @@ private:
 	KUiServerJobTracker *mJobTracker;
 	QLocalServer *mLocalServer;
 	QList<QLocalSocket *> mSockets;
+	QThread *mStateCheckThread;
+	BackupStateChecker *mStateChecker;
 };
 
 #endif /*KUPDAEMON_H*/
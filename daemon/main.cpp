@@ -21,12 +21,20 @@
 #include "kupdaemon.h"
 #include "kupdaemon_debug.h"
 
+#include <git2/version.h>
+#if LIBGIT2_VER_MAJOR == 0 && LIBGIT2_VER_MINOR >= 24
+#include <git2/global.h>
+#else
+#include <git2/threads.h>
+#endif
+
 #include <KAboutData>
 #include <KDBusService>
 #include <KLocalizedString>
 
 #include <QApplication>
 #include <QCommandLineParser>
+#include <QDir>
 
 extern "C" int Q_DECL_EXPORT kdemain(int argc, char *argv[]) {
 	QApplication lApp(argc, argv);
@@ -59,17 +67,49 @@ extern "C" int Q_DECL_EXPORT kdemain(int argc, char *argv[]) {
 	QCommandLineParser lParser;
 	lParser.addVersionOption();
 	lParser.addHelpOption();
+	lParser.addOption(QCommandLineOption(QStringLiteral("check-backup"),
+	                                     i18n("Check if the given files are included in the latest backup.")));
+	lParser.addPositionalArgument(QStringLiteral("<files>"), i18n("Files to check."));
 	lAbout.setupCommandLine(&lParser);
 	lParser.process(lApp);
 	lAbout.processCommandLine(&lParser);
 
-	// This call will exit() if an instance is already running
+	// This call will exit() if an instance is already running, after
+	// forwarding the arguments to it.
 	KDBusService lService(KDBusService::Unique);
 
+	#if LIBGIT2_VER_MAJOR == 0 && LIBGIT2_VER_MINOR >= 24
+	git_libgit2_init();
+	#else
+	git_threads_init();
+	#endif
+
 	lDaemon->setupGuiStuff();
 	lDaemon->connect(&lApp, &QApplication::commitDataRequest, [=](QSessionManager &pManager) {
 		lDaemon->slotShutdownRequest(pManager);
 	});
+	if(lParser.isSet(QStringLiteral("check-backup"))) {
+		foreach(const QString &lPath, lParser.positionalArguments()) {
+			lDaemon->startBackupStateCheck(QDir::current().absoluteFilePath(lPath), true);
+		}
+	}
+	lDaemon->connect(&lService, &KDBusService::activateRequested,
+	                 [=](const QStringList &pArguments, const QString &pWorkingDirectory) {
+		QCommandLineParser lActivationParser;
+		lActivationParser.addOption(QCommandLineOption(QStringLiteral("check-backup")));
+		lActivationParser.parse(pArguments);
+		if(lActivationParser.isSet(QStringLiteral("check-backup"))) {
+			foreach(const QString &lPath, lActivationParser.positionalArguments()) {
+				lDaemon->startBackupStateCheck(QDir(pWorkingDirectory).absoluteFilePath(lPath), true);
+			}
+		}
+	});
 
-	return lApp.exec();
+	int lRetVal = lApp.exec();
+	#if LIBGIT2_VER_MAJOR == 0 && LIBGIT2_VER_MINOR >= 24
+	git_libgit2_shutdown();
+	#else
+	git_threads_shutdown();
+	#endif
+	return lRetVal;
 }
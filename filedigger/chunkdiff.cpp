@@ -0,0 +1,272 @@
+/***************************************************************************
+ *   Copyright Simon Persson                                               *
+ *   simonpersson1@gmail.com                                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "chunkdiff.h"
+#include "kuptrace.h"
+#include "vfshelpers.h"
+
+#include <QHash>
+
+#include <algorithm>
+#include <sys/stat.h>
+
+struct ChunkTreeEntry {
+	quint64 mOffset; // relative to the start of the tree
+	git_oid mOid;
+	bool mIsTree;
+};
+
+struct ChunkLeaf {
+	quint64 mOffset;
+	quint64 mSize;
+	git_oid mOid;
+};
+
+struct ChunkDiffContext {
+	git_repository *mRepository;
+	QVector<git_oid> mOldChunks; // sorted once the trees have been walked
+	QVector<ChunkLeaf> mNewChunks;
+};
+
+struct ChunkOidIndex {
+	git_oid mOid;
+	int mIndex;
+};
+
+static bool oidLessThan(const git_oid &pA, const git_oid &pB) {
+	return git_oid_cmp(&pA, &pB) < 0;
+}
+
+static bool oidIndexLessThan(const ChunkOidIndex &pA, const ChunkOidIndex &pB) {
+	return git_oid_cmp(&pA.mOid, &pB.mOid) < 0;
+}
+
+static bool readChunkTree(git_repository *pRepository, const git_oid *pOid, QVector<ChunkTreeEntry> &pEntries) {
+	git_tree *lTree;
+	if(0 != git_tree_lookup(&lTree, pRepository, pOid)) {
+		return false;
+	}
+	const size_t lEntryCount = git_tree_entrycount(lTree);
+	pEntries.resize(lEntryCount);
+	for(size_t i = 0; i < lEntryCount; ++i) {
+		const git_tree_entry *lEntry = git_tree_entry_byindex(lTree, i);
+		if(!offsetFromName(lEntry, pEntries[i].mOffset)) {
+			git_tree_free(lTree);
+			return false;
+		}
+		pEntries[i].mOid = *git_tree_entry_id(lEntry);
+		pEntries[i].mIsTree = S_ISDIR(git_tree_entry_filemode(lEntry));
+	}
+	git_tree_free(lTree);
+	return true;
+}
+
+// Size of entry pIndex, it reaches up to the next one or to the end of the tree.
+static bool entrySize(const QVector<ChunkTreeEntry> &pEntries, int pIndex, quint64 pTreeSize, quint64 &pSize) {
+	const quint64 lEnd = pIndex + 1 < pEntries.count() ? pEntries.at(pIndex + 1).mOffset : pTreeSize;
+	if(lEnd < pEntries.at(pIndex).mOffset) {
+		return false;
+	}
+	pSize = lEnd - pEntries.at(pIndex).mOffset;
+	return true;
+}
+
+static bool collectOldChunks(ChunkDiffContext &pContext, const ChunkTreeEntry &pEntry) {
+	if(!pEntry.mIsTree) {
+		pContext.mOldChunks.append(pEntry.mOid);
+		return true;
+	}
+	QVector<ChunkTreeEntry> lEntries;
+	if(!readChunkTree(pContext.mRepository, &pEntry.mOid, lEntries)) {
+		return false;
+	}
+	foreach(const ChunkTreeEntry &lEntry, lEntries) {
+		if(!collectOldChunks(pContext, lEntry)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool collectNewChunks(ChunkDiffContext &pContext, const ChunkTreeEntry &pEntry, quint64 pOffset,
+                             quint64 pSize) {
+	if(!pEntry.mIsTree) {
+		ChunkLeaf lLeaf;
+		lLeaf.mOffset = pOffset;
+		lLeaf.mSize = pSize;
+		lLeaf.mOid = pEntry.mOid;
+		pContext.mNewChunks.append(lLeaf);
+		return true;
+	}
+	QVector<ChunkTreeEntry> lEntries;
+	if(!readChunkTree(pContext.mRepository, &pEntry.mOid, lEntries)) {
+		return false;
+	}
+	for(int i = 0; i < lEntries.count(); ++i) {
+		quint64 lSize;
+		if(!entrySize(lEntries, i, pSize, lSize) ||
+		      !collectNewChunks(pContext, lEntries.at(i), pOffset + lEntries.at(i).mOffset, lSize)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool diffChunkTrees(ChunkDiffContext &pContext, const git_oid *pOldTree, const git_oid *pNewTree,
+                           quint64 pOffset, quint64 pSize) {
+	QVector<ChunkTreeEntry> lOldEntries, lNewEntries;
+	if(!readChunkTree(pContext.mRepository, pOldTree, lOldEntries) ||
+	      !readChunkTree(pContext.mRepository, pNewTree, lNewEntries)) {
+		return false;
+	}
+	QVector<bool> lOldSeen(lOldEntries.count(), false);
+	QVector<bool> lNewSeen(lNewEntries.count(), false);
+
+	// Data inserted or removed near the start shifts every later entry, but sub
+	// trees after the edit keep their ids. Pair entries by id first.
+	QVector<ChunkOidIndex> lOldByOid(lOldEntries.count());
+	for(int i = 0; i < lOldEntries.count(); ++i) {
+		lOldByOid[i].mOid = lOldEntries.at(i).mOid;
+		lOldByOid[i].mIndex = i;
+	}
+	qSort(lOldByOid.begin(), lOldByOid.end(), oidIndexLessThan);
+	for(int i = 0; i < lNewEntries.count(); ++i) {
+		ChunkOidIndex lKey;
+		lKey.mOid = lNewEntries.at(i).mOid;
+		QVector<ChunkOidIndex>::const_iterator lIt = std::lower_bound(lOldByOid.constBegin(), lOldByOid.constEnd(),
+		                                                              lKey, oidIndexLessThan);
+		for(; lIt != lOldByOid.constEnd() && git_oid_equal(&lIt->mOid, &lKey.mOid); ++lIt) {
+			if(!lOldSeen.at(lIt->mIndex) && lOldEntries.at(lIt->mIndex).mIsTree == lNewEntries.at(i).mIsTree) {
+				lOldSeen[lIt->mIndex] = true;
+				lNewSeen[i] = true; // same data, maybe at another place
+				break;
+			}
+		}
+	}
+
+	// What is left is compared by offset, and only then leaf by leaf.
+	QHash<quint64, int> lOldIndexes;
+	lOldIndexes.reserve(lOldEntries.count());
+	for(int i = 0; i < lOldEntries.count(); ++i) {
+		if(!lOldSeen.at(i)) {
+			lOldIndexes.insert(lOldEntries.at(i).mOffset, i);
+		}
+	}
+	for(int i = 0; i < lNewEntries.count(); ++i) {
+		if(lNewSeen.at(i)) {
+			continue;
+		}
+		const ChunkTreeEntry &lNewEntry = lNewEntries.at(i);
+		quint64 lSize;
+		if(!entrySize(lNewEntries, i, pSize, lSize)) {
+			return false;
+		}
+		const quint64 lOffset = pOffset + lNewEntry.mOffset;
+		const int lOldIndex = lOldIndexes.value(lNewEntry.mOffset, -1);
+		if(lOldIndex < 0) {
+			if(!collectNewChunks(pContext, lNewEntry, lOffset, lSize)) {
+				return false;
+			}
+			continue;
+		}
+		lOldSeen[lOldIndex] = true;
+		const ChunkTreeEntry &lOldEntry = lOldEntries.at(lOldIndex);
+		if(lOldEntry.mIsTree && lNewEntry.mIsTree) {
+			if(!diffChunkTrees(pContext, &lOldEntry.mOid, &lNewEntry.mOid, lOffset, lSize)) {
+				return false;
+			}
+		} else if(!collectOldChunks(pContext, lOldEntry) ||
+		          !collectNewChunks(pContext, lNewEntry, lOffset, lSize)) {
+			return false;
+		}
+	}
+	for(int i = 0; i < lOldEntries.count(); ++i) {
+		if(!lOldSeen.at(i) && !collectOldChunks(pContext, lOldEntries.at(i))) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool diffChunkedFiles(git_repository *pRepository, const git_oid *pOldOid, const git_oid *pNewOid,
+                      ChunkChanges &pChanges) {
+	TraceSpan lSpan("diffChunkedFiles", "filedigger");
+	pChanges.mFileSize = calculateChunkFileSize(pNewOid, pRepository);
+	pChanges.mChangedBytes = 0;
+	pChanges.mChangedRanges.clear();
+	if(git_oid_equal(pOldOid, pNewOid)) {
+		return true;
+	}
+	ChunkDiffContext lContext;
+	lContext.mRepository = pRepository;
+	if(!diffChunkTrees(lContext, pOldOid, pNewOid, 0, pChanges.mFileSize)) {
+		return false;
+	}
+	qSort(lContext.mOldChunks.begin(), lContext.mOldChunks.end(), oidLessThan);
+	// chunks were collected in file order.
+	foreach(const ChunkLeaf &lChunk, lContext.mNewChunks) {
+		if(std::binary_search(lContext.mOldChunks.constBegin(), lContext.mOldChunks.constEnd(), lChunk.mOid,
+		                      oidLessThan)) {
+			continue;
+		}
+		pChanges.mChangedBytes += lChunk.mSize;
+		if(!pChanges.mChangedRanges.isEmpty() &&
+		      pChanges.mChangedRanges.last().mOffset + pChanges.mChangedRanges.last().mSize == lChunk.mOffset) {
+			pChanges.mChangedRanges.last().mSize += lChunk.mSize;
+		} else {
+			ChunkRange lRange;
+			lRange.mOffset = lChunk.mOffset;
+			lRange.mSize = lChunk.mSize;
+			pChanges.mChangedRanges.append(lRange);
+		}
+	}
+	return true;
+}
+
+ChunkDiffer::ChunkDiffer()
+   : QObject(), mRepository(nullptr)
+{
+}
+
+ChunkDiffer::~ChunkDiffer() {
+	if(mRepository != nullptr) {
+		git_repository_free(mRepository);
+	}
+}
+
+void ChunkDiffer::compare(const QString &pRepositoryPath, const QByteArray &pOldOid, const QByteArray &pNewOid) {
+	ChunkChanges lChanges;
+	if(mRepository == nullptr || pRepositoryPath != mRepositoryPath) {
+		if(mRepository != nullptr) {
+			git_repository_free(mRepository);
+			mRepository = nullptr;
+		}
+		if(0 != git_repository_open(&mRepository, pRepositoryPath.toLocal8Bit())) {
+			mRepository = nullptr;
+			emit compared(pOldOid, pNewOid, lChanges, false);
+			return;
+		}
+		mRepositoryPath = pRepositoryPath;
+	}
+	git_oid lOldOid, lNewOid;
+	git_oid_fromraw(&lOldOid, reinterpret_cast<const unsigned char *>(pOldOid.constData()));
+	git_oid_fromraw(&lNewOid, reinterpret_cast<const unsigned char *>(pNewOid.constData()));
+	const bool lOk = diffChunkedFiles(mRepository, &lOldOid, &lNewOid, lChanges);
+	emit compared(pOldOid, pNewOid, lChanges, lOk);
+}
@@ -0,0 +1,70 @@
+/***************************************************************************
+ *   Copyright Simon Persson                                               *
+ *   simonpersson1@gmail.com                                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef CHUNKDIFF_H
+#define CHUNKDIFF_H
+
+#include <QMetaType>
+#include <QObject>
+#include <QVector>
+
+#include <git2.h>
+
+struct ChunkRange {
+	quint64 mOffset;
+	quint64 mSize;
+};
+
+struct ChunkChanges {
+	quint64 mFileSize;
+	quint64 mChangedBytes;
+	QVector<ChunkRange> mChangedRanges; // in the newer version, sorted and merged
+};
+
+Q_DECLARE_METATYPE(ChunkChanges)
+
+// Compares two versions of a file that bup has split into chunks, without
+// reading the chunk data. Chunk trees are walked side by side, sub trees with
+// the same id are skipped wherever they moved to and the rest are paired by
+// offset. A chunk of the newer version counts as changed unless the same
+// chunk is found in the differing parts of the older version, so data that
+// only moved is not reported.
+bool diffChunkedFiles(git_repository *pRepository, const git_oid *pOldOid, const git_oid *pNewOid,
+                      ChunkChanges &pChanges);
+
+// Runs diffChunkedFiles in a worker thread, with a repository handle of its own.
+class ChunkDiffer : public QObject {
+	Q_OBJECT
+public:
+	ChunkDiffer();
+	~ChunkDiffer();
+
+public slots:
+	void compare(const QString &pRepositoryPath, const QByteArray &pOldOid, const QByteArray &pNewOid);
+
+signals:
+	void compared(const QByteArray &pOldOid, const QByteArray &pNewOid, const ChunkChanges &pChanges, bool pOk);
+
+protected:
+	git_repository *mRepository;
+	QString mRepositoryPath;
+};
+
+#endif // CHUNKDIFF_H
@@ -0,0 +1,137 @@
+/***************************************************************************
+ *   Copyright Simon Persson                                               *
+ *   simonpersson1@gmail.com                                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "deletedfilesdialog.h"
+#include "deletedfilesfinder.h"
+#include "mergedvfs.h"
+#include "vfshelpers.h"
+
+#include <KLocalizedString>
+#include <KRun>
+
+#include <QComboBox>
+#include <QDialogButtonBox>
+#include <QHeaderView>
+#include <QIcon>
+#include <QLabel>
+#include <QTimer>
+#include <QTreeWidget>
+#include <QVBoxLayout>
+
+DeletedFilesDialog::DeletedFilesDialog(MergedRepository *pRepository, QWidget *pParent)
+   : QDialog(pParent), mRepository(pRepository), mFinder(nullptr)
+{
+	setWindowTitle(i18nc("@title:window", "Find Deleted Files"));
+	// one backup is searched per round of the event loop, the dialog stays responsive.
+	mSearchTimer = new QTimer(this);
+	mSearchTimer->setSingleShot(true);
+	mSearchTimer->setInterval(0);
+	connect(mSearchTimer, &QTimer::timeout, this, &DeletedFilesDialog::searchNextSnapshot);
+
+	mReferenceCombo = new QComboBox;
+	const VersionList *lVersions = mRepository->versionList();
+	for(int i = 0; i < lVersions->count(); ++i) {
+		mReferenceCombo->addItem(vfsTimeToString(lVersions->commitTime(i)));
+	}
+	mStatusLabel = new QLabel;
+	mResultView = new QTreeWidget;
+	mResultView->setRootIsDecorated(false);
+	mResultView->setHeaderLabels(QStringList() << i18nc("@title:column", "Path")
+	                                           << i18nc("@title:column", "Last backup with it"));
+	mResultView->header()->setSectionResizeMode(0, QHeaderView::Stretch);
+	mResultView->header()->setStretchLastSection(false);
+	connect(mResultView, &QTreeWidget::itemActivated, this, &DeletedFilesDialog::openItem);
+
+	QHBoxLayout *lReferenceLayout = new QHBoxLayout;
+	lReferenceLayout->addWidget(new QLabel(i18nc("@label:listbox", "Missing from the backup from:")));
+	lReferenceLayout->addWidget(mReferenceCombo, 1);
+	QDialogButtonBox *lButtons = new QDialogButtonBox(QDialogButtonBox::Close);
+	connect(lButtons, &QDialogButtonBox::rejected, this, &QDialog::close);
+
+	QVBoxLayout *lLayout = new QVBoxLayout;
+	lLayout->addLayout(lReferenceLayout);
+	lLayout->addWidget(mResultView, 1);
+	lLayout->addWidget(mStatusLabel);
+	lLayout->addWidget(lButtons);
+	setLayout(lLayout);
+	resize(700, 500);
+
+	connect(mReferenceCombo, static_cast<void (QComboBox::*)(int)>(&QComboBox::currentIndexChanged),
+	        this, &DeletedFilesDialog::startSearch);
+	startSearch(0);
+}
+
+DeletedFilesDialog::~DeletedFilesDialog() {
+	delete mFinder;
+}
+
+void DeletedFilesDialog::startSearch(int pReferenceIndex) {
+	const VersionList *lVersions = mRepository->versionList();
+	if(pReferenceIndex < 0 || pReferenceIndex >= lVersions->count()) {
+		return;
+	}
+	delete mFinder;
+	mFinder = new DeletedFilesFinder(mRepository->listingCache(), &lVersions->at(pReferenceIndex)->mOid);
+	mReferenceIndex = pReferenceIndex;
+	mNextIndex = 0;
+	mResultView->clear();
+	mSearchTimer->start();
+}
+
+void DeletedFilesDialog::searchNextSnapshot() {
+	const VersionList *lVersions = mRepository->versionList();
+	if(mNextIndex == mReferenceIndex) {
+		++mNextIndex;
+	}
+	if(mFinder == nullptr || mNextIndex >= lVersions->count()) {
+		mStatusLabel->setText(i18ncp("@info:status", "Done, found one item.", "Done, found %1 items.",
+		                             mResultView->topLevelItemCount()));
+		return;
+	}
+	const VersionData *lVersion = lVersions->at(mNextIndex);
+	const QString lTime = vfsTimeToString(lVersions->commitTime(mNextIndex));
+
+	DeletedFileList lFound;
+	if(!mFinder->searchSnapshot(&lVersion->mOid, lFound)) {
+		mRepository->askForIntegrityCheck();
+	}
+	foreach(const DeletedFile &lFile, lFound) {
+		QString lPath = lFile.mPath.join(QLatin1Char('/'));
+		if(S_ISDIR(lFile.mMode)) {
+			lPath.append(QLatin1Char('/'));
+		}
+		QTreeWidgetItem *lItem = new QTreeWidgetItem(QStringList() << lPath << lTime);
+		lItem->setIcon(0, QIcon::fromTheme(S_ISDIR(lFile.mMode) ? QStringLiteral("folder")
+		                                                         : QStringLiteral("text-plain")));
+		lItem->setData(0, Qt::UserRole, mNextIndex);
+		mResultView->addTopLevelItem(lItem);
+	}
+	++mNextIndex;
+	mStatusLabel->setText(i18nc("@info:status", "Searching, %1 of %2 backups done...",
+	                            mNextIndex, lVersions->count()));
+	mSearchTimer->start();
+}
+
+void DeletedFilesDialog::openItem(QTreeWidgetItem *pItem) {
+	const int lVersionIndex = pItem->data(0, Qt::UserRole).toInt();
+	QUrl lUrl;
+	mRepository->getBupUrl(lVersionIndex, &lUrl);
+	lUrl.setPath(lUrl.path() + QLatin1Char('/') + pItem->text(0));
+	new KRun(lUrl, this);
+}
@@ -0,0 +1,61 @@
+/***************************************************************************
+ *   Copyright Simon Persson                                               *
+ *   simonpersson1@gmail.com                                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef DELETEDFILESDIALOG_H
+#define DELETEDFILESDIALOG_H
+
+#include <QDialog>
+
+class DeletedFilesFinder;
+class MergedRepository;
+class QComboBox;
+class QLabel;
+class QTimer;
+class QTreeWidget;
+class QTreeWidgetItem;
+
+// Lists files and folders which are missing from a chosen backup but exist
+// in other ones. Backups are searched one at a time from newest to oldest,
+// results show up while the search goes on.
+class DeletedFilesDialog : public QDialog
+{
+	Q_OBJECT
+
+public:
+	explicit DeletedFilesDialog(MergedRepository *pRepository, QWidget *pParent = nullptr);
+	~DeletedFilesDialog();
+
+protected slots:
+	void startSearch(int pReferenceIndex);
+	void searchNextSnapshot();
+	void openItem(QTreeWidgetItem *pItem);
+
+protected:
+	MergedRepository *mRepository;
+	DeletedFilesFinder *mFinder;
+	int mReferenceIndex;
+	int mNextIndex;
+	QTimer *mSearchTimer;
+	QComboBox *mReferenceCombo;
+	QLabel *mStatusLabel;
+	QTreeWidget *mResultView;
+};
+
+#endif // DELETEDFILESDIALOG_H
@@ -0,0 +1,89 @@
+/***************************************************************************
+ *   Copyright Simon Persson                                               *
+ *   simonpersson1@gmail.com                                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "deletedfilesfinder.h"
+#include "kuptrace.h"
+#include "listingcache.h"
+
+#include <QHash>
+
+#include <sys/stat.h>
+
+DeletedFilesFinder::DeletedFilesFinder(ListingCache *pListingCache, const git_oid *pReferenceTree) {
+	mListingCache = pListingCache;
+	mReferenceTree = *pReferenceTree;
+}
+
+bool DeletedFilesFinder::searchSnapshot(const git_oid *pTree, DeletedFileList &pFound) {
+	TraceSpan lSpan("DeletedFilesFinder::searchSnapshot", "filedigger");
+	pFound.clear();
+	return searchTree(pTree, &mReferenceTree, QStringList(), pFound);
+}
+
+bool DeletedFilesFinder::searchTree(const git_oid *pTree, const git_oid *pReferenceTree, const QStringList &pPath,
+                                    DeletedFileList &pFound) {
+	if(pReferenceTree != nullptr && git_oid_equal(pTree, pReferenceTree)) {
+		return true;
+	}
+	QByteArray lSearchKey(reinterpret_cast<const char *>(pTree->id), GIT_OID_RAWSZ);
+	lSearchKey.append(pPath.join(QLatin1Char('/')).toUtf8());
+	if(mSearchedTrees.contains(lSearchKey)) {
+		return true;
+	}
+	mSearchedTrees.insert(lSearchKey);
+
+	ListingEntryList lEntries, lReferenceEntries;
+	if(!mListingCache->basicListing(pTree, lEntries) ||
+	      (pReferenceTree != nullptr && !mListingCache->basicListing(pReferenceTree, lReferenceEntries))) {
+		return false;
+	}
+	QHash<QString, int> lReferenceIndexes;
+	lReferenceIndexes.reserve(lReferenceEntries.count());
+	for(int i = 0; i < lReferenceEntries.count(); ++i) {
+		lReferenceIndexes.insert(lReferenceEntries.at(i).mName, i);
+	}
+
+	foreach(const ListingEntry &lEntry, lEntries) {
+		QStringList lPath = pPath;
+		lPath.append(lEntry.mName);
+		const int lReferenceIndex = lReferenceIndexes.value(lEntry.mName, -1);
+		if(lReferenceIndex >= 0) {
+			const ListingEntry &lReferenceEntry = lReferenceEntries.at(lReferenceIndex);
+			if(S_ISDIR(lEntry.mTreeMode) == S_ISDIR(lReferenceEntry.mTreeMode)) {
+				// still there, maybe changed. Only folders can hide deleted files.
+				if(S_ISDIR(lEntry.mTreeMode) &&
+				      !searchTree(&lEntry.mOid, &lReferenceEntry.mOid, lPath, pFound)) {
+					return false;
+				}
+				continue;
+			}
+		}
+		const QString lPathString = lPath.join(QLatin1Char('/'));
+		if(mReportedPaths.contains(lPathString)) {
+			continue;
+		}
+		mReportedPaths.insert(lPathString);
+		DeletedFile lDeletedFile;
+		lDeletedFile.mPath = lPath;
+		lDeletedFile.mMode = lEntry.mTreeMode;
+		lDeletedFile.mOid = lEntry.mOid;
+		pFound.append(lDeletedFile);
+	}
+	return true;
+}
@@ -0,0 +1,60 @@
+/***************************************************************************
+ *   Copyright Simon Persson                                               *
+ *   simonpersson1@gmail.com                                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef DELETEDFILESFINDER_H
+#define DELETEDFILESFINDER_H
+
+#include <QSet>
+#include <QStringList>
+#include <QVector>
+
+#include <git2.h>
+
+class ListingCache;
+
+struct DeletedFile {
+	QStringList mPath;
+	uint mMode;
+	git_oid mOid;
+};
+
+typedef QVector<DeletedFile> DeletedFileList;
+
+// Finds paths that exist in older snapshots but not in a reference snapshot.
+// Give it snapshots from newest to oldest, each path is reported with the
+// first (so the newest) snapshot it was found in. Sub trees already searched
+// at the same path, or identical to the reference, are skipped. A deleted
+// folder is reported once as a whole.
+class DeletedFilesFinder {
+public:
+	DeletedFilesFinder(ListingCache *pListingCache, const git_oid *pReferenceTree);
+	bool searchSnapshot(const git_oid *pTree, DeletedFileList &pFound);
+
+protected:
+	bool searchTree(const git_oid *pTree, const git_oid *pReferenceTree, const QStringList &pPath,
+	                DeletedFileList &pFound);
+
+	ListingCache *mListingCache;
+	git_oid mReferenceTree;
+	QSet<QByteArray> mSearchedTrees; // tree oid followed by the path
+	QSet<QString> mReportedPaths;
+};
+
+#endif // DELETEDFILESFINDER_H
@@ -19,10 +19,16 @@
  ***************************************************************************/
 
 #include "filedigger.h"
+#include "deletedfilesdialog.h"
+#include "mergedvfs.h"
 #include "mergedvfsmodel.h"
+#include "previewpane.h"
 #include "restoredialog.h"
+#include "searchdialog.h"
+#include "treediff.h"
 #include "versionlistmodel.h"
 #include "versionlistdelegate.h"
+#include "vfshelpers.h"
 
 #include <KDirOperator>
 #include <KFilePlacesView>
@@ -34,19 +40,38 @@
 #include <KStandardAction>
 #include <KToolBar>
 
+#include <QAction>
+#include <QDialog>
+#include <QDialogButtonBox>
 #include <QLabel>
 #include <QListView>
+#include <QListWidget>
 #include <QPushButton>
 #include <QSplitter>
 #include <QTreeView>
 #include <QVBoxLayout>
 
 FileDigger::FileDigger(const QString &pRepoPath, const QString &pBranchName, QWidget *pParent)
-    : KMainWindow(pParent), mRepoPath(pRepoPath), mBranchName(pBranchName), mDirOperator(nullptr)
+    : KMainWindow(pParent), mRepository(nullptr), mMergedVfsModel(nullptr), mRepoPath(pRepoPath), mBranchName(pBranchName),
+      mDirOperator(nullptr)
 {
     setWindowIcon(QIcon::fromTheme(QStringLiteral("kup")));
     KToolBar *lAppToolBar = toolBar();
     lAppToolBar->addAction(KStandardAction::quit(this, SLOT(close()), this));
+    QAction *lChangesAction = new QAction(QIcon::fromTheme(QStringLiteral("view-list-details")),
+                                          i18nc("@action:button", "Show Changes"), this);
+    connect(lChangesAction, &QAction::triggered, this, &FileDigger::showChanges);
+    lAppToolBar->addAction(lChangesAction);
+    QAction *lDeletedAction = new QAction(QIcon::fromTheme(QStringLiteral("edit-find")),
+                                          i18nc("@action:button", "Find Deleted Files"), this);
+    connect(lDeletedAction, &QAction::triggered, this, &FileDigger::findDeletedFiles);
+    lAppToolBar->addAction(lDeletedAction);
+    QAction *lSearchAction = KStandardAction::find(this, SLOT(search()), this);
+    lAppToolBar->addAction(lSearchAction);
+    QAction *lLocationsAction = new QAction(QIcon::fromTheme(QStringLiteral("edit-copy")),
+                                            i18nc("@action:button", "Find Other Locations"), this);
+    connect(lLocationsAction, &QAction::triggered, this, &FileDigger::findOtherLocations);
+    lAppToolBar->addAction(lLocationsAction);
 
     repoPathAvailable();
 }
@@ -58,6 +83,11 @@ void FileDigger::updateVersionModel(const QModelIndex &pCurrent, const QModelInd
 	                                                QItemSelectionModel::Select);
 }
 
+void FileDigger::updatePreview(const QModelIndex &pCurrent, const QModelIndex &pPrevious) {
+	Q_UNUSED(pPrevious)
+	mPreviewPane->showVersion(mMergedVfsModel->node(mMergedVfsView->currentIndex()), pCurrent.row());
+}
+
 void FileDigger::open(const QModelIndex &pIndex) {
 	KRun::runUrl(pIndex.data(VersionBupUrlRole).value<QUrl>(),
 	             pIndex.data(VersionMimeTypeRole).toString(), this);
@@ -70,6 +100,118 @@ void FileDigger::restore(const QModelIndex &pIndex) {
 	lDialog->show();
 }
 
+void FileDigger::showChanges() {
+	if(mMergedVfsModel == nullptr) {
+		return; // no archive open yet
+	}
+	const MergedNode *lNode = mMergedVfsModel->node(mMergedVfsView->currentIndex());
+	if(lNode == nullptr || !lNode->isDirectory()) {
+		KMessageBox::information(this, xi18nc("@info messagebox",
+		                                      "Select a folder to see what changed in it."));
+		return;
+	}
+	const VersionList *lVersions = lNode->versionList();
+	const int lVersionIndex = mVersionView->currentIndex().row();
+	// versions are sorted newest first, compare with the one before.
+	if(lVersionIndex < 0 || lVersionIndex + 1 >= lVersions->count()) {
+		KMessageBox::information(this, xi18nc("@info messagebox",
+		                                      "There is no older version of this folder to compare with."));
+		return;
+	}
+	const VersionData *lNewVersion = lVersions->at(lVersionIndex);
+	const VersionData *lOldVersion = lVersions->at(lVersionIndex + 1);
+	TreeChangeList lChanges;
+	if(!diffTrees(lNode->listingCache(), &lOldVersion->mOid, &lNewVersion->mOid, lChanges)) {
+		lNode->askForIntegrityCheck();
+		return;
+	}
+
+	QDialog *lDialog = new QDialog(this);
+	lDialog->setAttribute(Qt::WA_DeleteOnClose);
+	lDialog->setWindowTitle(i18nc("@title:window", "Changes"));
+	QVBoxLayout *lLayout = new QVBoxLayout;
+	lLayout->addWidget(new QLabel(xi18nc("@label %1 and %2 are backup times",
+	                                     "Changes between the backups from %1 and %2:",
+	                                     vfsTimeToString(lVersions->commitTime(lVersionIndex + 1)),
+	                                     vfsTimeToString(lVersions->commitTime(lVersionIndex)))));
+	QListWidget *lList = new QListWidget;
+	foreach(const TreeChange &lChange, lChanges) {
+		QString lPath = lChange.mPath.join(QLatin1Char('/'));
+		if(S_ISDIR(lChange.mMode)) {
+			lPath.append(QLatin1Char('/'));
+		}
+		QString lIconName;
+		if(lChange.mType == TREE_CHANGE_ADDED) {
+			lIconName = QStringLiteral("list-add");
+		} else if(lChange.mType == TREE_CHANGE_REMOVED) {
+			lIconName = QStringLiteral("list-remove");
+		} else {
+			lIconName = QStringLiteral("document-edit");
+		}
+		lList->addItem(new QListWidgetItem(QIcon::fromTheme(lIconName), lPath));
+	}
+	if(lChanges.isEmpty()) {
+		lList->addItem(i18nc("@item:inlistbox", "No files were changed."));
+	}
+	lLayout->addWidget(lList, 1);
+	QDialogButtonBox *lButtons = new QDialogButtonBox(QDialogButtonBox::Close);
+	connect(lButtons, &QDialogButtonBox::rejected, lDialog, &QDialog::close);
+	lLayout->addWidget(lButtons);
+	lDialog->setLayout(lLayout);
+	lDialog->resize(600, 400);
+	lDialog->show();
+}
+
+void FileDigger::findDeletedFiles() {
+	if(mRepository == nullptr) {
+		return; // no archive open yet
+	}
+	DeletedFilesDialog *lDialog = new DeletedFilesDialog(mRepository, this);
+	lDialog->setAttribute(Qt::WA_DeleteOnClose);
+	lDialog->show();
+}
+
+void FileDigger::search() {
+	if(mRepository == nullptr) {
+		return; // no archive open yet
+	}
+	SearchDialog *lDialog = new SearchDialog(mRepository, nullptr, this);
+	lDialog->setAttribute(Qt::WA_DeleteOnClose);
+	connect(lDialog, &SearchDialog::pathActivated, this, &FileDigger::selectPath);
+	lDialog->show();
+}
+
+void FileDigger::findOtherLocations() {
+	if(mMergedVfsModel == nullptr) {
+		return; // no archive open yet
+	}
+	const MergedNode *lNode = mMergedVfsModel->node(mMergedVfsView->currentIndex());
+	const int lVersionIndex = mVersionView->currentIndex().row();
+	if(lNode == nullptr || lNode->isDirectory() || lVersionIndex < 0 ||
+	      lVersionIndex >= lNode->versionList()->count()) {
+		KMessageBox::information(this, xi18nc("@info messagebox",
+		                                      "Select a version of a file to see where else it was backed up."));
+		return;
+	}
+	SearchDialog *lDialog = new SearchDialog(mRepository, &lNode->versionList()->at(lVersionIndex)->mOid, this);
+	lDialog->setAttribute(Qt::WA_DeleteOnClose);
+	connect(lDialog, &SearchDialog::pathActivated, this, &FileDigger::selectPath);
+	lDialog->show();
+}
+
+void FileDigger::selectPath(const QStringList &pPath, bool pIsDirectory) {
+	if(mMergedVfsModel == nullptr) {
+		return;
+	}
+	const QModelIndex lIndex = mMergedVfsModel->indexForPath(pPath, pIsDirectory);
+	if(!lIndex.isValid()) {
+		return;
+	}
+	mMergedVfsView->scrollTo(lIndex);
+	mMergedVfsView->selectionModel()->setCurrentIndex(lIndex, QItemSelectionModel::ClearAndSelect);
+	activateWindow();
+}
+
 void FileDigger::repoPathAvailable() {
 	if(mRepoPath.isEmpty()) {
 		createSelectionView();
@@ -97,7 +239,7 @@ void FileDigger::enterUrl(QUrl pUrl) {
 }
 
 MergedRepository *FileDigger::createRepo() {
-    MergedRepository *lRepository = new MergedRepository(nullptr, mRepoPath, mBranchName);
+    MergedRepository *lRepository = new MergedRepository(mRepoPath, mBranchName);
     if(!lRepository->open()) {
         KMessageBox::sorry(nullptr, xi18nc("@info messagebox, %1 is a folder path",
                                        "The backup archive <filename>%1</filename> could not be opened."
@@ -119,6 +261,7 @@ MergedRepository *FileDigger::createRepo() {
 
 void FileDigger::createRepoView(MergedRepository *pRepository) {
     QSplitter *lSplitter = new QSplitter();
+    mRepository = pRepository;
     mMergedVfsModel = new MergedVfsModel(pRepository, this);
     mMergedVfsView = new QTreeView();
     mMergedVfsView->setHeaderHidden(true);
@@ -135,6 +278,10 @@ void FileDigger::createRepoView(MergedRepository *pRepository) {
 	VersionListDelegate *lVersionDelegate = new VersionListDelegate(mVersionView,this);
 	mVersionView->setItemDelegate(lVersionDelegate);
 	lSplitter->addWidget(mVersionView);
+	mPreviewPane = new PreviewPane();
+	lSplitter->addWidget(mPreviewPane);
+	connect(mVersionView->selectionModel(), SIGNAL(currentChanged(QModelIndex,QModelIndex)),
+	        this, SLOT(updatePreview(QModelIndex,QModelIndex)));
 	connect(lVersionDelegate, SIGNAL(openRequested(QModelIndex)), SLOT(open(QModelIndex)));
 	connect(lVersionDelegate, SIGNAL(restoreRequested(QModelIndex)), SLOT(restore(QModelIndex)));
 	mMergedVfsView->setFocus();
@@ -27,6 +27,7 @@
 class KDirOperator;
 class MergedVfsModel;
 class MergedRepository;
+class PreviewPane;
 class VersionListModel;
 class QListView;
 class QModelIndex;
@@ -40,21 +41,29 @@ public:
 
 protected slots:
 	void updateVersionModel(const QModelIndex &pCurrent, const QModelIndex &pPrevious);
+	void updatePreview(const QModelIndex &pCurrent, const QModelIndex &pPrevious);
 	void open(const QModelIndex &pIndex);
 	void restore(const QModelIndex &pIndex);
 	void repoPathAvailable();
 	void checkFileWidgetPath();
 	void enterUrl(QUrl pUrl);
+	void showChanges();
+	void findDeletedFiles();
+	void search();
+	void findOtherLocations();
+	void selectPath(const QStringList &pPath, bool pIsDirectory);
 
 protected:
 	MergedRepository *createRepo();
 	void createRepoView(MergedRepository *pRepository);
 	void createSelectionView();
+	MergedRepository *mRepository;
 	MergedVfsModel *mMergedVfsModel;
 	QTreeView *mMergedVfsView;
 
 	VersionListModel *mVersionModel;
 	QListView *mVersionView;
+	PreviewPane *mPreviewPane;
 	QString mRepoPath;
 	QString mBranchName;
 	KDirOperator *mDirOperator;
@@ -20,6 +20,7 @@
 
 #include "filedigger.h"
 #include "mergedvfs.h"
+#include "vfshelpers.h"
 
 #if LIBGIT2_VER_MAJOR == 0 && LIBGIT2_VER_MINOR >= 24
 #include <git2/global.h>
@@ -75,6 +76,17 @@ int main(int pArgCount, char **pArgArray) {
 	git_threads_init();
 	#endif
 
+	#ifdef BUNDLED_LIBGIT2
+	// Expanding a folder reads the same folder's tree from every snapshot and
+	// blobs are only read once, for their size or metadata. Spend the cache on
+	// trees and commits only.
+	git_libgit2_opts(GIT_OPT_SET_CACHE_OBJECT_LIMIT, GIT_OBJ_TREE, static_cast<size_t>(1024 * 1024));
+	git_libgit2_opts(GIT_OPT_SET_CACHE_TYPE_BUDGET, GIT_OBJ_TREE, static_cast<ssize_t>(192 * 1024 * 1024));
+	git_libgit2_opts(GIT_OPT_SET_CACHE_ADMISSION, GIT_OBJ_BLOB, static_cast<int>(GIT_CACHE_ADMIT_NEVER));
+	#endif
+	traceRepositoryReads();
+	usePackIndexCache();
+
 	FileDigger *lFileDigger = new FileDigger(lRepoPath, lParser.value(QStringLiteral("branch")));
 	lFileDigger->show();
 	int lRetVal = lApp.exec();
@@ -18,7 +18,10 @@
  *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
  ***************************************************************************/
 
+#include "commitcache.h"
 #include "kupdaemon.h"
+#include "kuptrace.h"
+#include "listingcache.h"
 #include "mergedvfs.h"
 #include "vfshelpers.h"
 #include "kupfiledigger_debug.h"
@@ -32,29 +35,32 @@
 #include <git2/branch.h>
 #include <sys/stat.h>
 
-typedef QMap<QString, MergedNode *> NameMap;
-typedef QMapIterator<QString, MergedNode *> NameMapIterator;
-
-git_repository *MergedNode::mRepository = nullptr;
-
-bool mergedNodeLessThan(const MergedNode *a, const MergedNode *b) {
-	if(a->isDirectory() != b->isDirectory()) {
-		return a->isDirectory();
+static bool mergedNodeLessThan(const MergedNode &a, const MergedNode &b) {
+	if(a.isDirectory() != b.isDirectory()) {
+		return a.isDirectory();
 	}
-	return a->objectName() < b->objectName();
+	return a.name() < b.name();
 }
 
-bool versionGreaterThan(const VersionData *a, const VersionData *b) {
-	return a->mModifiedDate > b->mModifiedDate;
+static bool versionGreaterThan(const VersionData &a, const VersionData &b) {
+	return a.mModifiedDate > b.mModifiedDate;
 }
 
+quint32 MergedTables::internName(const QString &pName) {
+	QHash<QString, quint32>::const_iterator lIter = mNameIds.constFind(pName);
+	if(lIter != mNameIds.constEnd()) {
+		return lIter.value();
+	}
+	const quint32 lNameId = static_cast<quint32>(mNames.count());
+	mNames.append(pName);
+	mNameIds.insert(pName, lNameId);
+	return lNameId;
+}
 
-MergedNode::MergedNode(QObject *pParent, const QString &pName, uint pMode)
-   :QObject(pParent)
+MergedNode::MergedNode()
+   : mTables(nullptr), mIndex(MERGED_ROOT_INDEX), mParent(MERGED_ROOT_INDEX), mFirstSubNode(0), mSubNodeCount(0),
+     mName(0), mMode(0), mSubNodesGenerated(false)
 {
-	mSubNodes = nullptr;
-	setObjectName(pName);
-	mMode = pMode;
 }
 
 void MergedNode::getBupUrl(int pVersionIndex, QUrl *pComplete, QString *pRepoPath,
@@ -63,27 +69,28 @@ void MergedNode::getBupUrl(int pVersionIndex, QUrl *pComplete, QString *pRepoPat
 	const MergedNode *lNode = this;
 	while(lNode != nullptr) {
 		lStack.append(lNode);
-		lNode = qobject_cast<const MergedNode *>(lNode->parent());
+		lNode = lNode->parentNode();
 	}
-	const MergedRepository *lRepo = qobject_cast<const MergedRepository *>(lStack.takeLast());
+	// the root is always the repository.
+	const MergedRepository *lRepo = static_cast<const MergedRepository *>(lStack.takeLast());
 	if(pComplete) {
-		pComplete->setUrl("bup://" + lRepo->objectName() + '/' + lRepo->mBranchName + '/' +
-		                  vfsTimeToString(mVersionList.at(pVersionIndex)->mCommitTime));
+		pComplete->setUrl("bup://" + lRepo->name() + '/' + lRepo->mBranchName + '/' +
+		                  vfsTimeToString(mVersionList.commitTime(pVersionIndex)));
 	}
 	if(pRepoPath) {
-		*pRepoPath = lRepo->objectName();
+		*pRepoPath = lRepo->name();
 	}
 	if(pBranchName) {
 		*pBranchName = lRepo->mBranchName;
 	}
 	if(pCommitTime) {
-		*pCommitTime = mVersionList.at(pVersionIndex)->mCommitTime;
+		*pCommitTime = mVersionList.commitTime(pVersionIndex);
 	}
 	if(pPathInRepo) {
 		pPathInRepo->clear();
 	}
 	while(!lStack.isEmpty()) {
-		QString lPathComponent = lStack.takeLast()->objectName();
+		QString lPathComponent = lStack.takeLast()->name();
 		if(pComplete) {
 			pComplete->setPath(pComplete->path() + '/' + lPathComponent);
 		}
@@ -94,17 +101,42 @@ void MergedNode::getBupUrl(int pVersionIndex, QUrl *pComplete, QString *pRepoPat
 	}
 }
 
-MergedNodeList &MergedNode::subNodes() {
-	if(mSubNodes == nullptr) {
-		mSubNodes = new MergedNodeList();
+int MergedNode::subNodeCount() {
+	if(!mSubNodesGenerated) {
+		mSubNodesGenerated = true;
 		if(S_ISDIR(mMode)) {
 			generateSubNodes();
 		}
 	}
-	return *mSubNodes;
+	return static_cast<int>(mSubNodeCount);
+}
+
+MergedNode *MergedNode::subNode(int pRow) {
+	if(pRow < 0 || pRow >= subNodeCount()) {
+		return nullptr;
+	}
+	return &mTables->mNodes[mFirstSubNode + static_cast<quint32>(pRow)];
+}
+
+MergedNode *MergedNode::parentNode() const {
+	if(this == mTables->mRoot) {
+		return nullptr;
+	}
+	if(mParent == MERGED_ROOT_INDEX) {
+		return mTables->mRoot;
+	}
+	return &mTables->mNodes[mParent];
+}
+
+int MergedNode::row() const {
+	const MergedNode *lParent = parentNode();
+	if(lParent == nullptr) {
+		return 0;
+	}
+	return static_cast<int>(mIndex - lParent->mFirstSubNode);
 }
 
-void MergedNode::askForIntegrityCheck() {
+void MergedNode::askForIntegrityCheck() const {
 	int lAnswer = KMessageBox::questionYesNo(nullptr, xi18nc("@info messagebox",
 	                                                     "Could not read this backup archive. Perhaps some files "
 	                                                     "have become corrupted. Do you want to run an integrity "
@@ -113,160 +145,150 @@ void MergedNode::askForIntegrityCheck() {
 		QDBusInterface lInterface(KUP_DBUS_SERVICE_NAME, KUP_DBUS_OBJECT_PATH);
 		if(lInterface.isValid()) {
 			lInterface.call(QStringLiteral("runIntegrityCheck"),
-			                QDir::cleanPath(QString::fromLocal8Bit(git_repository_path(mRepository))));
+			                QDir::cleanPath(QString::fromLocal8Bit(git_repository_path(repository()))));
 		}
 	}
 }
 
 void MergedNode::generateSubNodes() {
-	NameMap lSubNodeMap;
-	foreach(VersionData *lCurrentVersion, mVersionList) {
-		git_tree *lTree;
-		if(0 != git_tree_lookup(&lTree, mRepository, &lCurrentVersion->mOid)) {
+	TraceSpan lSpan("MergedNode::generateSubNodes", "filedigger");
+	// Built in a local array and added to the node table when sorted, so the
+	// sub nodes end up next to each other.
+	QVector<MergedNode> lSubNodes;
+	QHash<quint32, int> lIndexes; // name id to position in lSubNodes
+	for(int i = 0; i < mVersionList.count(); ++i) {
+		const VersionData &lCurrentVersion = mVersionList.mVersions.at(i);
+		ListingEntryList lEntries;
+		if(listingCache() == nullptr || !listingCache()->basicListing(&lCurrentVersion.mOid, lEntries)) {
 			askForIntegrityCheck();
 			continue; // try to be fault tolerant by not aborting...
 		}
-		git_blob *lMetadataBlob = nullptr;
-		VintStream *lMetadataStream = nullptr;
-		const git_tree_entry *lTreeEntry = git_tree_entry_byname(lTree, ".bupm");
-		if(lTreeEntry != nullptr && 0 == git_blob_lookup(&lMetadataBlob, mRepository, git_tree_entry_id(lTreeEntry))) {
-			lMetadataStream = new VintStream(git_blob_rawcontent(lMetadataBlob), git_blob_rawsize(lMetadataBlob), this);
-			Metadata lMetadata;
-			readMetadata(*lMetadataStream, lMetadata); // the first entry is metadata for the directory itself, discard it.
-		}
 
-		uint lEntryCount = git_tree_entrycount(lTree);
-		for(uint i = 0; i < lEntryCount; ++i) {
-			uint lMode;
-			const git_oid *lOid;
-			QString lName;
-			bool lChunked;
-			const git_tree_entry *lTreeEntry = git_tree_entry_byindex(lTree, i);
-			getEntryAttributes(lTreeEntry, lMode, lChunked, lOid, lName);
-			if(lName == QStringLiteral(".bupm")) {
-				continue;
-			}
+		foreach(const ListingEntry &lEntry, lEntries) {
+			const uint lMode = lEntry.mTreeMode;
+			const git_oid *lOid = &lEntry.mOid;
+			quint32 lName = mTables->internName(lEntry.mName);
 
-			MergedNode *lSubNode = lSubNodeMap.value(lName, nullptr);
-			if(lSubNode == nullptr) {
-				lSubNode = new MergedNode(this, lName, lMode);
-				lSubNodeMap.insert(lName, lSubNode);
-				mSubNodes->append(lSubNode);
-			} else if((S_IFMT & lMode) != (S_IFMT & lSubNode->mMode)) {
+			int lIndex = lIndexes.value(lName, -1);
+			if(lIndex >= 0 && (S_IFMT & lMode) != (S_IFMT & lSubNodes.at(lIndex).mMode)) {
+				QString lSuffixedName = lEntry.mName;
 				if(S_ISDIR(lMode)) {
-					lName.append(xi18nc("added after folder name in some cases", " (folder)"));
+					lSuffixedName.append(xi18nc("added after folder name in some cases", " (folder)"));
 				} else if(S_ISLNK(lMode)) {
-					lName.append(xi18nc("added after file name in some cases", " (symlink)"));
+					lSuffixedName.append(xi18nc("added after file name in some cases", " (symlink)"));
 				} else {
-					lName.append(xi18nc("added after file name in some cases", " (file)"));
-				}
-				lSubNode = lSubNodeMap.value(lName, nullptr);
-				if(lSubNode == nullptr) {
-					lSubNode = new MergedNode(this, lName, lMode);
-					lSubNodeMap.insert(lName, lSubNode);
-					mSubNodes->append(lSubNode);
+					lSuffixedName.append(xi18nc("added after file name in some cases", " (file)"));
 				}
+				lName = mTables->internName(lSuffixedName);
+				lIndex = lIndexes.value(lName, -1);
 			}
+			if(lIndex < 0) {
+				MergedNode lNewNode;
+				lNewNode.mTables = mTables;
+				lNewNode.mName = lName;
+				lNewNode.mMode = lMode;
+				lNewNode.mVersionList.mCommitTimes = &mTables->mCommitTimes;
+				lIndex = lSubNodes.count();
+				lSubNodes.append(lNewNode);
+				lIndexes.insert(lName, lIndex);
+			}
+			QVector<VersionData> &lVersions = lSubNodes[lIndex].mVersionList.mVersions;
 			bool lAlreadySeen = false;
-			foreach(VersionData *lVersion, lSubNode->mVersionList) {
-				if(lVersion->mOid == *lOid) {
+			foreach(const VersionData &lVersion, lVersions) {
+				if(lVersion.mOid == *lOid) {
 					lAlreadySeen = true;
 					break;
 				}
 			}
+			if(lAlreadySeen) {
+				continue;
+			}
 			if(S_ISDIR(lMode)) {
-				if(!lAlreadySeen) {
-					lSubNode->mVersionList.append(new VersionData(lOid, lCurrentVersion->mCommitTime,
-					                                              lCurrentVersion->mModifiedDate, 0));
-				}
+				lVersions.append(VersionData(lOid, lCurrentVersion.mCommitIndex, lCurrentVersion.mModifiedDate, 0));
 			} else {
 				quint64 lModifiedDate;
-				Metadata lMetadata;
-				if(lMetadataStream != nullptr && 0 == readMetadata(*lMetadataStream, lMetadata)) {
-					lModifiedDate = lMetadata.mMtime;
+				if(lEntry.mHasMetadata) {
+					lModifiedDate = lEntry.mMetadata.mMtime;
 				} else {
-					lModifiedDate = lCurrentVersion->mModifiedDate;
-				}
-				if(!lAlreadySeen) {
-					lSubNode->mVersionList.append(new VersionData(lChunked, lOid,
-					                                              lCurrentVersion->mCommitTime,
-					                                              lModifiedDate));
+					lModifiedDate = lCurrentVersion.mModifiedDate;
 				}
+				lVersions.append(VersionData(lEntry.mChunked, lOid, lCurrentVersion.mCommitIndex, lModifiedDate));
 			}
 		}
-		if(lMetadataStream != nullptr) {
-			delete lMetadataStream;
-			git_blob_free(lMetadataBlob);
-		}
-		git_tree_free(lTree);
 	}
-	qSort(mSubNodes->begin(), mSubNodes->end(), mergedNodeLessThan);
-	foreach(MergedNode *lNode, *mSubNodes) {
-		qSort(lNode->mVersionList.begin(), lNode->mVersionList.end(), versionGreaterThan);
+	qSort(lSubNodes.begin(), lSubNodes.end(), mergedNodeLessThan);
+	mFirstSubNode = static_cast<quint32>(mTables->mNodes.size());
+	mSubNodeCount = static_cast<quint32>(lSubNodes.count());
+	for(int i = 0; i < lSubNodes.count(); ++i) {
+		MergedNode &lSubNode = lSubNodes[i];
+		qSort(lSubNode.mVersionList.mVersions.begin(), lSubNode.mVersionList.mVersions.end(), versionGreaterThan);
+		lSubNode.mVersionList.mVersions.squeeze();
+		lSubNode.mIndex = mFirstSubNode + static_cast<quint32>(i);
+		lSubNode.mParent = mIndex;
+		mTables->mNodes.push_back(lSubNode);
 	}
 }
 
-MergedRepository::MergedRepository(QObject *pParent, const QString &pRepositoryPath, const QString &pBranchName)
-   : MergedNode(pParent, pRepositoryPath, DEFAULT_MODE_DIRECTORY), mBranchName(pBranchName)
+MergedRepository::MergedRepository(const QString &pRepositoryPath, const QString &pBranchName)
+   : MergedNode(), mBranchName(pBranchName)
 {
-	if(!objectName().endsWith(QLatin1Char('/'))) {
-		setObjectName(objectName() + QLatin1Char('/'));
+	mOwnTables.mRepository = nullptr;
+	mOwnTables.mListingCache = nullptr;
+	mOwnTables.mRoot = this;
+	mTables = &mOwnTables;
+	mMode = DEFAULT_MODE_DIRECTORY;
+	mVersionList.mCommitTimes = &mOwnTables.mCommitTimes;
+	QString lName = pRepositoryPath;
+	if(!lName.endsWith(QLatin1Char('/'))) {
+		lName.append(QLatin1Char('/'));
 	}
+	mName = mOwnTables.internName(lName);
 }
 
 MergedRepository::~MergedRepository() {
-	if(mRepository != nullptr) {
-		git_repository_free(mRepository);
+	// the nodes hold nothing from the repository, it can go first.
+	delete mOwnTables.mListingCache;
+	if(mOwnTables.mRepository != nullptr) {
+		git_repository_free(mOwnTables.mRepository);
 	}
 }
 
 bool MergedRepository::open() {
-	if(0 != git_repository_open(&mRepository, objectName().toLocal8Bit())) {
-		qCWarning(KUPFILEDIGGER) << "could not open repository " << objectName();
-		mRepository = nullptr;
+	if(0 != git_repository_open(&mOwnTables.mRepository, name().toLocal8Bit())) {
+		qCWarning(KUPFILEDIGGER) << "could not open repository " << name();
+		mOwnTables.mRepository = nullptr;
 		return false;
 	}
+	mOwnTables.mListingCache = new ListingCache(mOwnTables.mRepository);
 	return true;
 }
 
 bool MergedRepository::readBranch() {
-	if(mRepository == nullptr) {
+	if(mOwnTables.mRepository == nullptr) {
 		return false;
 	}
-	git_revwalk *lRevisionWalker;
-	if(0 != git_revwalk_new(&lRevisionWalker, mRepository)) {
-		qCWarning(KUPFILEDIGGER) << "could not create a revision walker in repository " << objectName();
-		return false;
-	}
-
 	QString lCompleteBranchName = QStringLiteral("refs/heads/");
 	lCompleteBranchName.append(mBranchName);
-	if(0 != git_revwalk_push_ref(lRevisionWalker, lCompleteBranchName.toLocal8Bit())) {
-		qCWarning(KUPFILEDIGGER) << "Unable to read branch " << mBranchName << " in repository " << objectName();
-		git_revwalk_free(lRevisionWalker);
+	CommitMetadataList lCommits;
+	if(!readBranchCommits(mOwnTables.mRepository, lCompleteBranchName.toLocal8Bit(), lCommits)) {
+		qCWarning(KUPFILEDIGGER) << "Unable to read branch " << mBranchName << " in repository " << name();
 		return false;
 	}
-	bool lEmptyList = true;
-	git_oid lOid;
-	while(0 == git_revwalk_next(&lOid, lRevisionWalker)) {
-		git_commit *lCommit;
-		if(0 != git_commit_lookup(&lCommit, mRepository, &lOid)) {
-			continue;
-		}
-		git_time_t lTime = git_commit_time(lCommit);
-		mVersionList.append(new VersionData(git_commit_tree_id(lCommit), lTime, lTime, 0));
-		lEmptyList = false;
-		git_commit_free(lCommit);
+	mOwnTables.mCommitTimes.reserve(lCommits.count());
+	mVersionList.mVersions.reserve(lCommits.count());
+	foreach(const CommitMetadata &lCommit, lCommits) {
+		const quint32 lCommitIndex = static_cast<quint32>(mOwnTables.mCommitTimes.count());
+		mOwnTables.mCommitTimes.append(lCommit.mCommitTime);
+		mVersionList.mVersions.append(VersionData(&lCommit.mTreeOid, lCommitIndex, lCommit.mCommitTime, 0));
 	}
-	git_revwalk_free(lRevisionWalker);
-	return !lEmptyList;
+	return !lCommits.isEmpty();
 }
 
 bool MergedRepository::permissionsOk() {
-	if(mRepository == nullptr) {
+	if(mOwnTables.mRepository == nullptr) {
 		return false;
 	}
-	QDir lRepoDir(objectName());
+	QDir lRepoDir(name());
 	if(!lRepoDir.exists()) {
 		return false;
 	}
@@ -298,15 +320,15 @@ bool operator ==(const git_oid &pOidA, const git_oid &pOidB) {
 }
 
 
-quint64 VersionData::size() {
+quint64 VersionData::size(git_repository *pRepository) const {
 	if(mSizeIsValid) {
 		return mSize;
 	}
 	if(mChunkedFile) {
-		mSize = calculateChunkFileSize(&mOid, MergedNode::mRepository);
+		mSize = calculateChunkFileSize(&mOid, pRepository);
 	} else {
 		git_blob *lBlob;
-		if(0 == git_blob_lookup(&lBlob, MergedNode::mRepository, &mOid)) {
+		if(0 == git_blob_lookup(&lBlob, pRepository, &mOid)) {
 			mSize = git_blob_rawsize(lBlob);
 			git_blob_free(lBlob);
 		} else {
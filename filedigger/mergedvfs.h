@@ -25,80 +25,137 @@
 uint qHash(git_oid pOid);
 bool operator ==(const git_oid &pOidA, const git_oid &pOidB);
 #include <QHash>
-#include <QObject>
-
+#include <QStringList>
 #include <QUrl>
+#include <QVector>
 
+#include <deque>
 #include <sys/stat.h>
 
+class ListingCache;
+struct MergedTables;
+
+// One version of a node, kept by value in the node's version list. The
+// commit is an index into the commit table shared by the whole tree.
 struct VersionData {
-	VersionData(bool pChunkedFile, const git_oid *pOid, quint64 pCommitTime, quint64 pModifiedDate)
-	   :mChunkedFile(pChunkedFile), mOid(*pOid), mCommitTime(pCommitTime), mModifiedDate(pModifiedDate)
-	{
-		mSizeIsValid = false;
-	}
-
-	VersionData(const git_oid *pOid, quint64 pCommitTime, quint64 pModifiedDate, quint64 pSize)
-	   :mOid(*pOid), mCommitTime(pCommitTime), mModifiedDate(pModifiedDate), mSize(pSize)
-	{
-		mSizeIsValid = true;
-	}
-
-	quint64 size();
-	bool mSizeIsValid;
-	bool mChunkedFile;
+	VersionData() {}
+	VersionData(bool pChunkedFile, const git_oid *pOid, quint32 pCommitIndex, quint64 pModifiedDate)
+	   : mOid(*pOid), mCommitIndex(pCommitIndex), mModifiedDate(pModifiedDate), mChunkedFile(pChunkedFile),
+	     mSizeIsValid(false), mSize(0)
+	{}
+
+	VersionData(const git_oid *pOid, quint32 pCommitIndex, quint64 pModifiedDate, quint64 pSize)
+	   : mOid(*pOid), mCommitIndex(pCommitIndex), mModifiedDate(pModifiedDate), mChunkedFile(false),
+	     mSizeIsValid(true), mSize(pSize)
+	{}
+
+	quint64 size(git_repository *pRepository) const;
 	git_oid mOid;
-	quint64 mCommitTime;
+	quint32 mCommitIndex;
 	quint64 mModifiedDate;
+	bool mChunkedFile;
+	mutable bool mSizeIsValid;
 
 protected:
-	quint64 mSize;
+	mutable quint64 mSize;
 };
+Q_DECLARE_TYPEINFO(VersionData, Q_MOVABLE_TYPE);
 
-class MergedNode;
-typedef QList<MergedNode*> MergedNodeList;
-typedef QListIterator<MergedNode*> MergedNodeListIterator;
-typedef QList<VersionData *> VersionList;
-typedef QListIterator<VersionData *> VersionListIterator;
+// Versions of a node, newest first, in one array.
+class VersionList {
+public:
+	VersionList() : mCommitTimes(nullptr) {}
+	int count() const { return mVersions.count(); }
+	bool isEmpty() const { return mVersions.isEmpty(); }
+	const VersionData *at(int pIndex) const { return &mVersions.at(pIndex); }
+	quint64 commitTime(int pIndex) const { return mCommitTimes->at(mVersions.at(pIndex).mCommitIndex); }
 
-class MergedNode: public QObject {
-	Q_OBJECT
-	friend class VersionData;
+protected:
+	friend class MergedNode;
+	friend class MergedRepository;
+	QVector<VersionData> mVersions;
+	const QVector<quint64> *mCommitTimes;
+};
+
+// A file or folder merged from all backups. Nodes are small values in the
+// node table, the sub nodes of a folder are a range in it, added when first
+// asked for. Pointers to nodes stay valid as long as the tree exists.
+class MergedNode {
 public:
-	MergedNode(QObject *pParent, const QString &pName, uint pMode);
-	virtual ~MergedNode() {
-		if(mSubNodes != nullptr) {
-			delete mSubNodes;
-		}
-	}
+	MergedNode();
 	bool isDirectory() const { return S_ISDIR(mMode); }
+	QString name() const;
 	void getBupUrl(int pVersionIndex, QUrl *pComplete, QString *pRepoPath = nullptr, QString *pBranchName = nullptr,
 	               quint64 *pCommitTime = nullptr, QString *pPathInRepo = nullptr) const;
-	virtual MergedNodeList &subNodes();
+	int subNodeCount();
+	MergedNode *subNode(int pRow);
+	MergedNode *parentNode() const;
+	// Position among the sub nodes of the parent.
+	int row() const;
 	const VersionList *versionList() const { return &mVersionList; }
 	uint mode() const { return mMode; }
-	static void askForIntegrityCheck();
+	git_repository *repository() const;
+	ListingCache *listingCache() const;
+	void askForIntegrityCheck() const;
 
 protected:
-	virtual void generateSubNodes();
+	void generateSubNodes();
 
-	static git_repository *mRepository;
-	uint mMode;
+	MergedTables *mTables;
 	VersionList mVersionList;
-	MergedNodeList *mSubNodes;
+	quint32 mIndex; // in the node table
+	quint32 mParent;
+	quint32 mFirstSubNode;
+	quint32 mSubNodeCount;
+	quint32 mName;
+	uint mMode;
+	bool mSubNodesGenerated;
+};
+
+// Index of the root node, which is the MergedRepository and not in the node table.
+#define MERGED_ROOT_INDEX 0xffffffffu
+
+// Tables shared by all nodes of one merged tree, owned by the MergedRepository.
+struct MergedTables {
+	quint32 internName(const QString &pName);
+
+	// Each tree has its own handle.
+	git_repository *mRepository;
+	ListingCache *mListingCache;
+	MergedNode *mRoot;
+	// Every node but the root. A deque, because the model keeps pointers to
+	// nodes and appending to a deque does not move the existing ones.
+	std::deque<MergedNode> mNodes;
+	QVector<quint64> mCommitTimes; // commit index to commit time, newest first
+	QStringList mNames;
+	QHash<QString, quint32> mNameIds;
 };
 
+inline QString MergedNode::name() const {
+	return mTables->mNames.at(static_cast<int>(mName));
+}
+
+inline git_repository *MergedNode::repository() const {
+	return mTables->mRepository;
+}
+
+inline ListingCache *MergedNode::listingCache() const {
+	return mTables->mListingCache;
+}
+
 class MergedRepository: public MergedNode {
-	Q_OBJECT
 public:
-	MergedRepository(QObject *pParent, const QString &pRepositoryPath, const QString &pBranchName);
-	virtual ~MergedRepository();
+	MergedRepository(const QString &pRepositoryPath, const QString &pBranchName);
+	~MergedRepository();
 
 	bool open();
 	bool readBranch();
 	bool permissionsOk();
 
 	QString mBranchName;
+
+protected:
+	MergedTables mOwnTables;
 };
 
 #endif // MERGEDVFS_H
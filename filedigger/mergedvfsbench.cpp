@@ -0,0 +1,170 @@
+/***************************************************************************
+ *   Copyright Simon Persson                                               *
+ *   simonpersson1@gmail.com                                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+// Builds a synthetic branch of many snapshots of many files, merges it the
+// way filedigger does, expands every folder and reports how much memory the
+// merged tree took.
+// Usage: kup-mergedvfs-bench [snapshots] [folders] [files per folder]
+
+#include "mergedvfs.h"
+
+#include <QApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QStandardPaths>
+#include <QTemporaryDir>
+
+#include <git2/threads.h>
+#include <stdio.h>
+#include <unistd.h>
+
+// Every snapshot changes one file in this many.
+#define CHANGE_INTERVAL 50
+
+static quint64 residentSize() {
+	QFile lFile(QStringLiteral("/proc/self/statm"));
+	if(!lFile.open(QIODevice::ReadOnly)) {
+		return 0;
+	}
+	const QList<QByteArray> lFields = lFile.readAll().split(' ');
+	if(lFields.count() < 2) {
+		return 0;
+	}
+	return lFields.at(1).toULongLong() * static_cast<quint64>(sysconf(_SC_PAGESIZE));
+}
+
+static bool buildBranch(const QString &pPath, int pSnapshots, int pFolders, int pFiles) {
+	git_repository *lRepository;
+	if(0 != git_repository_init(&lRepository, QFile::encodeName(pPath).constData(), 1)) {
+		return false;
+	}
+	QVector<git_oid> lBlobs(pFolders * pFiles);
+	git_commit *lParent = nullptr;
+	bool lOk = true;
+	for(int lSnapshot = 0; lOk && lSnapshot < pSnapshots; ++lSnapshot) {
+		git_treebuilder *lRootBuilder;
+		git_treebuilder_create(&lRootBuilder, nullptr);
+		for(int lFolder = 0; lOk && lFolder < pFolders; ++lFolder) {
+			git_treebuilder *lBuilder;
+			git_treebuilder_create(&lBuilder, nullptr);
+			for(int lFile = 0; lFile < pFiles; ++lFile) {
+				const int lIndex = lFolder * pFiles + lFile;
+				if(lSnapshot == 0 || (lIndex * 7 + lSnapshot) % CHANGE_INTERVAL == 0) {
+					const QByteArray lContent = QByteArray("file ") + QByteArray::number(lIndex) +
+					                            " in snapshot " + QByteArray::number(lSnapshot) + '\n';
+					lOk = lOk && 0 == git_blob_create_frombuffer(&lBlobs[lIndex], lRepository,
+					                                             lContent.constData(),
+					                                             static_cast<size_t>(lContent.size()));
+				}
+				const QByteArray lName = "file" + QByteArray::number(lFile) + ".txt";
+				lOk = lOk && 0 == git_treebuilder_insert(nullptr, lBuilder, lName.constData(), &lBlobs.at(lIndex),
+				                                         GIT_FILEMODE_BLOB);
+			}
+			git_oid lTreeOid;
+			const QByteArray lName = "folder" + QByteArray::number(lFolder);
+			lOk = lOk && 0 == git_treebuilder_write(&lTreeOid, lRepository, lBuilder) &&
+			      0 == git_treebuilder_insert(nullptr, lRootBuilder, lName.constData(), &lTreeOid, GIT_FILEMODE_TREE);
+			git_treebuilder_free(lBuilder);
+		}
+		git_oid lRootOid, lCommitOid;
+		git_tree *lRoot = nullptr;
+		git_signature *lSignature = nullptr;
+		lOk = lOk && 0 == git_treebuilder_write(&lRootOid, lRepository, lRootBuilder) &&
+		      0 == git_tree_lookup(&lRoot, lRepository, &lRootOid) &&
+		      0 == git_signature_new(&lSignature, "kup", "kup@localhost", 1500000000 + lSnapshot * 3600, 0);
+		const git_commit *lParents[] = {lParent};
+		lOk = lOk && 0 == git_commit_create(&lCommitOid, lRepository, "refs/heads/kup", lSignature, lSignature,
+		                                    nullptr, "snapshot", lRoot, lParent != nullptr ? 1 : 0, lParents);
+		git_signature_free(lSignature);
+		git_tree_free(lRoot);
+		git_treebuilder_free(lRootBuilder);
+		if(lParent != nullptr) {
+			git_commit_free(lParent);
+			lParent = nullptr;
+		}
+		lOk = lOk && 0 == git_commit_lookup(&lParent, lRepository, &lCommitOid);
+	}
+	if(lParent != nullptr) {
+		git_commit_free(lParent);
+	}
+	git_repository_free(lRepository);
+	return lOk;
+}
+
+static void expandAll(MergedNode *pNode, quint64 &pNodes, quint64 &pVersions) {
+	++pNodes;
+	pVersions += static_cast<quint64>(pNode->versionList()->count());
+	const int lCount = pNode->subNodeCount();
+	for(int i = 0; i < lCount; ++i) {
+		expandAll(pNode->subNode(i), pNodes, pVersions);
+	}
+}
+
+int main(int pArgc, char **pArgv) {
+	// a failed read asks about an integrity check in a message box.
+	if(qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) {
+		qputenv("QT_QPA_PLATFORM", "offscreen");
+	}
+	QApplication lApp(pArgc, pArgv);
+	// keeps the listing and commit caches out of the user's cache folder.
+	QStandardPaths::setTestModeEnabled(true);
+	git_threads_init();
+
+	const int lSnapshots = pArgc > 1 ? atoi(pArgv[1]) : 100;
+	const int lFolders = pArgc > 2 ? atoi(pArgv[2]) : 100;
+	const int lFiles = pArgc > 3 ? atoi(pArgv[3]) : 100;
+	if(lSnapshots <= 0 || lFolders <= 0 || lFiles <= 0) {
+		fprintf(stderr, "Usage: kup-mergedvfs-bench [snapshots] [folders] [files per folder]\n");
+		return 1;
+	}
+
+	QTemporaryDir lDir;
+	const QString lPath = lDir.path() + QStringLiteral("/repository/");
+	if(!lDir.isValid() || !buildBranch(lPath, lSnapshots, lFolders, lFiles)) {
+		fprintf(stderr, "Could not build the synthetic branch in %s\n", qPrintable(lPath));
+		return 1;
+	}
+
+	const quint64 lBefore = residentSize();
+	QElapsedTimer lTimer;
+	lTimer.start();
+	MergedRepository *lRepository = new MergedRepository(lPath, QStringLiteral("kup"));
+	if(!lRepository->open() || !lRepository->readBranch()) {
+		fprintf(stderr, "Could not read the synthetic branch\n");
+		return 1;
+	}
+	quint64 lNodes = 0, lVersions = 0;
+	expandAll(lRepository, lNodes, lVersions);
+	const qint64 lTime = lTimer.elapsed();
+	const quint64 lAfter = residentSize();
+	const quint64 lGrowth = lAfter > lBefore ? lAfter - lBefore : 0;
+
+	printf("%d snapshots of %d files: %llu nodes, %llu versions, merged in %lld ms\n", lSnapshots,
+	       lFolders * lFiles, static_cast<unsigned long long>(lNodes), static_cast<unsigned long long>(lVersions),
+	       static_cast<long long>(lTime));
+	printf("resident before %.1f MiB, after %.1f MiB, %.1f MiB for the merged tree\n", lBefore / 1048576.0,
+	       lAfter / 1048576.0, lGrowth / 1048576.0);
+	printf("%.0f bytes per node, %.0f bytes per version\n", static_cast<double>(lGrowth) / lNodes,
+	       static_cast<double>(lGrowth) / lVersions);
+
+	delete lRepository;
+	git_threads_shutdown();
+	return 0;
+}
@@ -24,6 +24,7 @@
 
 #include <KIO/Global>
 #include <KIconLoader>
+#include <KLocalizedString>
 #include <QPixmap>
 
 MergedVfsModel::MergedVfsModel(MergedRepository *pRoot, QObject *pParent) :
@@ -47,10 +48,10 @@ QVariant MergedVfsModel::data(const QModelIndex &pIndex, int pRole) const {
 	MergedNode *lNode = static_cast<MergedNode *>(pIndex.internalPointer());
 	switch (pRole) {
 	case Qt::DisplayRole:
-		return lNode->objectName();
+		return lNode->name();
 	case Qt::DecorationRole:
 		return KIconLoader::global()->loadMimeTypeIcon(
-		         KIO::iconNameForUrl(QUrl::fromLocalFile(lNode->objectName())),
+		         KIO::iconNameForUrl(QUrl::fromLocalFile(lNode->name())),
 		         KIconLoader::Small);
 	default:
 		return QVariant();
@@ -62,16 +63,16 @@ QModelIndex MergedVfsModel::index(int pRow, int pColumn, const QModelIndex &pPar
 		return QModelIndex(); // invalid
 	}
 	if(!pParent.isValid()) {
-		if(pRow >= mRoot->subNodes().count()) {
+		if(pRow >= mRoot->subNodeCount()) {
 			return QModelIndex(); // invalid
 		}
-		return createIndex(pRow, 0, mRoot->subNodes().at(pRow));
+		return createIndex(pRow, 0, mRoot->subNode(pRow));
 	}
 	MergedNode *lParentNode = static_cast<MergedNode *>(pParent.internalPointer());
-	if(pRow >= lParentNode->subNodes().count()) {
+	if(pRow >= lParentNode->subNodeCount()) {
 		return QModelIndex(); // invalid
 	}
-	return createIndex(pRow, 0, lParentNode->subNodes().at(pRow));
+	return createIndex(pRow, 0, lParentNode->subNode(pRow));
 }
 
 QModelIndex MergedVfsModel::parent(const QModelIndex &pChild) const {
@@ -79,26 +80,22 @@ QModelIndex MergedVfsModel::parent(const QModelIndex &pChild) const {
 		return QModelIndex();
 	}
 	MergedNode *lChild = static_cast<MergedNode *>(pChild.internalPointer());
-	MergedNode *lParent = qobject_cast<MergedNode *>(lChild->parent());
+	MergedNode *lParent = lChild->parentNode();
 	if(lParent == nullptr || lParent == mRoot) {
 		return QModelIndex(); //invalid
 	}
-	MergedNode *lGrandParent = qobject_cast<MergedNode *>(lParent->parent());
-	if(lGrandParent == nullptr) {
-		return QModelIndex(); //invalid
-	}
-	return createIndex(lGrandParent->subNodes().indexOf(lParent), 0, lParent);
+	return createIndex(lParent->row(), 0, lParent);
 }
 
 int MergedVfsModel::rowCount(const QModelIndex &pParent) const {
 	if(!pParent.isValid()) {
-		return mRoot->subNodes().count();
+		return mRoot->subNodeCount();
 	}
 	MergedNode *lParent = static_cast<MergedNode *>(pParent.internalPointer());
 	if(lParent == nullptr) {
 		return 0;
 	}
-	return lParent->subNodes().count();
+	return lParent->subNodeCount();
 }
 
 const VersionList *MergedVfsModel::versionList(const QModelIndex &pIndex) {
@@ -110,3 +107,36 @@ const MergedNode *MergedVfsModel::node(const QModelIndex &pIndex) {
 	return static_cast<MergedNode *>(pIndex.internalPointer());
 }
 
+
+QModelIndex MergedVfsModel::indexForPath(const QStringList &pPath, bool pIsDirectory) const {
+	QModelIndex lIndex;
+	MergedNode *lNode = mRoot;
+	for(int i = 0; i < pPath.count(); ++i) {
+		const bool lWantDirectory = i + 1 < pPath.count() || pIsDirectory;
+		// when a name has been both file and folder one of them got a suffix added
+		QStringList lNames;
+		lNames << pPath.at(i);
+		if(lWantDirectory) {
+			lNames << pPath.at(i) + xi18nc("added after folder name in some cases", " (folder)");
+		} else {
+			lNames << pPath.at(i) + xi18nc("added after file name in some cases", " (symlink)");
+			lNames << pPath.at(i) + xi18nc("added after file name in some cases", " (file)");
+		}
+		const int lCount = lNode->subNodeCount();
+		int lRow = -1;
+		for(int j = 0; j < lCount; ++j) {
+			if(lNames.contains(lNode->subNode(j)->name())) {
+				lRow = j;
+				if(lNode->subNode(j)->isDirectory() == lWantDirectory) {
+					break;
+				}
+			}
+		}
+		if(lRow < 0) {
+			break;
+		}
+		lNode = lNode->subNode(lRow);
+		lIndex = createIndex(lRow, 0, lNode);
+	}
+	return lIndex;
+}
@@ -39,6 +39,9 @@ public:
 
 	const VersionList *versionList(const QModelIndex &pIndex);
 	const MergedNode *node(const QModelIndex &pIndex);
+	// Finds the node at a path inside the backups, the closest existing
+	// parent folder if it can not be found.
+	QModelIndex indexForPath(const QStringList &pPath, bool pIsDirectory) const;
 
 protected:
 	MergedRepository *mRoot;
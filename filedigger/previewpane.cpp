@@ -0,0 +1,288 @@
+/***************************************************************************
+ *   Copyright Simon Persson                                               *
+ *   simonpersson1@gmail.com                                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include "previewpane.h"
+#include "mergedvfs.h"
+#include "thumbnailcache.h"
+#include "kupfiledigger_debug.h"
+
+#include <KLocalizedString>
+#ifdef HAVE_KPARTS
+#include <KMimeTypeTrader>
+#include <KParts/ReadOnlyPart>
+#endif
+
+#include <QBuffer>
+#include <QDir>
+#include <QFontDatabase>
+#include <QLabel>
+#include <QMimeDatabase>
+#include <QPixmap>
+#include <QPlainTextEdit>
+#include <QScrollArea>
+#include <QStackedLayout>
+#include <QTemporaryFile>
+#include <QTextCodec>
+
+// Larger files are not read for a preview, opening them is better.
+#define PREVIEW_SIZE_LIMIT (16*1024*1024)
+// Images are shown at most this big, from the thumbnail cache shared with kio_bup.
+#define PREVIEW_IMAGE_SIZE 512
+// Total size of decoded content kept for versions shown before.
+#define PREVIEW_CACHE_SIZE (64*1024*1024)
+
+static bool appendBlob(git_repository *pRepository, const git_oid *pOid, QByteArray &pContent) {
+	git_blob *lBlob;
+	if(0 != git_blob_lookup(&lBlob, pRepository, pOid)) {
+		return false;
+	}
+	pContent.append(static_cast<const char *>(git_blob_rawcontent(lBlob)),
+	                static_cast<int>(git_blob_rawsize(lBlob)));
+	git_blob_free(lBlob);
+	return true;
+}
+
+// bup names the entries of a chunk tree with their offset in zero padded hex,
+// so reading them in tree order gives the file from start to end.
+static bool appendChunkTree(git_repository *pRepository, const git_oid *pOid, QByteArray &pContent) {
+	git_tree *lTree;
+	if(0 != git_tree_lookup(&lTree, pRepository, pOid)) {
+		return false;
+	}
+	bool lOk = true;
+	const size_t lEntryCount = git_tree_entrycount(lTree);
+	for(size_t i = 0; i < lEntryCount && lOk; ++i) {
+		const git_tree_entry *lEntry = git_tree_entry_byindex(lTree, i);
+		if(S_ISDIR(git_tree_entry_filemode(lEntry))) {
+			lOk = appendChunkTree(pRepository, git_tree_entry_id(lEntry), pContent);
+		} else {
+			lOk = appendBlob(pRepository, git_tree_entry_id(lEntry), pContent);
+		}
+	}
+	git_tree_free(lTree);
+	return lOk;
+}
+
+static int previewCost(const PreviewContent *pContent) {
+	return 1 + pContent->mText.size() * static_cast<int>(sizeof(QChar)) + pContent->mImage.byteCount() +
+	       pContent->mData.size();
+}
+
+PreviewPane::PreviewPane(QWidget *pParent)
+   : QWidget(pParent), mCache(PREVIEW_CACHE_SIZE), mPart(nullptr), mPartFile(nullptr)
+{
+	mMessageLabel = new QLabel;
+	mMessageLabel->setAlignment(Qt::AlignCenter);
+	mMessageLabel->setWordWrap(true);
+
+	mTextView = new QPlainTextEdit;
+	mTextView->setReadOnly(true);
+	mTextView->setLineWrapMode(QPlainTextEdit::NoWrap);
+	mTextView->setFont(QFontDatabase::systemFont(QFontDatabase::FixedFont));
+
+	mImageLabel = new QLabel;
+	mImageArea = new QScrollArea;
+	mImageArea->setAlignment(Qt::AlignCenter);
+	mImageArea->setWidget(mImageLabel);
+
+	mStack = new QStackedLayout;
+	mStack->addWidget(mMessageLabel);
+	mStack->addWidget(mTextView);
+	mStack->addWidget(mImageArea);
+	setLayout(mStack);
+}
+
+PreviewPane::~PreviewPane() {
+#ifdef HAVE_KPARTS
+	delete mPart;
+#endif
+	delete mPartFile;
+}
+
+void PreviewPane::showVersion(const MergedNode *pNode, int pVersionIndex) {
+	if(pNode == nullptr || pVersionIndex < 0 || pVersionIndex >= pNode->versionList()->count()) {
+		clear();
+		return;
+	}
+	if(pNode->isDirectory()) {
+		showMessage(i18nc("@info:status", "Select a file to see a preview of it."));
+		return;
+	}
+	const VersionData *lVersion = pNode->versionList()->at(pVersionIndex);
+	QByteArray lKey(reinterpret_cast<const char *>(lVersion->mOid.id), GIT_OID_RAWSZ);
+	if(S_ISLNK(pNode->mode())) {
+		lKey.append('l'); // a link target can have the same id as a file with that content
+	}
+	PreviewContent *lContent = mCache.object(lKey);
+	if(lContent != nullptr) {
+		showContent(lContent, pNode->name());
+		return;
+	}
+	lContent = decode(pNode, pVersionIndex);
+	showContent(lContent, pNode->name());
+	// the cache takes ownership, content larger than the whole cache is deleted right away.
+	mCache.insert(lKey, lContent, previewCost(lContent));
+}
+
+void PreviewPane::clear() {
+	showMessage(QString());
+}
+
+PreviewContent *PreviewPane::decode(const MergedNode *pNode, int pVersionIndex) {
+	PreviewContent *lContent = new PreviewContent;
+	lContent->mKind = PreviewContent::PREVIEW_NONE;
+	const VersionData *lVersion = pNode->versionList()->at(pVersionIndex);
+	git_repository *lRepository = pNode->repository();
+	// a thumbnail made before, here or by kio_bup for a file manager, saves
+	// reading the file at all. Only images get one.
+	QByteArray lPngData;
+	if(!S_ISLNK(pNode->mode()) && findThumbnail(&lVersion->mOid, PREVIEW_IMAGE_SIZE, lPngData) &&
+	      lContent->mImage.loadFromData(lPngData, "PNG")) {
+		lContent->mMimeType = QStringLiteral("image/png");
+		lContent->mKind = PreviewContent::PREVIEW_IMAGE;
+		return lContent;
+	}
+	const quint64 lSize = lVersion->size(lRepository);
+	if(lSize > PREVIEW_SIZE_LIMIT) {
+		lContent->mText = i18nc("@info:status", "This file is too large to preview, open it to see its content.");
+		return lContent;
+	}
+	if(lSize == 0) {
+		lContent->mText = i18nc("@info:status", "This file is empty.");
+		return lContent;
+	}
+
+	QByteArray lData;
+	lData.reserve(static_cast<int>(lSize));
+	bool lOk;
+	if(lVersion->mChunkedFile) {
+		lOk = appendChunkTree(lRepository, &lVersion->mOid, lData);
+	} else {
+		lOk = appendBlob(lRepository, &lVersion->mOid, lData);
+	}
+	if(!lOk) {
+		qCWarning(KUPFILEDIGGER) << "could not read content of" << pNode->name();
+		lContent->mText = i18nc("@info:status", "Could not read this version of the file.");
+		return lContent;
+	}
+	if(S_ISLNK(pNode->mode())) {
+		lContent->mText = xi18nc("@info:status", "Symbolic link to <filename>%1</filename>",
+		                         QString::fromLocal8Bit(lData));
+		return lContent;
+	}
+
+	QMimeDatabase lMimeDatabase;
+	const QMimeType lMimeType = lMimeDatabase.mimeTypeForFileNameAndData(pNode->name(), lData);
+	lContent->mMimeType = lMimeType.name();
+	if(lMimeType.inherits(QStringLiteral("text/plain"))) {
+		QTextCodec *lCodec = QTextCodec::codecForUtfText(lData, QTextCodec::codecForName("UTF-8"));
+		lContent->mText = lCodec->toUnicode(lData);
+		lContent->mKind = PreviewContent::PREVIEW_TEXT;
+		return lContent;
+	}
+	if(lContent->mMimeType.startsWith(QStringLiteral("image/"))) {
+		QBuffer lBuffer(&lData);
+		if(lBuffer.open(QIODevice::ReadOnly) &&
+		      makeThumbnail(&lBuffer, &lVersion->mOid, PREVIEW_IMAGE_SIZE, lPngData) &&
+		      lContent->mImage.loadFromData(lPngData, "PNG")) {
+			lContent->mKind = PreviewContent::PREVIEW_IMAGE;
+			return lContent;
+		}
+	}
+#ifdef HAVE_KPARTS
+	if(KMimeTypeTrader::self()->preferredService(lContent->mMimeType, QStringLiteral("KParts/ReadOnlyPart"))) {
+		lContent->mData = lData;
+		lContent->mKind = PreviewContent::PREVIEW_PART;
+		return lContent;
+	}
+#endif
+	lContent->mText = i18nc("@info:status %1 is a file type", "There is no preview for files of type %1.",
+	                        lMimeType.comment());
+	return lContent;
+}
+
+void PreviewPane::showMessage(const QString &pMessage) {
+	mMessageLabel->setText(pMessage);
+	mStack->setCurrentWidget(mMessageLabel);
+}
+
+void PreviewPane::showContent(const PreviewContent *pContent, const QString &pName) {
+	switch(pContent->mKind) {
+	case PreviewContent::PREVIEW_TEXT:
+		mTextView->setPlainText(pContent->mText);
+		mStack->setCurrentWidget(mTextView);
+		break;
+	case PreviewContent::PREVIEW_IMAGE:
+		mImageLabel->setPixmap(QPixmap::fromImage(pContent->mImage));
+		mImageLabel->adjustSize();
+		mStack->setCurrentWidget(mImageArea);
+		break;
+	case PreviewContent::PREVIEW_PART:
+		if(!showInPart(pContent, pName)) {
+			showMessage(i18nc("@info:status", "Could not show a preview of this file."));
+		}
+		break;
+	case PreviewContent::PREVIEW_NONE:
+		showMessage(pContent->mText);
+		break;
+	}
+}
+
+bool PreviewPane::showInPart(const PreviewContent *pContent, const QString &pName) {
+#ifdef HAVE_KPARTS
+	if(mPart == nullptr || mPartMimeType != pContent->mMimeType) {
+		delete mPart; // takes its widget along, which leaves the stack by itself
+		mPartMimeType.clear();
+		QString lError;
+		mPart = KMimeTypeTrader::self()->createPartInstanceFromQuery<KParts::ReadOnlyPart>(
+		           pContent->mMimeType, this, this, QString(), QVariantList(), &lError);
+		if(mPart == nullptr) {
+			qCWarning(KUPFILEDIGGER) << "could not create a viewer for" << pContent->mMimeType << lError;
+			return false;
+		}
+		mPartMimeType = pContent->mMimeType;
+		mStack->addWidget(mPart->widget());
+	}
+	if(mPart->openStream(pContent->mMimeType, QUrl::fromLocalFile(pName))) {
+		mPart->writeStream(pContent->mData);
+		mPart->closeStream();
+	} else {
+		// this viewer can only read files, give it a temporary one.
+		delete mPartFile;
+		QMimeDatabase lMimeDatabase;
+		mPartFile = new QTemporaryFile(QDir::tempPath() + QStringLiteral("/kup-preview-XXXXXX.") +
+		                               lMimeDatabase.mimeTypeForName(pContent->mMimeType).preferredSuffix());
+		if(!mPartFile->open() || mPartFile->write(pContent->mData) != pContent->mData.size()) {
+			qCWarning(KUPFILEDIGGER) << "could not write preview file" << mPartFile->fileName();
+			return false;
+		}
+		mPartFile->close();
+		if(!mPart->openUrl(QUrl::fromLocalFile(mPartFile->fileName()))) {
+			return false;
+		}
+	}
+	mStack->setCurrentWidget(mPart->widget());
+	return true;
+#else
+	Q_UNUSED(pContent)
+	Q_UNUSED(pName)
+	return false;
+#endif
+}
@@ -0,0 +1,82 @@
+/***************************************************************************
+ *   Copyright Simon Persson                                               *
+ *   simonpersson1@gmail.com                                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef PREVIEWPANE_H
+#define PREVIEWPANE_H
+
+#include <QCache>
+#include <QImage>
+#include <QWidget>
+
+class MergedNode;
+class QLabel;
+class QPlainTextEdit;
+class QScrollArea;
+class QStackedLayout;
+class QTemporaryFile;
+namespace KParts {
+	class ReadOnlyPart;
+}
+
+// What a file version looked like once decoded, kept in the preview cache.
+struct PreviewContent {
+	enum Kind {PREVIEW_TEXT, PREVIEW_IMAGE, PREVIEW_PART, PREVIEW_NONE};
+	Kind mKind;
+	QString mMimeType;
+	QString mText;
+	QImage mImage;
+	QByteArray mData; // only kept for content shown by a part
+};
+
+// Shows the content of one version of a file next to the version list. The
+// content is read straight from the repository filedigger already has open,
+// no application or kio_bup process is started. Text is shown directly,
+// images as thumbnails from the cache kio_bup fills for file managers, other
+// types with a KParts viewer if one is installed. Decoded content is cached
+// by object id, so going back and forth between versions does not read them
+// again.
+class PreviewPane : public QWidget
+{
+	Q_OBJECT
+
+public:
+	explicit PreviewPane(QWidget *pParent = nullptr);
+	~PreviewPane();
+	void showVersion(const MergedNode *pNode, int pVersionIndex);
+	void clear();
+
+protected:
+	PreviewContent *decode(const MergedNode *pNode, int pVersionIndex);
+	void showMessage(const QString &pMessage);
+	void showContent(const PreviewContent *pContent, const QString &pName);
+	bool showInPart(const PreviewContent *pContent, const QString &pName);
+
+	QCache<QByteArray, PreviewContent> mCache;
+	QStackedLayout *mStack;
+	QLabel *mMessageLabel;
+	QPlainTextEdit *mTextView;
+	QScrollArea *mImageArea;
+	QLabel *mImageLabel;
+	KParts::ReadOnlyPart *mPart;
+	QString mPartMimeType;
+	QTemporaryFile *mPartFile;
+};
+
+#endif // PREVIEWPANE_H
@@ -0,0 +1,180 @@
+/***************************************************************************
+ *   Copyright Simon Persson                                               *
+ *   simonpersson1@gmail.com                                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "searchdialog.h"
+#include "mergedvfs.h"
+#include "searchindex.h"
+#include "vfshelpers.h"
+
+#include <KLocalizedString>
+
+#include <QDialogButtonBox>
+#include <QHeaderView>
+#include <QIcon>
+#include <QLabel>
+#include <QLineEdit>
+#include <QTimer>
+#include <QTreeWidget>
+#include <QVBoxLayout>
+
+#include <sys/stat.h>
+
+#define MAX_SEARCH_RESULTS 1000
+#define BACKUPS_BETWEEN_SAVES 100
+
+SearchDialog::SearchDialog(MergedRepository *pRepository, const git_oid *pContent, QWidget *pParent)
+   : QDialog(pParent), mRepository(pRepository), mFindContent(pContent != nullptr), mIndexChanged(false),
+     mResultsTruncated(false)
+{
+	if(mFindContent) {
+		git_oid_cpy(&mContentOid, pContent);
+		setWindowTitle(i18nc("@title:window", "Other Locations"));
+	} else {
+		setWindowTitle(i18nc("@title:window", "Search"));
+	}
+	mIndexTimer = new QTimer(this);
+	mIndexTimer->setSingleShot(true);
+	mIndexTimer->setInterval(0);
+	connect(mIndexTimer, &QTimer::timeout, this, &SearchDialog::indexNextBackup);
+
+	mQueryEdit = new QLineEdit;
+	mQueryEdit->setClearButtonEnabled(true);
+	mQueryEdit->setPlaceholderText(i18nc("@info:placeholder", "Part of a name, or a pattern like *.odt"));
+	connect(mQueryEdit, &QLineEdit::textChanged, this, &SearchDialog::updateResults);
+	mQueryEdit->setVisible(!mFindContent);
+	mStatusLabel = new QLabel;
+	mResultView = new QTreeWidget;
+	mResultView->setRootIsDecorated(false);
+	mResultView->setHeaderLabels(QStringList() << i18nc("@title:column", "Path")
+	                                           << i18nc("@title:column", "First backup with it")
+	                                           << i18nc("@title:column", "Last backup with it"));
+	mResultView->header()->setSectionResizeMode(0, QHeaderView::Stretch);
+	mResultView->header()->setStretchLastSection(false);
+	connect(mResultView, &QTreeWidget::itemActivated, this, &SearchDialog::activateItem);
+	QDialogButtonBox *lButtons = new QDialogButtonBox(QDialogButtonBox::Close);
+	connect(lButtons, &QDialogButtonBox::rejected, this, &QDialog::close);
+
+	QVBoxLayout *lLayout = new QVBoxLayout;
+	lLayout->addWidget(mQueryEdit);
+	lLayout->addWidget(mResultView, 1);
+	lLayout->addWidget(mStatusLabel);
+	lLayout->addWidget(lButtons);
+	setLayout(lLayout);
+	resize(800, 500);
+
+	// the index wants backups oldest first, the version list has them newest first.
+	const VersionList *lVersions = mRepository->versionList();
+	QVector<qint64> lCommitTimes;
+	QVector<git_oid> lTrees;
+	for(int i = lVersions->count() - 1; i >= 0; --i) {
+		lCommitTimes.append(lVersions->commitTime(i));
+		lTrees.append(lVersions->at(i)->mOid);
+	}
+	mIndex = new SearchIndex(mRepository->listingCache(), mRepository->name(), mRepository->mBranchName,
+	                         mFindContent);
+	mIndex->load(lCommitTimes, lTrees);
+	if(mFindContent) {
+		updateResults();
+	}
+	updateStatus();
+	mIndexTimer->start();
+}
+
+SearchDialog::~SearchDialog() {
+	if(mIndexChanged) {
+		mIndex->save();
+	}
+	delete mIndex;
+}
+
+void SearchDialog::indexNextBackup() {
+	if(mIndex->indexedCount() >= mIndex->backupCount()) {
+		return;
+	}
+	if(!mIndex->indexNextBackup()) {
+		mRepository->askForIntegrityCheck();
+	}
+	mIndexChanged = true;
+	if(mIndex->indexedCount() == mIndex->backupCount()) {
+		mIndex->save();
+		mIndexChanged = false;
+		updateResults(); // may have more hits now
+	} else {
+		if(mIndex->indexedCount() % BACKUPS_BETWEEN_SAVES == 0) {
+			mIndex->save();
+			mIndexChanged = false;
+		}
+		updateStatus();
+		mIndexTimer->start();
+	}
+}
+
+void SearchDialog::updateResults() {
+	mResultView->clear();
+	mResultsTruncated = false;
+	const SearchResultList lResults = mFindContent ? mIndex->findContent(&mContentOid)
+	                                               : mIndex->search(mQueryEdit->text(), MAX_SEARCH_RESULTS,
+	                                                                &mResultsTruncated);
+	foreach(const SearchResult &lResult, lResults) {
+		QString lPath = lResult.mPath.join(QLatin1Char('/'));
+		if(lResult.mIsDirectory) {
+			lPath.append(QLatin1Char('/'));
+		}
+		QStringList lColumns;
+		lColumns << lPath << vfsTimeToString(lResult.mFirstSeen);
+		if(lResult.mLastSeen == 0) {
+			lColumns << i18nc("@item:intable last backup with a file", "The newest");
+		} else {
+			lColumns << vfsTimeToString(lResult.mLastSeen);
+		}
+		QTreeWidgetItem *lItem = new QTreeWidgetItem(lColumns);
+		lItem->setIcon(0, QIcon::fromTheme(lResult.mIsDirectory ? QStringLiteral("folder")
+		                                                         : QStringLiteral("text-plain")));
+		lItem->setData(0, Qt::UserRole, lResult.mPath);
+		lItem->setData(0, Qt::UserRole + 1, lResult.mIsDirectory);
+		mResultView->addTopLevelItem(lItem);
+	}
+	updateStatus();
+}
+
+void SearchDialog::activateItem(QTreeWidgetItem *pItem) {
+	emit pathActivated(pItem->data(0, Qt::UserRole).toStringList(), pItem->data(0, Qt::UserRole + 1).toBool());
+}
+
+void SearchDialog::updateStatus() {
+	QString lStatus;
+	if(mFindContent) {
+		lStatus = i18ncp("@info:status", "Found in one place.", "Found in %1 places.",
+		                 mResultView->topLevelItemCount());
+	} else if(!mQueryEdit->text().trimmed().isEmpty()) {
+		lStatus = i18ncp("@info:status", "Found one item.", "Found %1 items.", mResultView->topLevelItemCount());
+		if(mResultsTruncated) {
+			lStatus = i18nc("@info:status", "Showing the first %1 items, make the search more specific to see "
+			                "the others.", MAX_SEARCH_RESULTS);
+		}
+	}
+	if(mIndex->indexedCount() < mIndex->backupCount()) {
+		if(!lStatus.isEmpty()) {
+			lStatus.append(QLatin1Char(' '));
+		}
+		lStatus.append(i18nc("@info:status", "Indexing, %1 of %2 backups done...",
+		                     mIndex->indexedCount(), mIndex->backupCount()));
+	}
+	mStatusLabel->setText(lStatus);
+}
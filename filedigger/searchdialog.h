@@ -0,0 +1,73 @@
+/***************************************************************************
+ *   Copyright Simon Persson                                               *
+ *   simonpersson1@gmail.com                                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef SEARCHDIALOG_H
+#define SEARCHDIALOG_H
+
+#include <QDialog>
+
+#include <git2.h>
+
+class MergedRepository;
+class SearchIndex;
+class QLabel;
+class QLineEdit;
+class QTimer;
+class QTreeWidget;
+class QTreeWidgetItem;
+
+// Searches file and folder names in all backups. The index is brought up to
+// date one backup per round of the event loop, searching works meanwhile on
+// what is indexed so far.
+// Given a content id instead, it lists every path that content was backed up
+// at, which needs the index to keep track of content too.
+class SearchDialog : public QDialog
+{
+	Q_OBJECT
+
+public:
+	explicit SearchDialog(MergedRepository *pRepository, const git_oid *pContent = nullptr,
+	                      QWidget *pParent = nullptr);
+	~SearchDialog();
+
+signals:
+	void pathActivated(const QStringList &pPath, bool pIsDirectory);
+
+protected slots:
+	void indexNextBackup();
+	void updateResults();
+	void activateItem(QTreeWidgetItem *pItem);
+
+protected:
+	void updateStatus();
+
+	MergedRepository *mRepository;
+	bool mFindContent;
+	git_oid mContentOid;
+	SearchIndex *mIndex;
+	bool mIndexChanged;
+	bool mResultsTruncated;
+	QTimer *mIndexTimer;
+	QLineEdit *mQueryEdit;
+	QLabel *mStatusLabel;
+	QTreeWidget *mResultView;
+};
+
+#endif // SEARCHDIALOG_H
@@ -0,0 +1,545 @@
+/***************************************************************************
+ *   Copyright Simon Persson                                               *
+ *   simonpersson1@gmail.com                                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "searchindex.h"
+#include "kuptrace.h"
+#include "listingcache.h"
+#include "treediff.h"
+
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QRegExp>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QtAlgorithms>
+
+#include <sys/stat.h>
+#include <algorithm>
+
+#define SEARCH_INDEX_MAGIC 0x4b555053 // "KUPS"
+#define SEARCH_INDEX_VERSION 2
+#define ROOT_PATH_ID 0xFFFFFFFF
+#define NO_CONTENT_ID 0xFFFFFFFF
+
+static quint64 pathKey(quint32 pParent, quint32 pName) {
+	return (quint64(pParent) << 32) | pName;
+}
+
+static quint64 trigramAt(const QString &pLowerName, int pIndex) {
+	return (quint64(pLowerName.at(pIndex).unicode()) << 32) |
+	       (quint64(pLowerName.at(pIndex + 1).unicode()) << 16) |
+	       quint64(pLowerName.at(pIndex + 2).unicode());
+}
+
+// The longest run of characters a glob match must contain as they are.
+static QString longestGlobLiteral(const QString &pPattern) {
+	QString lLongest, lCurrent;
+	bool lInBrackets = false;
+	foreach(const QChar &lChar, pPattern) {
+		if(lInBrackets) {
+			lInBrackets = lChar != QLatin1Char(']');
+			continue;
+		}
+		if(lChar == QLatin1Char('*') || lChar == QLatin1Char('?') || lChar == QLatin1Char('[')) {
+			lInBrackets = lChar == QLatin1Char('[');
+			if(lCurrent.length() > lLongest.length()) {
+				lLongest = lCurrent;
+			}
+			lCurrent.clear();
+		} else {
+			lCurrent.append(lChar);
+		}
+	}
+	return lCurrent.length() > lLongest.length() ? lCurrent : lLongest;
+}
+
+// A match with its path joined once, for keeping the first ones by path.
+struct RankedResult {
+	QString mKey;
+	SearchResult mResult;
+};
+
+static bool rankedLessThan(const RankedResult &a, const RankedResult &b) {
+	return a.mKey < b.mKey;
+}
+
+static bool firstSeenLessThan(const SearchResult &a, const SearchResult &b) {
+	return a.mFirstSeen < b.mFirstSeen;
+}
+
+SearchIndex::SearchIndex(ListingCache *pListingCache, const QString &pRepositoryPath, const QString &pBranchName,
+                         bool pIndexContent) {
+	mListingCache = pListingCache;
+	mIndexContent = pIndexContent;
+	QByteArray lKey = QDir::cleanPath(pRepositoryPath).toUtf8();
+	lKey.append('\0');
+	lKey.append(pBranchName.toUtf8());
+	QString lDir = QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation);
+	lDir.append(QStringLiteral("/kup/search/"));
+	QDir().mkpath(lDir);
+	mCachePath = lDir + QString::fromLatin1(QCryptographicHash::hash(lKey, QCryptographicHash::Sha1).toHex());
+}
+
+void SearchIndex::clear() {
+	mIndexedTimes.clear();
+	mIndexedTrees.clear();
+	mNames.clear();
+	mNameIds.clear();
+	mNamePaths.clear();
+	mPaths.clear();
+	mPathIds.clear();
+	mTrigrams.clear();
+	mContentOids.clear();
+	mContentEntries.clear();
+	mContentIds.clear();
+}
+
+void SearchIndex::load(const QVector<qint64> &pCommitTimes, const QVector<git_oid> &pTrees) {
+	TraceSpan lSpan("SearchIndex::load", "filedigger");
+	mCommitTimes = pCommitTimes;
+	mTrees = pTrees;
+	clear();
+
+	QFile lFile(mCachePath);
+	if(!lFile.open(QIODevice::ReadOnly)) {
+		return;
+	}
+	QDataStream lStream(&lFile);
+	lStream.setVersion(QDataStream::Qt_5_0);
+	quint32 lMagic;
+	qint32 lVersion, lIndexedCount;
+	bool lHasContent;
+	lStream >> lMagic >> lVersion >> lHasContent >> lIndexedCount;
+	// content asked for but missing means all backups must be indexed again.
+	if(lMagic != SEARCH_INDEX_MAGIC || lVersion != SEARCH_INDEX_VERSION || (mIndexContent && !lHasContent) ||
+	      lIndexedCount < 0 || lIndexedCount > mCommitTimes.count()) {
+		return;
+	}
+	mIndexContent = lHasContent;
+	// Only usable if what was indexed is still the start of the branch, otherwise
+	// backups were removed and the ranges are wrong.
+	for(int i = 0; i < lIndexedCount; ++i) {
+		qint64 lTime;
+		git_oid lTree;
+		lStream >> lTime;
+		if(lStream.readRawData(reinterpret_cast<char *>(lTree.id), GIT_OID_RAWSZ) != GIT_OID_RAWSZ ||
+		      lTime != mCommitTimes.at(i) || !git_oid_equal(&lTree, &mTrees.at(i))) {
+			clear();
+			return;
+		}
+		mIndexedTimes.append(lTime);
+		mIndexedTrees.append(lTree);
+	}
+	qint32 lPathCount;
+	lStream >> mNames >> lPathCount;
+	if(lStream.status() != QDataStream::Ok || lPathCount < 0) {
+		clear();
+		return;
+	}
+	mPaths.resize(lPathCount);
+	for(int i = 0; i < lPathCount; ++i) {
+		PathEntry &lPath = mPaths[i];
+		lStream >> lPath.mParent >> lPath.mName >> lPath.mIsDirectory >> lPath.mRanges >> lPath.mContent;
+		if(lStream.status() != QDataStream::Ok || lPath.mName >= quint32(mNames.count()) ||
+		      (lPath.mParent != ROOT_PATH_ID && lPath.mParent >= quint32(i))) {
+			clear();
+			return;
+		}
+	}
+	if(mIndexContent) {
+		qint32 lContentCount;
+		lStream >> lContentCount;
+		if(lStream.status() != QDataStream::Ok || lContentCount < 0) {
+			clear();
+			return;
+		}
+		mContentOids.resize(lContentCount);
+		mContentEntries.resize(lContentCount);
+		for(int i = 0; i < lContentCount; ++i) {
+			qint32 lEntryCount;
+			if(lStream.readRawData(reinterpret_cast<char *>(mContentOids[i].id), GIT_OID_RAWSZ) != GIT_OID_RAWSZ) {
+				clear();
+				return;
+			}
+			lStream >> lEntryCount;
+			if(lStream.status() != QDataStream::Ok || lEntryCount < 0) {
+				clear();
+				return;
+			}
+			QVector<ContentEntry> &lEntries = mContentEntries[i];
+			lEntries.resize(lEntryCount);
+			for(int j = 0; j < lEntryCount; ++j) {
+				lStream >> lEntries[j].mPath >> lEntries[j].mFirstSeen >> lEntries[j].mLastSeen;
+				if(lStream.status() != QDataStream::Ok || lEntries.at(j).mPath >= quint32(mPaths.count())) {
+					clear();
+					return;
+				}
+			}
+		}
+	}
+	for(int i = 0; i < mPaths.count(); ++i) {
+		if(mPaths.at(i).mContent != NO_CONTENT_ID && mPaths.at(i).mContent >= quint32(mContentOids.count())) {
+			clear();
+			return;
+		}
+	}
+
+	// the lookup tables are quick to build and not worth storing.
+	mNamePaths.resize(mNames.count());
+	mNameIds.reserve(mNames.count());
+	for(int i = 0; i < mNames.count(); ++i) {
+		mNameIds.insert(mNames.at(i), i);
+		addTrigrams(i);
+	}
+	mPathIds.reserve(mPaths.count());
+	for(int i = 0; i < mPaths.count(); ++i) {
+		mPathIds.insert(pathKey(mPaths.at(i).mParent, mPaths.at(i).mName), i);
+		mNamePaths[mPaths.at(i).mName].append(i);
+	}
+	mContentIds.reserve(mContentOids.count());
+	for(int i = 0; i < mContentOids.count(); ++i) {
+		mContentIds.insert(QByteArray(reinterpret_cast<const char *>(mContentOids.at(i).id), GIT_OID_RAWSZ), i);
+	}
+}
+
+bool SearchIndex::save() const {
+	TraceSpan lSpan("SearchIndex::save", "filedigger");
+	QSaveFile lFile(mCachePath);
+	if(!lFile.open(QIODevice::WriteOnly)) {
+		return false;
+	}
+	QDataStream lStream(&lFile);
+	lStream.setVersion(QDataStream::Qt_5_0);
+	lStream << quint32(SEARCH_INDEX_MAGIC) << qint32(SEARCH_INDEX_VERSION) << mIndexContent
+	        << qint32(mIndexedTimes.count());
+	for(int i = 0; i < mIndexedTimes.count(); ++i) {
+		lStream << mIndexedTimes.at(i);
+		lStream.writeRawData(reinterpret_cast<const char *>(mIndexedTrees.at(i).id), GIT_OID_RAWSZ);
+	}
+	lStream << mNames << qint32(mPaths.count());
+	foreach(const PathEntry &lPath, mPaths) {
+		lStream << lPath.mParent << lPath.mName << lPath.mIsDirectory << lPath.mRanges << lPath.mContent;
+	}
+	if(mIndexContent) {
+		lStream << qint32(mContentOids.count());
+		for(int i = 0; i < mContentOids.count(); ++i) {
+			lStream.writeRawData(reinterpret_cast<const char *>(mContentOids.at(i).id), GIT_OID_RAWSZ);
+			lStream << qint32(mContentEntries.at(i).count());
+			foreach(const ContentEntry &lEntry, mContentEntries.at(i)) {
+				lStream << lEntry.mPath << lEntry.mFirstSeen << lEntry.mLastSeen;
+			}
+		}
+	}
+	return lStream.status() == QDataStream::Ok && lFile.commit();
+}
+
+bool SearchIndex::indexNextBackup() {
+	TraceSpan lSpan("SearchIndex::indexNextBackup", "filedigger");
+	const int lIndex = mIndexedTimes.count();
+	if(lIndex >= mCommitTimes.count()) {
+		return true;
+	}
+	const qint64 lTime = mCommitTimes.at(lIndex);
+	const git_oid *lTree = &mTrees.at(lIndex);
+	bool lOk = true;
+	if(lIndex == 0) {
+		lOk = addTree(ROOT_PATH_ID, lTree, lTime);
+	} else {
+		const qint64 lPreviousTime = mIndexedTimes.last();
+		TreeChangeList lChanges;
+		lOk = diffTrees(mListingCache, &mIndexedTrees.last(), lTree, lChanges);
+		// Removals first, a path which changed between file and folder is
+		// listed as both and must end up open.
+		foreach(const TreeChange &lChange, lChanges) {
+			if(lChange.mType == TREE_CHANGE_REMOVED) {
+				const quint32 lPath = pathIdForComponents(lChange.mPath, S_ISDIR(lChange.mMode));
+				if(S_ISDIR(lChange.mMode) && !removeTree(lPath, &lChange.mOid, lPreviousTime)) {
+					lOk = false;
+				}
+				closeRange(lPath, lPreviousTime);
+			}
+		}
+		foreach(const TreeChange &lChange, lChanges) {
+			if(lChange.mType == TREE_CHANGE_ADDED) {
+				const quint32 lPath = pathIdForComponents(lChange.mPath, S_ISDIR(lChange.mMode));
+				openRange(lPath, lTime);
+				if(!S_ISDIR(lChange.mMode)) {
+					openContent(lPath, &lChange.mOid, lTime);
+				} else if(!addTree(lPath, &lChange.mOid, lTime)) {
+					lOk = false;
+				}
+			} else if(lChange.mType == TREE_CHANGE_MODIFIED && mIndexContent) {
+				// only files are listed as modified, folders are diffed into.
+				const quint32 lPath = pathIdForComponents(lChange.mPath, false);
+				closeContent(lPath, lPreviousTime);
+				openContent(lPath, &lChange.mOid, lTime);
+			}
+		}
+	}
+	// Recorded even if some of it could not be read, a broken backup would
+	// otherwise stop all later ones from being indexed.
+	mIndexedTimes.append(lTime);
+	mIndexedTrees.append(*lTree);
+	return lOk;
+}
+
+SearchResultList SearchIndex::findContent(const git_oid *pOid) const {
+	SearchResultList lResults;
+	const quint32 lContentId = mContentIds.value(QByteArray(reinterpret_cast<const char *>(pOid->id),
+	                                                        GIT_OID_RAWSZ), NO_CONTENT_ID);
+	if(lContentId == NO_CONTENT_ID) {
+		return lResults;
+	}
+	foreach(const ContentEntry &lEntry, mContentEntries.at(lContentId)) {
+		SearchResult lResult;
+		lResult.mPath = pathComponents(lEntry.mPath);
+		lResult.mIsDirectory = false;
+		lResult.mFirstSeen = lEntry.mFirstSeen;
+		lResult.mLastSeen = lEntry.mLastSeen;
+		lResults.append(lResult);
+	}
+	qSort(lResults.begin(), lResults.end(), firstSeenLessThan);
+	return lResults;
+}
+
+SearchResultList SearchIndex::search(const QString &pQuery, int pMaxResults, bool *pTruncated) const {
+	TraceSpan lSpan("SearchIndex::search", "filedigger");
+	SearchResultList lResults;
+	if(pTruncated) {
+		*pTruncated = false;
+	}
+	const QString lQuery = pQuery.trimmed().toLower();
+	if(lQuery.isEmpty()) {
+		return lResults;
+	}
+	const bool lIsGlob = lQuery.contains(QLatin1Char('*')) || lQuery.contains(QLatin1Char('?')) ||
+	                     lQuery.contains(QLatin1Char('['));
+	QRegExp lGlob(lQuery, Qt::CaseInsensitive, QRegExp::Wildcard);
+	const QString lLiteral = lIsGlob ? longestGlobLiteral(lQuery) : lQuery;
+
+	// Names are checked one by one, but only those sharing the rarest trigram
+	// of the query when it is long enough to have one.
+	const QVector<quint32> *lCandidates = nullptr;
+	for(int i = 0; i + 3 <= lLiteral.length(); ++i) {
+		QHash<quint64, QVector<quint32> >::const_iterator lIter = mTrigrams.constFind(trigramAt(lLiteral, i));
+		if(lIter == mTrigrams.constEnd()) {
+			return lResults;
+		}
+		if(lCandidates == nullptr || lIter.value().count() < lCandidates->count()) {
+			lCandidates = &lIter.value();
+		}
+	}
+	// All matches are looked at, the ones sorting first are kept in a max heap
+	// so memory use stays at pMaxResults however many there are.
+	QVector<RankedResult> lHeap;
+	bool lTruncated = false;
+	const int lCandidateCount = lCandidates != nullptr ? lCandidates->count() : mNames.count();
+	for(int i = 0; i < lCandidateCount && pMaxResults > 0; ++i) {
+		const quint32 lNameId = lCandidates != nullptr ? lCandidates->at(i) : quint32(i);
+		const QString &lName = mNames.at(lNameId);
+		if(lIsGlob ? !lGlob.exactMatch(lName) : !lName.toLower().contains(lQuery)) {
+			continue;
+		}
+		foreach(quint32 lPathId, mNamePaths.at(lNameId)) {
+			const PathEntry &lPath = mPaths.at(lPathId);
+			if(lPath.mRanges.isEmpty()) {
+				continue;
+			}
+			RankedResult lRanked;
+			lRanked.mResult.mPath = pathComponents(lPathId);
+			lRanked.mResult.mIsDirectory = lPath.mIsDirectory;
+			lRanked.mResult.mFirstSeen = lPath.mRanges.first();
+			lRanked.mResult.mLastSeen = lPath.mRanges.last();
+			lRanked.mKey = lRanked.mResult.mPath.join(QLatin1Char('/'));
+			if(lHeap.count() == pMaxResults) {
+				lTruncated = true;
+				if(!rankedLessThan(lRanked, lHeap.first())) {
+					continue;
+				}
+				std::pop_heap(lHeap.begin(), lHeap.end(), rankedLessThan);
+				lHeap.removeLast();
+			}
+			lHeap.append(lRanked);
+			std::push_heap(lHeap.begin(), lHeap.end(), rankedLessThan);
+		}
+	}
+	std::sort_heap(lHeap.begin(), lHeap.end(), rankedLessThan);
+	lResults.reserve(lHeap.count());
+	foreach(const RankedResult &lRanked, lHeap) {
+		lResults.append(lRanked.mResult);
+	}
+	if(pTruncated) {
+		*pTruncated = lTruncated;
+	}
+	return lResults;
+}
+
+quint32 SearchIndex::internName(const QString &pName) {
+	QHash<QString, quint32>::const_iterator lIter = mNameIds.constFind(pName);
+	if(lIter != mNameIds.constEnd()) {
+		return lIter.value();
+	}
+	const quint32 lNameId = mNames.count();
+	mNames.append(pName);
+	mNameIds.insert(pName, lNameId);
+	mNamePaths.append(QVector<quint32>());
+	addTrigrams(lNameId);
+	return lNameId;
+}
+
+quint32 SearchIndex::pathId(quint32 pParent, const QString &pName, bool pIsDirectory) {
+	const quint32 lNameId = internName(pName);
+	const quint64 lKey = pathKey(pParent, lNameId);
+	QHash<quint64, quint32>::const_iterator lIter = mPathIds.constFind(lKey);
+	if(lIter != mPathIds.constEnd()) {
+		mPaths[lIter.value()].mIsDirectory = pIsDirectory;
+		return lIter.value();
+	}
+	PathEntry lPath;
+	lPath.mParent = pParent;
+	lPath.mName = lNameId;
+	lPath.mIsDirectory = pIsDirectory;
+	lPath.mContent = NO_CONTENT_ID;
+	const quint32 lPathId = mPaths.count();
+	mPaths.append(lPath);
+	mPathIds.insert(lKey, lPathId);
+	mNamePaths[lNameId].append(lPathId);
+	return lPathId;
+}
+
+quint32 SearchIndex::pathIdForComponents(const QStringList &pPath, bool pIsDirectory) {
+	quint32 lPathId = ROOT_PATH_ID;
+	for(int i = 0; i < pPath.count(); ++i) {
+		lPathId = pathId(lPathId, pPath.at(i), i + 1 < pPath.count() || pIsDirectory);
+	}
+	return lPathId;
+}
+
+void SearchIndex::openRange(quint32 pPath, qint64 pTime) {
+	QVector<qint64> &lRanges = mPaths[pPath].mRanges;
+	if(lRanges.isEmpty() || lRanges.last() != 0) {
+		lRanges.append(pTime);
+		lRanges.append(0);
+	}
+}
+
+void SearchIndex::closeRange(quint32 pPath, qint64 pTime) {
+	QVector<qint64> &lRanges = mPaths[pPath].mRanges;
+	if(!lRanges.isEmpty() && lRanges.last() == 0) {
+		lRanges.last() = pTime;
+	}
+	closeContent(pPath, pTime);
+}
+
+void SearchIndex::openContent(quint32 pPath, const git_oid *pOid, qint64 pTime) {
+	if(!mIndexContent) {
+		return;
+	}
+	const QByteArray lKey(reinterpret_cast<const char *>(pOid->id), GIT_OID_RAWSZ);
+	QHash<QByteArray, quint32>::const_iterator lIter = mContentIds.constFind(lKey);
+	quint32 lContentId;
+	if(lIter != mContentIds.constEnd()) {
+		lContentId = lIter.value();
+	} else {
+		lContentId = mContentOids.count();
+		mContentOids.append(*pOid);
+		mContentEntries.append(QVector<ContentEntry>());
+		mContentIds.insert(lKey, lContentId);
+	}
+	if(mPaths.at(pPath).mContent == lContentId) {
+		return;
+	}
+	ContentEntry lEntry;
+	lEntry.mPath = pPath;
+	lEntry.mFirstSeen = pTime;
+	lEntry.mLastSeen = 0;
+	mContentEntries[lContentId].append(lEntry);
+	mPaths[pPath].mContent = lContentId;
+}
+
+void SearchIndex::closeContent(quint32 pPath, qint64 pTime) {
+	const quint32 lContentId = mPaths.at(pPath).mContent;
+	if(lContentId == NO_CONTENT_ID) {
+		return;
+	}
+	QVector<ContentEntry> &lEntries = mContentEntries[lContentId];
+	for(int i = lEntries.count() - 1; i >= 0; --i) {
+		if(lEntries.at(i).mPath == pPath && lEntries.at(i).mLastSeen == 0) {
+			lEntries[i].mLastSeen = pTime;
+			break;
+		}
+	}
+	mPaths[pPath].mContent = NO_CONTENT_ID;
+}
+
+bool SearchIndex::addTree(quint32 pParent, const git_oid *pTree, qint64 pTime) {
+	ListingEntryList lEntries;
+	if(!mListingCache->basicListing(pTree, lEntries)) {
+		return false;
+	}
+	bool lOk = true;
+	foreach(const ListingEntry &lEntry, lEntries) {
+		const quint32 lPath = pathId(pParent, lEntry.mName, S_ISDIR(lEntry.mTreeMode));
+		openRange(lPath, pTime);
+		if(!S_ISDIR(lEntry.mTreeMode)) {
+			openContent(lPath, &lEntry.mOid, pTime);
+		} else if(!addTree(lPath, &lEntry.mOid, pTime)) {
+			lOk = false;
+		}
+	}
+	return lOk;
+}
+
+bool SearchIndex::removeTree(quint32 pParent, const git_oid *pTree, qint64 pLastTime) {
+	ListingEntryList lEntries;
+	if(!mListingCache->basicListing(pTree, lEntries)) {
+		return false;
+	}
+	bool lOk = true;
+	foreach(const ListingEntry &lEntry, lEntries) {
+		const quint32 lPath = pathId(pParent, lEntry.mName, S_ISDIR(lEntry.mTreeMode));
+		if(S_ISDIR(lEntry.mTreeMode) && !removeTree(lPath, &lEntry.mOid, pLastTime)) {
+			lOk = false;
+		}
+		closeRange(lPath, pLastTime);
+	}
+	return lOk;
+}
+
+void SearchIndex::addTrigrams(quint32 pNameId) {
+	const QString lName = mNames.at(pNameId).toLower();
+	for(int i = 0; i + 3 <= lName.length(); ++i) {
+		QVector<quint32> &lNameIds = mTrigrams[trigramAt(lName, i)];
+		if(lNameIds.isEmpty() || lNameIds.last() != pNameId) {
+			lNameIds.append(pNameId);
+		}
+	}
+}
+
+QStringList SearchIndex::pathComponents(quint32 pPath) const {
+	QStringList lComponents;
+	while(pPath != ROOT_PATH_ID) {
+		const PathEntry &lPath = mPaths.at(pPath);
+		lComponents.prepend(mNames.at(lPath.mName));
+		pPath = lPath.mParent;
+	}
+	return lComponents;
+}
@@ -0,0 +1,123 @@
+/***************************************************************************
+ *   Copyright Simon Persson                                               *
+ *   simonpersson1@gmail.com                                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef SEARCHINDEX_H
+#define SEARCHINDEX_H
+
+#include <QHash>
+#include <QStringList>
+#include <QVector>
+
+#include <git2.h>
+
+class ListingCache;
+
+struct SearchResult {
+	QStringList mPath;
+	bool mIsDirectory;
+	qint64 mFirstSeen; // commit time of the first backup with this path
+	qint64 mLastSeen;  // commit time of the last backup with it, 0 if still in the newest one
+};
+
+typedef QVector<SearchResult> SearchResultList;
+
+// Index of every path that ever appeared in a branch. Path components are
+// interned and every path keeps the time ranges of backups it was part of.
+// Backups are added oldest first by diffing each one against the previous,
+// so unchanged sub trees cost nothing. Names are looked up through a trigram
+// index, a query is either a substring or a glob pattern (with * ? or [])
+// matched against file and folder names, case insensitive.
+// The index is kept in the user's cache folder and only the backups taken
+// since last time need to be added when it is opened again.
+// Optionally the index also records which file content (blob or chunk tree
+// id) was at which path when, so all places a version of a file was backed up
+// at can be found. Once an index has this it is kept up to date from then on.
+class SearchIndex {
+public:
+	SearchIndex(ListingCache *pListingCache, const QString &pRepositoryPath, const QString &pBranchName,
+	            bool pIndexContent = false);
+
+	// Give the backups of the branch oldest first. Anything indexed earlier
+	// which does not match them is thrown away.
+	void load(const QVector<qint64> &pCommitTimes, const QVector<git_oid> &pTrees);
+	bool save() const;
+
+	int indexedCount() const { return mIndexedTimes.count(); }
+	int backupCount() const { return mCommitTimes.count(); }
+	// Returns false if the backup could not be read, it is then skipped.
+	bool indexNextBackup();
+
+	// The first pMaxResults matches sorted by path. pTruncated is set when
+	// there were more.
+	SearchResultList search(const QString &pQuery, int pMaxResults, bool *pTruncated = nullptr) const;
+	bool hasContentIndex() const { return mIndexContent; }
+	// Every path where this content was stored, with the times it was there.
+	// A path shows up once per stretch of backups it had the content.
+	SearchResultList findContent(const git_oid *pOid) const;
+
+protected:
+	struct PathEntry {
+		quint32 mParent;
+		quint32 mName;
+		bool mIsDirectory;
+		QVector<qint64> mRanges; // pairs of first and last commit time, last is 0 while open
+		quint32 mContent; // content id while the path is in the newest indexed backup
+	};
+
+	struct ContentEntry {
+		quint32 mPath;
+		qint64 mFirstSeen;
+		qint64 mLastSeen; // 0 while still there
+	};
+
+	void clear();
+	quint32 internName(const QString &pName);
+	quint32 pathId(quint32 pParent, const QString &pName, bool pIsDirectory);
+	quint32 pathIdForComponents(const QStringList &pPath, bool pIsDirectory);
+	void openRange(quint32 pPath, qint64 pTime);
+	void closeRange(quint32 pPath, qint64 pTime);
+	void openContent(quint32 pPath, const git_oid *pOid, qint64 pTime);
+	void closeContent(quint32 pPath, qint64 pTime);
+	bool addTree(quint32 pParent, const git_oid *pTree, qint64 pTime);
+	bool removeTree(quint32 pParent, const git_oid *pTree, qint64 pLastTime);
+	void addTrigrams(quint32 pNameId);
+	QStringList pathComponents(quint32 pPath) const;
+
+	ListingCache *mListingCache;
+	QString mCachePath;
+	QVector<qint64> mCommitTimes;
+	QVector<git_oid> mTrees;
+	QVector<qint64> mIndexedTimes;
+	QVector<git_oid> mIndexedTrees;
+
+	QStringList mNames;
+	QHash<QString, quint32> mNameIds;
+	QVector<QVector<quint32> > mNamePaths; // name id to the paths with that name
+	QVector<PathEntry> mPaths;
+	QHash<quint64, quint32> mPathIds; // parent path id and name id to path id
+	QHash<quint64, QVector<quint32> > mTrigrams; // trigram of lower case name to name ids
+
+	bool mIndexContent;
+	QVector<git_oid> mContentOids;
+	QVector<QVector<ContentEntry> > mContentEntries; // content id to where it was stored
+	QHash<QByteArray, quint32> mContentIds; // raw oid to content id
+};
+
+#endif // SEARCHINDEX_H
@@ -207,8 +207,19 @@ void VersionListDelegate::paint(QPainter *pPainter, const QStyleOptionViewItem &
 		QString lSizeText = KFormat().formatByteSize((double)pIndex.data(VersionSizeRole).toULongLong());
 		pPainter->drawText(lMarginRect, Qt::AlignRight | Qt::AlignTop, lSizeText, &lSizeDisplayBounds);
 	}
+	QRect lChangesDisplayBounds;
+	const QString lChangesText = pIndex.data(VersionChangesRole).toString();
+	if(!lChangesText.isEmpty()) {
+		QRect lChangesRect = lMarginRect.adjusted(0, 0, -lSizeDisplayBounds.width() - 2*cMargin, 0);
+		pPainter->save();
+		pPainter->setOpacity(0.6);
+		pPainter->drawText(lChangesRect, Qt::AlignRight | Qt::AlignTop, lChangesText, &lChangesDisplayBounds);
+		pPainter->restore();
+		lChangesDisplayBounds.adjust(-2*cMargin, 0, 0, 0);
+	}
 	QString lDateText = pOption.fontMetrics.elidedText(pIndex.data().toString(), Qt::ElideRight,
-	                                                   lMarginRect.width() - lSizeDisplayBounds.width());
+	                                                   lMarginRect.width() - lSizeDisplayBounds.width()
+	                                                   - lChangesDisplayBounds.width());
 	pPainter->drawText(lMarginRect, Qt::AlignLeft | Qt::AlignTop, lDateText);
 	pPainter->restore();
 
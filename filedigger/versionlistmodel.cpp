@@ -28,11 +28,34 @@
 #include <QLocale>
 #include <QMimeDatabase>
 #include <QMimeType>
+#include <QThread>
+
+#define MAX_TOOLTIP_RANGES 10
+
+static QByteArray changesKey(const VersionData *pOld, const VersionData *pNew) {
+	QByteArray lKey(reinterpret_cast<const char *>(pOld->mOid.id), GIT_OID_RAWSZ);
+	lKey.append(reinterpret_cast<const char *>(pNew->mOid.id), GIT_OID_RAWSZ);
+	return lKey;
+}
 
 VersionListModel::VersionListModel(QObject *parent) :
    QAbstractListModel(parent)
 {
 	mVersionList = nullptr;
+	mNode = nullptr;
+	qRegisterMetaType<ChunkChanges>("ChunkChanges");
+	// comparing big files can take a while, do it without blocking the view.
+	mDiffThread = new QThread(this);
+	mDiffer = new ChunkDiffer;
+	mDiffer->moveToThread(mDiffThread);
+	connect(mDiffThread, &QThread::finished, mDiffer, &QObject::deleteLater);
+	connect(mDiffer, &ChunkDiffer::compared, this, &VersionListModel::storeChanges);
+	mDiffThread->start();
+}
+
+VersionListModel::~VersionListModel() {
+	mDiffThread->quit();
+	mDiffThread->wait();
 }
 
 void VersionListModel::setNode(const MergedNode *pNode) {
@@ -56,7 +79,7 @@ QVariant VersionListModel::data(const QModelIndex &pIndex, int pRole) const {
 	}
 	QMimeDatabase db;
 	KFormat lFormat;
-	VersionData *lData = mVersionList->at(pIndex.row());
+	const VersionData *lData = mVersionList->at(pIndex.row());
 	switch (pRole) {
 	case Qt::DisplayRole:
 		return lFormat.formatRelativeDateTime(QDateTime::fromTime_t(lData->mModifiedDate), QLocale::ShortFormat);
@@ -69,20 +92,91 @@ QVariant VersionListModel::data(const QModelIndex &pIndex, int pRole) const {
 		if(mNode->isDirectory()) {
 			return QString(QStringLiteral("inode/directory"));
 		}
-		return db.mimeTypeForFile(mNode->objectName(), QMimeDatabase::MatchExtension).name();
+		return db.mimeTypeForFile(mNode->name(), QMimeDatabase::MatchExtension).name();
 	case VersionSizeRole:
-		return lData->size();
+		return lData->size(mNode->repository());
 	case VersionSourceInfoRole: {
 		BupSourceInfo lSourceInfo;
 		mNode->getBupUrl(pIndex.row(), &lSourceInfo.mBupKioPath, &lSourceInfo.mRepoPath, &lSourceInfo.mBranchName,
 		                 &lSourceInfo.mCommitTime, &lSourceInfo.mPathInRepo);
 		lSourceInfo.mIsDirectory = mNode->isDirectory();
-		lSourceInfo.mSize = lData->size();
+		lSourceInfo.mSize = lData->size(mNode->repository());
 		return QVariant::fromValue<BupSourceInfo>(lSourceInfo);
 	}
 	case VersionIsDirectoryRole:
 		return mNode->isDirectory();
+	case VersionChangesRole: {
+		const ChunkChanges *lChanges = changesFromOlder(pIndex.row());
+		if(lChanges == nullptr) {
+			return QVariant();
+		}
+		if(lChanges->mChangedBytes == 0) {
+			return xi18nc("@item:intable", "No new data");
+		}
+		return xi18ncp("@item:intable %2 is a size", "%2 changed in one place", "%2 changed in %1 places",
+		               lChanges->mChangedRanges.count(), lFormat.formatByteSize(lChanges->mChangedBytes));
+	}
+	case Qt::ToolTipRole: {
+		const ChunkChanges *lChanges = changesFromOlder(pIndex.row());
+		if(lChanges == nullptr || lChanges->mChangedRanges.isEmpty()) {
+			return QVariant();
+		}
+		QStringList lLines;
+		for(int i = 0; i < lChanges->mChangedRanges.count() && i < MAX_TOOLTIP_RANGES; ++i) {
+			const ChunkRange &lRange = lChanges->mChangedRanges.at(i);
+			lLines << xi18nc("@info:tooltip %1 is a size, %2 a position in the file", "%1 at %2",
+			                 lFormat.formatByteSize(lRange.mSize), lFormat.formatByteSize(lRange.mOffset));
+		}
+		if(lChanges->mChangedRanges.count() > MAX_TOOLTIP_RANGES) {
+			lLines << xi18ncp("@info:tooltip", "and one more place", "and %1 more places",
+			                  lChanges->mChangedRanges.count() - MAX_TOOLTIP_RANGES);
+		}
+		return lLines.join(QLatin1Char('\n'));
+	}
 	default:
 		return QVariant();
 	}
 }
+
+const ChunkChanges *VersionListModel::changesFromOlder(int pRow) const {
+	// only files split into chunks can be compared without reading them.
+	if(mNode->isDirectory() || pRow + 1 >= mVersionList->count()) {
+		return nullptr;
+	}
+	const VersionData *lNew = mVersionList->at(pRow);
+	const VersionData *lOld = mVersionList->at(pRow + 1);
+	if(!lNew->mChunkedFile || !lOld->mChunkedFile) {
+		return nullptr;
+	}
+	const QByteArray lKey = changesKey(lOld, lNew);
+	QHash<QByteArray, ChunkChanges>::const_iterator lIter = mChanges.constFind(lKey);
+	if(lIter != mChanges.constEnd()) {
+		return &lIter.value();
+	}
+	if(!mPendingChanges.contains(lKey)) {
+		mPendingChanges.insert(lKey);
+		QMetaObject::invokeMethod(mDiffer, "compare", Qt::QueuedConnection,
+		                          Q_ARG(QString, QString::fromLocal8Bit(git_repository_path(mNode->repository()))),
+		                          Q_ARG(QByteArray, lKey.left(GIT_OID_RAWSZ)),
+		                          Q_ARG(QByteArray, lKey.mid(GIT_OID_RAWSZ)));
+	}
+	return nullptr;
+}
+
+void VersionListModel::storeChanges(const QByteArray &pOldOid, const QByteArray &pNewOid,
+                                    const ChunkChanges &pChanges, bool pOk) {
+	if(!pOk) {
+		return; // left as pending, no point in trying again
+	}
+	const QByteArray lKey = pOldOid + pNewOid;
+	mChanges.insert(lKey, pChanges);
+	mPendingChanges.remove(lKey);
+	if(mVersionList == nullptr || mNode->isDirectory()) {
+		return;
+	}
+	for(int i = 0; i + 1 < mVersionList->count(); ++i) {
+		if(changesKey(mVersionList->at(i + 1), mVersionList->at(i)) == lKey) {
+			emit dataChanged(index(i), index(i));
+		}
+	}
+}
@@ -22,8 +22,12 @@
 #define VERSIONLISTMODEL_H
 
 #include <QAbstractListModel>
+#include <QSet>
+#include "chunkdiff.h"
 #include "mergedvfs.h"
 
+class QThread;
+
 struct BupSourceInfo {
 	QUrl mBupKioPath;
 	QString mRepoPath;
@@ -41,13 +45,25 @@ class VersionListModel : public QAbstractListModel
 	Q_OBJECT
 public:
 	explicit VersionListModel(QObject *parent = 0);
+	~VersionListModel();
 	void setNode(const MergedNode *pNode);
 	int rowCount(const QModelIndex &pParent) const;
 	QVariant data(const QModelIndex &pIndex, int pRole) const;
 
+protected slots:
+	void storeChanges(const QByteArray &pOldOid, const QByteArray &pNewOid, const ChunkChanges &pChanges, bool pOk);
+
 protected:
+	// Returns nullptr and starts comparing in the background if not known yet.
+	const ChunkChanges *changesFromOlder(int pRow) const;
+
 	const VersionList *mVersionList;
 	const MergedNode *mNode;
+	QThread *mDiffThread;
+	ChunkDiffer *mDiffer;
+	// keyed by old and new chunk tree id, kept while other files are shown.
+	QHash<QByteArray, ChunkChanges> mChanges;
+	mutable QSet<QByteArray> mPendingChanges;
 };
 
 enum VersionDataRole {
@@ -55,7 +71,8 @@ enum VersionDataRole {
 	VersionMimeTypeRole, // QString
 	VersionSizeRole, // quint64
 	VersionSourceInfoRole, // PathInfo
-	VersionIsDirectoryRole // bool
+	VersionIsDirectoryRole, // bool
+	VersionChangesRole // QString, what changed since the version before, empty until known
 };
 
 #endif // VERSIONLISTMODEL_H
@@ -0,0 +1,243 @@
+/***************************************************************************
+ *   Copyright Simon Persson                                               *
+ *   simonpersson1@gmail.com                                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "hashsplit.h"
+
+#include <git2/odb.h>
+
+#include <stdio.h>
+#include <string.h>
+
+// Offset added to each byte, bup inherited it from rsync's checksum.
+#define ROLLSUM_CHAR_OFFSET 31
+#define SPLIT_MASK ((1u << HASHSPLIT_BLOB_BITS) - 1)
+
+// The checksum state lives in locals while rolling, so the compiler can keep it
+// in registers. Returns how many bytes were rolled in, stopping right after a
+// split point (pSplit is then set) or at the end of pData. pWindow holds the
+// last bytes rolled in, pWindow[pWindowOffset] is the oldest one.
+static inline size_t rollUntilSplit(uint32_t &pS1, uint32_t &pS2, unsigned char *pWindow,
+                                    unsigned int &pWindowOffset, const unsigned char *pData, size_t pSize,
+                                    bool &pSplit) {
+	uint32_t lS1 = pS1, lS2 = pS2;
+	unsigned int lWindowOffset = pWindowOffset;
+	size_t i = 0;
+	pSplit = false;
+	// The byte dropping out of the window comes from pWindow until a whole
+	// window of pData has been rolled in, after that straight from pData.
+	while(i < pSize && i < HASHSPLIT_WINDOW_SIZE) {
+		const uint32_t lAdd = pData[i++];
+		const uint32_t lDrop = pWindow[lWindowOffset];
+		pWindow[lWindowOffset] = static_cast<unsigned char>(lAdd);
+		lWindowOffset = (lWindowOffset + 1) & (HASHSPLIT_WINDOW_SIZE - 1);
+		lS1 += lAdd - lDrop;
+		lS2 += lS1 - HASHSPLIT_WINDOW_SIZE * (lDrop + ROLLSUM_CHAR_OFFSET);
+		if((lS2 & SPLIT_MASK) == SPLIT_MASK) {
+			pSplit = true;
+			break;
+		}
+	}
+	if(!pSplit && i == HASHSPLIT_WINDOW_SIZE) {
+		while(i < pSize) {
+			const uint32_t lAdd = pData[i];
+			const uint32_t lDrop = pData[i - HASHSPLIT_WINDOW_SIZE];
+			++i;
+			lS1 += lAdd - lDrop;
+			lS2 += lS1 - HASHSPLIT_WINDOW_SIZE * (lDrop + ROLLSUM_CHAR_OFFSET);
+			if((lS2 & SPLIT_MASK) == SPLIT_MASK) {
+				pSplit = true;
+				break;
+			}
+		}
+		memcpy(pWindow, pData + i - HASHSPLIT_WINDOW_SIZE, HASHSPLIT_WINDOW_SIZE);
+		lWindowOffset = 0;
+	}
+	pS1 = lS1;
+	pS2 = lS2;
+	pWindowOffset = lWindowOffset;
+	return i;
+}
+
+// Number of set bits from HASHSPLIT_BLOB_BITS upwards, counted the way bup does.
+static int splitBits(uint32_t pS1, uint32_t pS2) {
+	uint32_t lDigest = (pS1 << 16) | (pS2 & 0xffff);
+	lDigest >>= HASHSPLIT_BLOB_BITS;
+	int lBits = HASHSPLIT_BLOB_BITS;
+	while((lDigest >>= 1) & 1) {
+		++lBits;
+	}
+	return lBits;
+}
+
+size_t findSplitOffset(const unsigned char *pData, size_t pSize, int *pBits) {
+	uint32_t lS1 = HASHSPLIT_WINDOW_SIZE * ROLLSUM_CHAR_OFFSET;
+	uint32_t lS2 = HASHSPLIT_WINDOW_SIZE * (HASHSPLIT_WINDOW_SIZE - 1) * ROLLSUM_CHAR_OFFSET;
+	unsigned char lWindow[HASHSPLIT_WINDOW_SIZE];
+	memset(lWindow, 0, sizeof(lWindow));
+	unsigned int lWindowOffset = 0;
+	bool lSplit;
+	const size_t lUsed = rollUntilSplit(lS1, lS2, lWindow, lWindowOffset, pData, pSize, lSplit);
+	if(!lSplit) {
+		return 0;
+	}
+	if(pBits != nullptr) {
+		*pBits = splitBits(lS1, lS2);
+	}
+	return lUsed;
+}
+
+HashSplitter::HashSplitter(int pFanout) {
+	// bup uses the whole number of bits in the fanout, 128 if it is zero.
+	if(pFanout <= 0) {
+		pFanout = 128;
+	}
+	mFanoutBits = 0;
+	while((2 << mFanoutBits) <= pFanout) {
+		++mFanoutBits;
+	}
+	if(mFanoutBits == 0) {
+		mFanoutBits = 1;
+	}
+	mChunk.reserve(HASHSPLIT_BLOB_MAX);
+	mOffset = 0;
+	mStacks.resize(1);
+	resetChecksum();
+}
+
+HashSplitter::~HashSplitter() {
+}
+
+void HashSplitter::write(const void *pData, size_t pSize) {
+	const unsigned char *lData = static_cast<const unsigned char *>(pData);
+	while(pSize > 0) {
+		// a chunk is cut at HASHSPLIT_BLOB_MAX bytes even without a split point.
+		const size_t lRoom = HASHSPLIT_BLOB_MAX - mChunk.size();
+		bool lSplit;
+		const size_t lUsed = rollUntilSplit(mS1, mS2, mWindow, mWindowOffset, lData,
+		                                    pSize < lRoom ? pSize : lRoom, lSplit);
+		if(!lSplit && lUsed < lRoom) {
+			mChunk.insert(mChunk.end(), lData, lData + lUsed);
+			return; // the chunk continues in the next write
+		}
+		const int lLevel = lSplit ? (splitBits(mS1, mS2) - HASHSPLIT_BLOB_BITS) / mFanoutBits : 0;
+		if(mChunk.empty()) {
+			addChunk(lData, lUsed, lLevel);
+		} else {
+			mChunk.insert(mChunk.end(), lData, lData + lUsed);
+			addChunk(mChunk.data(), mChunk.size(), lLevel);
+			mChunk.clear();
+		}
+		resetChecksum();
+		lData += lUsed;
+		pSize -= lUsed;
+	}
+}
+
+void HashSplitter::finish(git_oid *pOid, unsigned int *pMode) {
+	if(!mChunk.empty()) {
+		addChunk(mChunk.data(), mChunk.size(), 0);
+		mChunk.clear();
+	}
+	squish(mStacks.size() - 1);
+	const TreeItemList &lTop = mStacks.back();
+	if(lTop.size() == 1) {
+		*pOid = lTop.front().mOid;
+		*pMode = lTop.front().mMode;
+	} else if(lTop.empty()) {
+		git_odb_hash(pOid, "", 0, GIT_OBJ_BLOB);
+		addBlob(pOid, nullptr, 0, 0);
+		*pMode = HASHSPLIT_MODE_FILE;
+	} else {
+		*pOid = makeTree(lTop).mOid;
+		*pMode = HASHSPLIT_MODE_TREE;
+	}
+	mOffset = 0;
+	mStacks.clear();
+	mStacks.resize(1);
+	resetChecksum();
+}
+
+void HashSplitter::addBlob(const git_oid *pOid, const unsigned char *pData, size_t pSize, uint64_t pOffset) {
+	(void)pOid; (void)pData; (void)pSize; (void)pOffset;
+}
+
+void HashSplitter::addTree(const git_oid *pOid, const std::string &pContent) {
+	(void)pOid; (void)pContent;
+}
+
+void HashSplitter::resetChecksum() {
+	mS1 = HASHSPLIT_WINDOW_SIZE * ROLLSUM_CHAR_OFFSET;
+	mS2 = HASHSPLIT_WINDOW_SIZE * (HASHSPLIT_WINDOW_SIZE - 1) * ROLLSUM_CHAR_OFFSET;
+	mWindowOffset = 0;
+	memset(mWindow, 0, sizeof(mWindow));
+}
+
+void HashSplitter::addChunk(const unsigned char *pData, size_t pSize, int pLevel) {
+	TreeItem lItem;
+	lItem.mMode = HASHSPLIT_MODE_FILE;
+	lItem.mSize = pSize;
+	git_odb_hash(&lItem.mOid, pData, pSize, GIT_OBJ_BLOB);
+	addBlob(&lItem.mOid, pData, pSize, mOffset);
+	mOffset += pSize;
+	mStacks.front().push_back(lItem);
+	squish(pLevel);
+}
+
+// Moves everything below pLevel, and any full level, one level up. Like bup's
+// _squish(), a level with a single item is moved up as it is.
+void HashSplitter::squish(size_t pLevel) {
+	for(size_t i = 0; i < pLevel || mStacks[i].size() >= HASHSPLIT_MAX_PER_TREE; ++i) {
+		if(mStacks.size() <= i + 1) {
+			mStacks.resize(i + 2);
+		}
+		if(mStacks[i].size() == 1) {
+			mStacks[i + 1].push_back(mStacks[i].front());
+		} else if(!mStacks[i].empty()) {
+			mStacks[i + 1].push_back(makeTree(mStacks[i]));
+		}
+		mStacks[i].clear();
+	}
+}
+
+// Entries are named by their offset in hex, all of the same width. That makes
+// name order the same as offset order, which is also git's tree order.
+HashSplitter::TreeItem HashSplitter::makeTree(const TreeItemList &pItems) {
+	uint64_t lTotal = 0;
+	for(const TreeItem &lItem: pItems) {
+		lTotal += lItem.mSize;
+	}
+	char lName[32];
+	const int lNameWidth = snprintf(lName, sizeof(lName), "%llx", static_cast<unsigned long long>(lTotal));
+	std::string lContent;
+	lContent.reserve(pItems.size() * (8 + lNameWidth + GIT_OID_RAWSZ));
+	uint64_t lOffset = 0;
+	for(const TreeItem &lItem: pItems) {
+		lContent.append(lItem.mMode == HASHSPLIT_MODE_TREE ? "40000 " : "100644 ");
+		snprintf(lName, sizeof(lName), "%0*llx", lNameWidth, static_cast<unsigned long long>(lOffset));
+		lContent.append(lName, lNameWidth + 1); // with the terminating zero
+		lContent.append(reinterpret_cast<const char *>(lItem.mOid.id), GIT_OID_RAWSZ);
+		lOffset += lItem.mSize;
+	}
+	TreeItem lTree;
+	lTree.mMode = HASHSPLIT_MODE_TREE;
+	lTree.mSize = lTotal;
+	git_odb_hash(&lTree.mOid, lContent.data(), lContent.size(), GIT_OBJ_TREE);
+	addTree(&lTree.mOid, lContent);
+	return lTree;
+}
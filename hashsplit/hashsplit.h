@@ -0,0 +1,90 @@
+/***************************************************************************
+ *   Copyright Simon Persson                                               *
+ *   simonpersson1@gmail.com                                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef HASHSPLIT_H
+#define HASHSPLIT_H
+
+#include <git2.h>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// bup's rolling checksum and file splitting, giving the same chunks, chunk
+// trees and object ids as "bup split" and "bup save". This lets Kup compare
+// local files with backed up ones without running bup. No Qt in here, it is
+// meant to be usable from any part of Kup.
+
+#define HASHSPLIT_BLOB_BITS 13
+#define HASHSPLIT_BLOB_MAX (1 << (HASHSPLIT_BLOB_BITS + 2))
+#define HASHSPLIT_WINDOW_SIZE 64
+#define HASHSPLIT_MAX_PER_TREE 256
+#define HASHSPLIT_MODE_FILE 0100644
+#define HASHSPLIT_MODE_TREE 040000
+
+// Returns the length of the first chunk in pData, 0 if pData does not contain a
+// split point. pBits then tells how many of the checksum's low bits were set,
+// it decides how high up in the chunk tree the split is. Same as
+// bupsplit_find_ofs() in bup.
+size_t findSplitOffset(const unsigned char *pData, size_t pSize, int *pBits);
+
+// Feed a file's content with write(), then call finish(). Override the add
+// functions to store or look up the objects as they are made.
+class HashSplitter {
+public:
+	// pFanout is bup's --fanout, the default is what bup uses.
+	explicit HashSplitter(int pFanout = 16);
+	virtual ~HashSplitter();
+
+	void write(const void *pData, size_t pSize);
+	// pOid gets the id of the blob, or of the chunk tree if the file got split,
+	// pMode tells which. After this the splitter can be used for the next file.
+	void finish(git_oid *pOid, unsigned int *pMode);
+	uint64_t bytesWritten() const { return mOffset + mChunk.size(); }
+
+protected:
+	// Called with every chunk in file order, pOffset is where in the file it starts.
+	virtual void addBlob(const git_oid *pOid, const unsigned char *pData, size_t pSize, uint64_t pOffset);
+	// Called with every chunk tree, pContent is in git's tree format.
+	virtual void addTree(const git_oid *pOid, const std::string &pContent);
+
+	struct TreeItem {
+		unsigned int mMode;
+		git_oid mOid;
+		uint64_t mSize;
+	};
+	typedef std::vector<TreeItem> TreeItemList;
+
+	void resetChecksum();
+	void addChunk(const unsigned char *pData, size_t pSize, int pLevel);
+	void squish(size_t pLevel);
+	TreeItem makeTree(const TreeItemList &pItems);
+
+	int mFanoutBits;
+	uint32_t mS1, mS2;
+	unsigned int mWindowOffset;
+	unsigned char mWindow[HASHSPLIT_WINDOW_SIZE];
+	std::vector<unsigned char> mChunk; // start of a chunk which continues in the next write
+	uint64_t mOffset; // where in the file mChunk starts
+	std::vector<TreeItemList> mStacks; // chunks and trees not yet put in a tree, by level
+};
+
+#endif // HASHSPLIT_H
@@ -0,0 +1,67 @@
+/***************************************************************************
+ *   Copyright Simon Persson                                               *
+ *   simonpersson1@gmail.com                                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+// Measures how fast content is split and hashed, without any disk reads.
+// Usage: kup-hashsplit-bench [MiB of content] [rounds]
+
+#include "hashsplit.h"
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+
+int main(int pArgc, char **pArgv) {
+	const size_t lMiB = pArgc > 1 ? strtoul(pArgv[1], nullptr, 10) : 256;
+	const int lRounds = pArgc > 2 ? atoi(pArgv[2]) : 5;
+	if(lMiB == 0 || lRounds <= 0) {
+		fprintf(stderr, "Usage: kup-hashsplit-bench [MiB of content] [rounds]\n");
+		return 1;
+	}
+	std::vector<unsigned char> lData(lMiB << 20);
+	uint32_t x = 1;
+	for(size_t i = 0; i < lData.size(); ++i) {
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		lData[i] = static_cast<unsigned char>(x >> 24);
+	}
+
+	// Written in 1 MiB pieces, like a file being read.
+	const size_t lPieceSize = 1 << 20;
+	double lBest = 0.0;
+	for(int lRound = 0; lRound < lRounds; ++lRound) {
+		HashSplitter lSplitter;
+		const std::chrono::steady_clock::time_point lStart = std::chrono::steady_clock::now();
+		for(size_t i = 0; i < lData.size(); i += lPieceSize) {
+			lSplitter.write(lData.data() + i, lData.size() - i < lPieceSize ? lData.size() - i : lPieceSize);
+		}
+		git_oid lOid;
+		unsigned int lMode;
+		lSplitter.finish(&lOid, &lMode);
+		const std::chrono::duration<double> lTime = std::chrono::steady_clock::now() - lStart;
+		const double lRate = static_cast<double>(lData.size()) / lTime.count() / 1e9;
+		printf("round %d: %.3f s, %.3f GB/s\n", lRound + 1, lTime.count(), lRate);
+		if(lRate > lBest) {
+			lBest = lRate;
+		}
+	}
+	printf("best: %.3f GB/s\n", lBest);
+	return 0;
+}
@@ -0,0 +1,155 @@
+/***************************************************************************
+ *   Copyright Simon Persson                                               *
+ *   simonpersson1@gmail.com                                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+// Splits fixed inputs and compares with the object ids "bup split" gives for
+// the same content. Run by ctest.
+
+#include "hashsplit.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// Counts the chunks, to make sure the inputs really hit the cases they are
+// meant for.
+class CountingSplitter: public HashSplitter {
+public:
+	explicit CountingSplitter(int pFanout)
+	   : HashSplitter(pFanout), mBlobs(0), mFullBlobs(0), mNextOffset(0), mOffsetsOk(true) {}
+	int mBlobs;
+	int mFullBlobs;
+	uint64_t mNextOffset;
+	bool mOffsetsOk;
+
+protected:
+	virtual void addBlob(const git_oid *pOid, const unsigned char *pData, size_t pSize, uint64_t pOffset) {
+		(void)pOid; (void)pData;
+		if(pSize == 0) {
+			return; // the empty file
+		}
+		++mBlobs;
+		if(pSize == HASHSPLIT_BLOB_MAX) {
+			++mFullBlobs;
+		}
+		mOffsetsOk = mOffsetsOk && pOffset == mNextOffset;
+		mNextOffset = pOffset + pSize;
+	}
+};
+
+enum Content {
+	TEXT,
+	ZEROS,
+	RANDOM
+};
+
+struct TestCase {
+	const char *mName;
+	Content mContent;
+	size_t mSize;
+	uint32_t mSeed;
+	int mFanout;
+	unsigned int mMode;
+	const char *mOid;
+	int mBlobs;
+	int mFullBlobs; // chunks cut at HASHSPLIT_BLOB_MAX
+};
+
+// The random content is the top byte of a xorshift32 sequence, so it is the
+// same everywhere. Zeros never give a split point, everything is cut at
+// HASHSPLIT_BLOB_MAX; 9 MiB of them overflows the 256 entries a chunk tree
+// can take. Random content with fanout 2 gives a tree six levels deep.
+static const TestCase sCases[] = {
+	{"empty", TEXT, 0, 0, 16, HASHSPLIT_MODE_FILE, "e69de29bb2d1d6434b8b29ae775ad8c2e48c5391", 0, 0},
+	{"short text", TEXT, 25, 0, 16, HASHSPLIT_MODE_FILE, "59904faa5f1a1cda5e1bb0fe4e2bb176f98e3de3", 1, 0},
+	{"zeros 100000", ZEROS, 100000, 0, 16, HASHSPLIT_MODE_TREE, "198e33e995a34ca1701bd035c351ede6c1de4ff0", 4, 3},
+	{"zeros 9 MiB", ZEROS, 9 << 20, 0, 16, HASHSPLIT_MODE_TREE, "503e2db375df1e5f2073b33a4a3535a1ad79cc9a", 288, 288},
+	{"random 1 MiB", RANDOM, 1 << 20, 1, 16, HASHSPLIT_MODE_TREE, "445b954085575806eb0f3d3163f9aeb67fa94006", 129, 3},
+	{"random 4 MiB", RANDOM, 4 << 20, 2, 16, HASHSPLIT_MODE_TREE, "e415a7e45c4aabfce15b86dd32f263fe55799010", 500, 13},
+	{"random 1 MiB, fanout 2", RANDOM, 1 << 20, 3, 2, HASHSPLIT_MODE_TREE, "83191a08e709e230985be4384a72fd953c7aa5e8", 117, 1},
+};
+
+static std::vector<unsigned char> makeContent(const TestCase &pCase) {
+	std::vector<unsigned char> lData(pCase.mSize);
+	if(pCase.mContent == TEXT) {
+		memcpy(lData.data(), "Kup backs up your files.\n", pCase.mSize);
+	} else if(pCase.mContent == RANDOM) {
+		uint32_t x = pCase.mSeed;
+		for(size_t i = 0; i < pCase.mSize; ++i) {
+			x ^= x << 13;
+			x ^= x >> 17;
+			x ^= x << 5;
+			lData[i] = static_cast<unsigned char>(x >> 24);
+		}
+	}
+	return lData;
+}
+
+// pPieceSize 0 writes everything at once, otherwise in pieces of that size.
+static bool runCase(const TestCase &pCase, const std::vector<unsigned char> &pData, size_t pPieceSize) {
+	CountingSplitter lSplitter(pCase.mFanout);
+	if(pPieceSize == 0) {
+		lSplitter.write(pData.data(), pData.size());
+	} else {
+		for(size_t i = 0; i < pData.size(); i += pPieceSize) {
+			lSplitter.write(pData.data() + i, pData.size() - i < pPieceSize ? pData.size() - i : pPieceSize);
+		}
+	}
+	git_oid lOid;
+	unsigned int lMode;
+	lSplitter.finish(&lOid, &lMode);
+	char lOidString[GIT_OID_HEXSZ + 1];
+	git_oid_tostr(lOidString, sizeof(lOidString), &lOid);
+
+	bool lOk = true;
+	if(strcmp(lOidString, pCase.mOid) != 0 || lMode != pCase.mMode) {
+		fprintf(stderr, "%s, pieces of %zu: got %o %s, expected %o %s\n", pCase.mName, pPieceSize,
+		        lMode, lOidString, pCase.mMode, pCase.mOid);
+		lOk = false;
+	}
+	if(lSplitter.mBlobs != pCase.mBlobs || lSplitter.mFullBlobs != pCase.mFullBlobs) {
+		fprintf(stderr, "%s, pieces of %zu: got %d chunks, %d of them full, expected %d and %d\n",
+		        pCase.mName, pPieceSize, lSplitter.mBlobs, lSplitter.mFullBlobs, pCase.mBlobs, pCase.mFullBlobs);
+		lOk = false;
+	}
+	if(!lSplitter.mOffsetsOk || lSplitter.mNextOffset != pData.size()) {
+		fprintf(stderr, "%s, pieces of %zu: chunk offsets do not cover the file\n", pCase.mName, pPieceSize);
+		lOk = false;
+	}
+	return lOk;
+}
+
+int main() {
+	// Odd piece sizes make chunks and the checksum window span several writes.
+	const size_t lPieceSizes[] = {0, 1000, 7, HASHSPLIT_BLOB_MAX + 1};
+	int lFailed = 0;
+	for(const TestCase &lCase: sCases) {
+		const std::vector<unsigned char> lData = makeContent(lCase);
+		for(size_t lPieceSize: lPieceSizes) {
+			if(!runCase(lCase, lData, lPieceSize)) {
+				++lFailed;
+			}
+		}
+	}
+	if(lFailed > 0) {
+		fprintf(stderr, "%d failed\n", lFailed);
+		return 1;
+	}
+	printf("all passed\n");
+	return 0;
+}
@@ -18,20 +18,87 @@
  *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
  ***************************************************************************/
 #include "bupvfs.h"
+#include "thumbnailcache.h"
+#include "treesizecache.h"
 
 #include <QCoreApplication>
+#include <QDataStream>
 #include <QDebug>
 #include <QFile>
+#include <QIODevice>
+#include <QScopedPointer>
 #include <QVarLengthArray>
 
 #include <KIO/SlaveBase>
+#include <kio_version.h>
 using namespace KIO;
 #include <KLocalizedString>
 #include <KProcess>
 
 #include <grp.h>
+#include <limits.h>
 #include <pwd.h>
 
+// Hex id of the git object with a node's content, in UDS entries and as
+// "bup-oid" metadata of special(). Equal ids mean equal content, for files
+// as well as for whole folders (including their metadata).
+static const uint UDS_BUP_OID = KIO::UDSEntry::UDS_EXTRA;
+
+// Entries are sent to the client this many at a time while listing.
+#define LIST_BATCH_SIZE 200
+// The slave lives on between operations, nodes of archived folders beyond
+// this are dropped, least recently used first.
+#define NODE_MEMORY_BUDGET (128 * 1024 * 1024)
+
+// special() commands, the QDataStream starts with the command as qint32.
+enum BupSpecialCommand {
+	BUP_SPECIAL_OID = 1, // followed by the QUrl of the node
+	BUP_SPECIAL_SIZE = 2, // followed by the QUrl, "bup-size" metadata is the size of all files inside
+	BUP_SPECIAL_THUMBNAIL = 3 // followed by the QUrl and the size as qint32, sends a PNG as data
+};
+
+// Lets image decoders read a file from the archive a piece at a time.
+class FileDevice: public QIODevice {
+public:
+	FileDevice(File *pFile)
+	   : mFile(pFile)
+	{}
+	virtual bool isSequential() const {
+		return false;
+	}
+	virtual qint64 size() const {
+		return static_cast<qint64>(mFile->size());
+	}
+	virtual bool seek(qint64 pPosition) {
+		if(pPosition < 0 || !QIODevice::seek(pPosition)) {
+			return false;
+		}
+		// the end can be seeked to, there is just nothing to read there.
+		return pPosition >= size() || 0 == mFile->seek(static_cast<quint64>(pPosition));
+	}
+
+protected:
+	virtual qint64 readData(char *pData, qint64 pMaxSize) {
+		if(pos() >= size()) {
+			return 0;
+		}
+		QByteArray lChunk;
+		const int lReadSize = static_cast<int>(qMin(pMaxSize, static_cast<qint64>(INT_MAX)));
+		if(0 != mFile->read(lChunk, lReadSize)) {
+			return -1;
+		}
+		memcpy(pData, lChunk.constData(), static_cast<size_t>(lChunk.size()));
+		return lChunk.size();
+	}
+	virtual qint64 writeData(const char *pData, qint64 pSize) {
+		Q_UNUSED(pData)
+		Q_UNUSED(pSize)
+		return -1;
+	}
+
+	File *mFile;
+};
+
 class BupSlave : public SlaveBase
 {
 public:
@@ -45,32 +112,82 @@ public:
 	virtual void seek(filesize_t pOffset);
 	virtual void stat(const QUrl &pUrl);
 	virtual void mimetype(const QUrl &pUrl);
+	virtual void special(const QByteArray &pData);
 
 private:
 	bool checkCorrectRepository(const QUrl &pUrl, QStringList &pPathInRepository);
 	QString getUserName(uid_t pUid);
 	QString getGroupName(gid_t pGid);
-	void createUDSEntry(Node *pNode, KIO::UDSEntry & pUDSEntry, int pDetails);
+	TarFile *createTarFile(const QStringList &pPathInRepository);
+	// pCalculateTreeSize also gives folders sizes that are not known yet.
+	void createUDSEntry(Node *pNode, KIO::UDSEntry & pUDSEntry, int pDetails, bool pCalculateTreeSize = false);
+	friend class ListingVisitor;
 
 	QHash<uid_t, QString> mUsercache;
 	QHash<gid_t, QString> mGroupcache;
 	Repository *mRepository;
+	TreeSizeCache *mTreeSizes;
 	File *mOpenFile;
 };
 
+// Turns streamed nodes into UDS entries and sends them in batches.
+class ListingVisitor: public NodeVisitor {
+public:
+	ListingVisitor(BupSlave *pSlave, int pDetails)
+	   : mSlave(pSlave), mDetails(pDetails)
+	{
+		mBatch.reserve(LIST_BATCH_SIZE);
+	}
+	virtual void visitNode(Node *pNode) {
+		UDSEntry lEntry;
+		mSlave->createUDSEntry(pNode, lEntry, mDetails);
+		mBatch.append(lEntry);
+		if(mBatch.count() >= LIST_BATCH_SIZE) {
+			flush();
+		}
+	}
+	void flush() {
+		if(!mBatch.isEmpty()) {
+			mSlave->listEntries(mBatch);
+			mBatch.clear();
+		}
+	}
+
+protected:
+	BupSlave *mSlave;
+	int mDetails;
+	UDSEntryList mBatch;
+};
+
 BupSlave::BupSlave(const QByteArray &pPoolSocket, const QByteArray &pAppSocket)
    : SlaveBase("bup", pPoolSocket, pAppSocket)
 {
 	mRepository = nullptr;
+	mTreeSizes = nullptr;
 	mOpenFile = nullptr;
 	#if LIBGIT2_VER_MAJOR == 0 && LIBGIT2_VER_MINOR >= 24
 	git_libgit2_init();
 	#else
 	git_threads_init();
 	#endif
+
+	#ifdef BUNDLED_LIBGIT2
+	// Trees are small and get revisited all the time while browsing, file chunks
+	// are mostly streamed through once. Keep trees, only keep blobs (like .bupm
+	// metadata) when they are read a second time.
+	git_libgit2_opts(GIT_OPT_SET_CACHE_MAX_SIZE, static_cast<ssize_t>(128 * 1024 * 1024));
+	git_libgit2_opts(GIT_OPT_SET_CACHE_OBJECT_LIMIT, GIT_OBJ_TREE, static_cast<size_t>(256 * 1024));
+	git_libgit2_opts(GIT_OPT_SET_CACHE_TYPE_BUDGET, GIT_OBJ_TREE, static_cast<ssize_t>(96 * 1024 * 1024));
+	git_libgit2_opts(GIT_OPT_SET_CACHE_OBJECT_LIMIT, GIT_OBJ_BLOB, static_cast<size_t>(64 * 1024));
+	git_libgit2_opts(GIT_OPT_SET_CACHE_ADMISSION, GIT_OBJ_BLOB, static_cast<int>(GIT_CACHE_ADMIT_REUSED));
+	git_libgit2_opts(GIT_OPT_SET_CACHE_TYPE_BUDGET, GIT_OBJ_BLOB, static_cast<ssize_t>(16 * 1024 * 1024));
+	#endif
+	traceRepositoryReads();
+	usePackIndexCache();
 }
 
 BupSlave::~BupSlave() {
+	delete mTreeSizes;
 	if(mRepository != nullptr) {
 		delete mRepository;
 	}
@@ -98,6 +215,11 @@ void BupSlave::get(const QUrl &pUrl) {
 	// symlink, it would just create a symlink on the destination kioslave using the
 	// target it already got from calling stat() on this one.
 	Node *lNode = mRepository->resolve(lPathInRepo, true);
+	QScopedPointer<TarFile> lTarFile;
+	if(lNode == nullptr) {
+		lTarFile.reset(createTarFile(lPathInRepo));
+		lNode = lTarFile.data();
+	}
 	if(lNode == nullptr) {
 		emit error(KIO::ERR_DOES_NOT_EXIST, lPathInRepo.join(QStringLiteral("/")));
 		return;
@@ -166,12 +288,22 @@ void BupSlave::listDir(const QUrl &pUrl) {
 	const QString sDetails = metaData(QStringLiteral("details"));
 	const int lDetails = sDetails.isEmpty() ? 2 : sDetails.toInt();
 
-	NodeMapIterator i(lDir->subNodes());
-	UDSEntry lEntry;
-	while(i.hasNext()) {
-		createUDSEntry(i.next().value(), lEntry, lDetails);
-		emit listEntry(lEntry);
+	ListingVisitor lVisitor(this, lDetails);
+	// Archived folders not listed before are streamed, so the first entries
+	// show up right away and a huge folder is never all in memory.
+	ArchivedDirectory *lArchivedDir = qobject_cast<ArchivedDirectory *>(lDir);
+	if(lArchivedDir != nullptr) {
+		if(!lArchivedDir->streamSubNodes(lVisitor)) {
+			emit error(KIO::ERR_COULD_NOT_READ, lPathInRepo.join(QStringLiteral("/")));
+			return;
+		}
+	} else {
+		NodeMapIterator i(lDir->subNodes());
+		while(i.hasNext()) {
+			lVisitor.visitNode(i.next().value());
+		}
 	}
+	lVisitor.flush();
 	emit finished();
 }
 
@@ -251,6 +383,11 @@ void BupSlave::stat(const QUrl &pUrl) {
 	}
 
 	Node *lNode = mRepository->resolve(lPathInRepo);
+	QScopedPointer<TarFile> lTarFile;
+	if(lNode == nullptr) {
+		lTarFile.reset(createTarFile(lPathInRepo));
+		lNode = lTarFile.data();
+	}
 	if(lNode == nullptr) {
 		emit error(KIO::ERR_DOES_NOT_EXIST, lPathInRepo.join(QStringLiteral("/")));
 		return;
@@ -259,8 +396,15 @@ void BupSlave::stat(const QUrl &pUrl) {
 	const QString sDetails = metaData(QStringLiteral("details"));
 	const int lDetails = sDetails.isEmpty() ? 2 : sDetails.toInt();
 
+	bool lCalculateTreeSize = false;
+	#if KIO_VERSION >= QT_VERSION_CHECK(5, 70, 0)
+	// asked for by directory size jobs, like the one of Dolphin's properties
+	// dialog. With the size in the entry they need no recursive listing.
+	lCalculateTreeSize = (lDetails & KIO::StatRecursiveSize) != 0;
+	#endif
+
 	UDSEntry lUDSEntry;
-	createUDSEntry(lNode, lUDSEntry, lDetails);
+	createUDSEntry(lNode, lUDSEntry, lDetails, lCalculateTreeSize);
 	emit statEntry(lUDSEntry);
 	emit finished();
 }
@@ -273,6 +417,11 @@ void BupSlave::mimetype(const QUrl &pUrl) {
 	}
 
 	Node *lNode = mRepository->resolve(lPathInRepo);
+	QScopedPointer<TarFile> lTarFile;
+	if(lNode == nullptr) {
+		lTarFile.reset(createTarFile(lPathInRepo));
+		lNode = lTarFile.data();
+	}
 	if(lNode == nullptr) {
 		emit error(KIO::ERR_DOES_NOT_EXIST, lPathInRepo.join(QStringLiteral("/")));
 		return;
@@ -282,6 +431,68 @@ void BupSlave::mimetype(const QUrl &pUrl) {
 	emit finished();
 }
 
+void BupSlave::special(const QByteArray &pData) {
+	QDataStream lStream(pData);
+	qint32 lCommand;
+	lStream >> lCommand;
+	if(lCommand != BUP_SPECIAL_OID && lCommand != BUP_SPECIAL_SIZE && lCommand != BUP_SPECIAL_THUMBNAIL) {
+		emit error(KIO::ERR_UNSUPPORTED_ACTION, QString::number(lCommand));
+		return;
+	}
+	QUrl lUrl;
+	lStream >> lUrl;
+	QStringList lPathInRepo;
+	if(!checkCorrectRepository(lUrl, lPathInRepo)) {
+		emit error(KIO::ERR_SLAVE_DEFINED, i18n("No bup repository found.\n%1", lUrl.toDisplayString()));
+		return;
+	}
+
+	Node *lNode = mRepository->resolve(lPathInRepo);
+	if(lNode == nullptr) {
+		emit error(KIO::ERR_DOES_NOT_EXIST, lPathInRepo.join(QStringLiteral("/")));
+		return;
+	}
+	if(lCommand == BUP_SPECIAL_THUMBNAIL) {
+		qint32 lSize;
+		lStream >> lSize;
+		File *lFile = qobject_cast<File *>(lNode);
+		QByteArray lPngData;
+		bool lFound = lFile != nullptr && lFile->oid() != nullptr && findThumbnail(lFile->oid(), lSize, lPngData);
+		if(!lFound && lFile != nullptr && lFile->oid() != nullptr && 0 == lFile->seek(0)) {
+			FileDevice lDevice(lFile);
+			lFound = lDevice.open(QIODevice::ReadOnly) && makeThumbnail(&lDevice, lFile->oid(), lSize, lPngData);
+		}
+		if(!lFound) {
+			emit error(KIO::ERR_COULD_NOT_READ, lPathInRepo.join(QStringLiteral("/")));
+			return;
+		}
+		emit mimeType(QStringLiteral("image/png"));
+		emit data(lPngData);
+		emit data(QByteArray());
+		emit finished();
+		return;
+	}
+	if(lCommand == BUP_SPECIAL_SIZE) {
+		quint64 lSize = 0;
+		File *lFile = qobject_cast<File *>(lNode);
+		ArchivedDirectory *lDirectory = qobject_cast<ArchivedDirectory *>(lNode);
+		if(lFile != nullptr) {
+			lSize = lFile->size();
+		} else if(lDirectory != nullptr && !mTreeSizes->treeSize(lDirectory->oid(), lSize)) {
+			emit error(KIO::ERR_COULD_NOT_READ, lPathInRepo.join(QStringLiteral("/")));
+			return;
+		}
+		setMetaData(QStringLiteral("bup-size"), QString::number(lSize));
+		emit finished();
+		return;
+	}
+	const git_oid *lOid = lNode->oid();
+	if(lOid != nullptr) {
+		setMetaData(QStringLiteral("bup-oid"), oidToString(lOid));
+	}
+	emit finished();
+}
+
 bool BupSlave::checkCorrectRepository(const QUrl &pUrl, QStringList &pPathInRepository) {
 	// make this slave accept most URLs.. even incorrect ones. (no slash (wrong),
 	// one slash (correct), two slashes (wrong), three slashes (correct))
@@ -299,9 +510,13 @@ bool BupSlave::checkCorrectRepository(const QUrl &pUrl, QStringList &pPathInRepo
 		if(lPath.startsWith(mRepository->objectName())) {
 			lPath.remove(0, mRepository->objectName().length());
 			pPathInRepository = lPath.split(QLatin1Char('/'), QString::SkipEmptyParts);
+			// no operation is running, only the open file may be in use.
+			mRepository->trimMemory(mOpenFile);
 			return true;
 		}
 		else {
+			delete mTreeSizes;
+			mTreeSizes = nullptr;
 			delete mRepository;
 			mRepository = nullptr;
 		}
@@ -317,13 +532,36 @@ bool BupSlave::checkCorrectRepository(const QUrl &pUrl, QStringList &pPathInRepo
 		    QFile::exists(lRepoPath + QStringLiteral("refs"))) ||
 		      (QFile::exists(lRepoPath + QStringLiteral(".git/objects")) &&
 		       QFile::exists(lRepoPath + QStringLiteral(".git/refs")))) {
+			delete mTreeSizes;
+			mTreeSizes = nullptr;
+			delete mRepository;
 			mRepository = new Repository(nullptr, lRepoPath);
-			return mRepository->isValid();
+			if(!mRepository->isValid()) {
+				return false;
+			}
+			mRepository->setMemoryBudget(NODE_MEMORY_BUDGET);
+			mTreeSizes = new TreeSizeCache(mRepository->repository());
+			return true;
 		}
 	}
 	return false;
 }
 
+// "<folder>.tar" next to a backed up folder, when no real file has that name,
+// is the folder streamed as a tar archive. Caller owns the returned file.
+TarFile *BupSlave::createTarFile(const QStringList &pPathInRepository) {
+	if(pPathInRepository.isEmpty() || !pPathInRepository.last().endsWith(QStringLiteral(".tar"))) {
+		return nullptr;
+	}
+	QStringList lDirectoryPath = pPathInRepository;
+	lDirectoryPath.last().chop(4);
+	ArchivedDirectory *lDirectory = qobject_cast<ArchivedDirectory *>(mRepository->resolve(lDirectoryPath, true));
+	if(lDirectory == nullptr) {
+		return nullptr;
+	}
+	return new TarFile(lDirectory);
+}
+
 QString BupSlave::getUserName(uid_t pUid) {
 	if(!mUsercache.contains(pUid)) {
 		struct passwd *lUserInfo = getpwuid(pUid);
@@ -350,7 +588,7 @@ QString BupSlave::getGroupName(gid_t pGid) {
 	return mGroupcache.value(pGid);
 }
 
-void BupSlave::createUDSEntry(Node *pNode, UDSEntry &pUDSEntry, int pDetails) {
+void BupSlave::createUDSEntry(Node *pNode, UDSEntry &pUDSEntry, int pDetails, bool pCalculateTreeSize) {
 	pUDSEntry.clear();
 	pUDSEntry.insert(KIO::UDSEntry::UDS_NAME, pNode->objectName());
 	if(!pNode->mSymlinkTarget.isEmpty()) {
@@ -376,6 +614,20 @@ void BupSlave::createUDSEntry(Node *pNode, UDSEntry &pUDSEntry, int pDetails) {
 		pUDSEntry.insert(KIO::UDSEntry::UDS_MODIFICATION_TIME, pNode->mMtime);
         pUDSEntry.insert(KIO::UDSEntry::UDS_USER, getUserName(static_cast<uint>(pNode->mUid)));
         pUDSEntry.insert(KIO::UDSEntry::UDS_GROUP, getGroupName(static_cast<uint>(pNode->mGid)));
+		const git_oid *lOid = pNode->oid();
+		if(lOid != nullptr) {
+			pUDSEntry.insert(UDS_BUP_OID, oidToString(lOid));
+		}
+		#if KIO_VERSION >= QT_VERSION_CHECK(5, 70, 0)
+		// Calculating means reading every tree below the folder the first time,
+		// too much for each entry of a listing. Those only get known sizes.
+		quint64 lTreeSize;
+		if(qobject_cast<ArchivedDirectory *>(pNode) != nullptr && mTreeSizes != nullptr &&
+		      (pCalculateTreeSize ? mTreeSizes->treeSize(lOid, lTreeSize) :
+		                            mTreeSizes->knownTreeSize(lOid, lTreeSize))) {
+			pUDSEntry.insert(KIO::UDSEntry::UDS_RECURSIVE_SIZE, static_cast<qint64>(lTreeSize));
+		}
+		#endif
 	}
 }
 
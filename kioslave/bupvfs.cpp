@@ -18,23 +18,36 @@
  *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
  ***************************************************************************/
 #include "bupvfs.h"
+#include "commitcache.h"
 #include "kupkio_debug.h"
+#include "listingcache.h"
+#include "treediff.h"
+#include "kuptrace.h"
 
 #include <git2/blob.h>
 #include <git2/branch.h>
 
+#include <string.h>
 #include <sys/stat.h>
 
 #include <QDebug>
+#include <QFile>
 #include <QMimeDatabase>
+#include <QtAlgorithms>
+#include <QVector>
 
-git_revwalk *Node::mRevisionWalker = nullptr;
-git_repository *Node::mRepository = nullptr;
+#define STREAMED_LISTING_CACHE_LIMIT 10000
+// Rough heap use of one node with its name, metadata and map entry.
+#define NODE_MEMORY_ESTIMATE 512
 
 Node::Node(QObject *pParent, const QString &pName, quint64 pMode)
    :QObject(pParent), Metadata(pMode)
 {
 	setObjectName(pName);
+	Node *lParentNode = qobject_cast<Node *>(pParent);
+	mRepository = lParentNode != nullptr ? lParentNode->mRepository : nullptr;
+	mListingCache = lParentNode != nullptr ? lParentNode->mListingCache : nullptr;
+	mNodeBudget = lParentNode != nullptr ? lParentNode->mNodeBudget : nullptr;
 }
 
 int Node::readMetadata(VintStream &pMetadataStream) {
@@ -63,7 +76,7 @@ Node *Node::resolve(const QStringList &pPathList, bool pFollowLinks) {
 			if(lDir == nullptr) {
 				return nullptr;
 			}
-			lNode = lDir->subNodes().value(lPathComponent, nullptr);
+			lNode = lDir->subNode(lPathComponent);
 		}
 		if(lNode == nullptr) {
 			return nullptr;
@@ -124,6 +137,83 @@ NodeMap Directory::subNodes() {
 	return *mSubNodes;
 }
 
+void Directory::releaseSubNodes() {
+	if(mSubNodes == nullptr) {
+		return;
+	}
+	NodeMap *lSubNodes = mSubNodes;
+	mSubNodes = nullptr;
+	qDeleteAll(*lSubNodes);
+	delete lSubNodes;
+}
+
+NodeBudget::NodeBudget(quint64 pBudget)
+   : mBudget(pBudget), mUsed(0), mClock(0)
+{
+}
+
+void NodeBudget::touch(ArchivedDirectory *pDirectory, int pNodeCount) {
+	Usage &lUsage = mUsage[pDirectory];
+	const quint64 lSize = static_cast<quint64>(pNodeCount) * NODE_MEMORY_ESTIMATE;
+	mUsed = mUsed - lUsage.mSize + lSize;
+	lUsage.mSize = lSize;
+	lUsage.mLastUse = ++mClock;
+}
+
+void NodeBudget::forget(ArchivedDirectory *pDirectory) {
+	QHash<ArchivedDirectory *, Usage>::iterator lIter = mUsage.find(pDirectory);
+	if(lIter != mUsage.end()) {
+		mUsed -= lIter.value().mSize;
+		mUsage.erase(lIter);
+	}
+}
+
+void NodeBudget::addDependent(Directory *pDirectory) {
+	mDependents.append(pDirectory);
+}
+
+void NodeBudget::removeDependent(Directory *pDirectory) {
+	mDependents.removeOne(pDirectory);
+}
+
+void NodeBudget::trim(const Node *pKeep) {
+	if(mUsed > mBudget) {
+		TraceSpan lSpan("NodeBudget::trim", "kio");
+		QVector<QPair<quint64, ArchivedDirectory *> > lByAge;
+		lByAge.reserve(mUsage.count());
+		QHashIterator<ArchivedDirectory *, Usage> i(mUsage);
+		while(i.hasNext()) {
+			i.next();
+			lByAge.append(qMakePair(i.value().mLastUse, i.key()));
+		}
+		qSort(lByAge);
+		// go well below the budget, so the next operation does not start over.
+		const quint64 lTarget = mBudget / 4 * 3;
+		bool lEvicted = false;
+		for(int j = 0; j < lByAge.count() && mUsed > lTarget; ++j) {
+			ArchivedDirectory *lDirectory = lByAge.at(j).second;
+			if(!mUsage.contains(lDirectory)) {
+				continue; // already deleted, with a folder above it
+			}
+			const QObject *lObject = pKeep;
+			while(lObject != nullptr && lObject != lDirectory) {
+				lObject = lObject->parent();
+			}
+			if(lObject != nullptr) {
+				continue;
+			}
+			lDirectory->releaseSubNodes();
+			lEvicted = true;
+		}
+		if(lEvicted) {
+			foreach(Directory *lDependent, mDependents) {
+				lDependent->releaseSubNodes();
+			}
+		}
+	}
+	traceCounter("kio_bup node memory", "kio", static_cast<qint64>(mUsed));
+}
+
 int File::readMetadata(VintStream &pMetadataStream) {
 	int lRetVal = Node::readMetadata(pMetadataStream);
 	QByteArray lContent, lNextData;
@@ -203,6 +293,7 @@ ChunkFile::~ChunkFile() {
 }
 
 int ChunkFile::seek(quint64 pOffset) {
+	TraceSpan lSpan("ChunkFile::seek", "kio");
 	if(pOffset >= size()) {
 		return KIO::ERR_COULD_NOT_SEEK;
 	}
@@ -271,6 +362,7 @@ int ChunkFile::seek(quint64 pOffset) {
 }
 
 int ChunkFile::read(QByteArray &pChunk, int pReadSize) {
+	TraceSpan lSpan("ChunkFile::read", "kio");
 	if(mOffset >= size()) {
 		return KIO::ERR_NO_CONTENT;
 	}
@@ -352,67 +444,732 @@ ChunkFile::TreePosition::~TreePosition() {
 	git_tree_free(mTree);
 }
 
-ArchivedDirectory::ArchivedDirectory(Node *pParent, const git_oid *pOid, const QString &pName, quint64 pMode)
+ArchivedDirectory::ArchivedDirectory(Node *pParent, const git_oid *pOid, const QString &pName, quint64 pMode,
+                                     bool pReadMetadata)
    : Directory(pParent, pName, pMode)
 {
 	mOid = *pOid;
+	mMetadataBlob = nullptr;
 	mMetadataStream = nullptr;
 	mTree = nullptr;
+	if(pReadMetadata) {
+		// the tree and metadata are opened again once the folder is used, an
+		// open handle would keep them in memory for every folder seen.
+		openTree(true);
+		closeTree();
+	}
+}
+
+ArchivedDirectory::~ArchivedDirectory() {
+	if(mNodeBudget != nullptr) {
+		mNodeBudget->forget(this);
+	}
+	if(mMetadataBlob != nullptr) {
+		git_blob_free(mMetadataBlob);
+	}
+	if(mTree != nullptr) {
+		git_tree_free(mTree);
+	}
+}
+
+void ArchivedDirectory::openTree(bool pReadMetadata) {
 	if(0 != git_tree_lookup(&mTree, mRepository, &mOid)) {
+		mTree = nullptr;
 		return;
 	}
 	const git_tree_entry *lTreeEntry = git_tree_entry_byname(mTree, ".bupm");
 	if(lTreeEntry != nullptr && 0 == git_blob_lookup(&mMetadataBlob, mRepository, git_tree_entry_id(lTreeEntry))) {
 		mMetadataStream = new VintStream(git_blob_rawcontent(mMetadataBlob), git_blob_rawsize(mMetadataBlob), this);
-		readMetadata(*mMetadataStream); // the first entry is metadata for the directory itself
+		// the first entry is metadata for the directory itself
+		if(pReadMetadata) {
+			readMetadata(*mMetadataStream);
+		} else {
+			Metadata lMetadata;
+			::readMetadata(*mMetadataStream, lMetadata);
+		}
+	}
+}
+
+// Entries in a .bupm blob come in tree order, after the one for the folder
+// itself. Folders have their metadata in their own .bupm instead, but files
+// split into chunks are trees too.
+static bool hasMetadataEntry(const git_tree_entry *pTreeEntry) {
+	const char *lName = git_tree_entry_name(pTreeEntry);
+	if(0 == strcmp(lName, ".bupm")) {
+		return false;
+	}
+	if(!S_ISDIR(git_tree_entry_filemode(pTreeEntry))) {
+		return true;
+	}
+	const size_t lLength = strlen(lName);
+	return lLength >= 4 && 0 == strcmp(lName + lLength - 4, ".bup");
+}
+
+Node *ArchivedDirectory::subNode(const QString &pName) {
+	if(mSubNodes != nullptr) {
+		touchBudget();
+		return mSubNodes->value(pName, nullptr);
+	}
+	Node *lNode = mResolvedNodes.value(pName, nullptr);
+	if(lNode != nullptr) {
+		touchBudget();
+		return lNode;
+	}
+	TraceSpan lSpan("ArchivedDirectory::subNode", "kio");
+	ListingEntryList lEntries;
+	if(mListingCache != nullptr && mListingCache->lookup(&mOid, LISTING_FULL, lEntries)) {
+		foreach(const ListingEntry &lEntry, lEntries) {
+			if(lEntry.mName == pName) {
+				lNode = nodeFromListing(lEntry);
+				break;
+			}
+		}
+	} else {
+		lNode = nodeFromTree(pName);
+	}
+	if(lNode != nullptr) {
+		mResolvedNodes.insert(pName, lNode);
+		touchBudget();
+	}
+	return lNode;
+}
+
+void ArchivedDirectory::releaseSubNodes() {
+	Directory::releaseSubNodes();
+	qDeleteAll(mResolvedNodes);
+	mResolvedNodes.clear();
+	closeTree();
+	if(mNodeBudget != nullptr) {
+		mNodeBudget->forget(this);
+	}
+}
+
+void ArchivedDirectory::touchBudget() {
+	if(mNodeBudget != nullptr) {
+		const int lNodeCount = mSubNodes != nullptr ? mSubNodes->count() : mResolvedNodes.count();
+		mNodeBudget->touch(this, lNodeCount);
+	}
+}
+
+Node *ArchivedDirectory::nodeFromTree(const QString &pName) {
+	// only keep the tree open for as long as the lookup takes if it was closed,
+	// open handles on every folder along resolved paths add up.
+	const bool lWasOpen = mTree != nullptr;
+	if(!lWasOpen) {
+		openTree(false);
+	}
+	if(mTree == nullptr) {
+		return nullptr;
+	}
+	Node *lNode = nodeFromOpenTree(pName);
+	if(!lWasOpen) {
+		closeTree();
+	}
+	return lNode;
+}
+
+Node *ArchivedDirectory::nodeFromOpenTree(const QString &pName) {
+	// try the names bup could have given it, chunked file first.
+	const QByteArray lName = pName.toUtf8();
+	const git_tree_entry *lTreeEntry = git_tree_entry_byname(mTree, QByteArray(lName + ".bup").constData());
+	if(lTreeEntry == nullptr) {
+		if(lName.endsWith(".bup") || lName.left(lName.length() - 1).endsWith(".bup")) {
+			lTreeEntry = git_tree_entry_byname(mTree, QByteArray(lName + ".bupl").constData());
+		} else {
+			lTreeEntry = git_tree_entry_byname(mTree, lName.constData());
+		}
+	}
+	if(lTreeEntry == nullptr) {
+		return nullptr;
 	}
+	uint lMode;
+	const git_oid *lOid;
+	QString lEntryName;
+	bool lChunked;
+	getEntryAttributes(lTreeEntry, lMode, lChunked, lOid, lEntryName);
+	if(lEntryName != pName) {
+		return nullptr;
+	}
+	if(S_ISDIR(lMode)) {
+		return new ArchivedDirectory(this, lOid, pName, lMode);
+	}
+
+	Node *lNode;
+	if(S_ISLNK(lMode)) {
+		lNode = new Symlink(this, lOid, pName, lMode);
+	} else if(lChunked) {
+		lNode = new ChunkFile(this, lOid, pName, lMode);
+	} else {
+		lNode = new BlobFile(this, lOid, pName, lMode);
+	}
+	if(mMetadataBlob != nullptr) {
+		// skip to the entry of this file, counting the one for the folder.
+		int lSkipCount = 1;
+		for(uint i = 0; i < git_tree_entrycount(mTree); ++i) {
+			const git_tree_entry *lEntry = git_tree_entry_byindex(mTree, i);
+			if(lEntry == lTreeEntry) {
+				break;
+			}
+			if(hasMetadataEntry(lEntry)) {
+				++lSkipCount;
+			}
+		}
+		VintStream lMetadataStream(git_blob_rawcontent(mMetadataBlob), git_blob_rawsize(mMetadataBlob), nullptr);
+		if(0 == skipMetadata(lMetadataStream, lSkipCount)) {
+			lNode->readMetadata(lMetadataStream);
+		}
+	}
+	return lNode;
+}
+
+Node *ArchivedDirectory::nodeFromListing(const ListingEntry &pEntry) {
+	Node *lNode;
+	if(S_ISDIR(pEntry.mTreeMode)) {
+		lNode = new ArchivedDirectory(this, &pEntry.mOid, pEntry.mName, pEntry.mTreeMode, false);
+	} else if(S_ISLNK(pEntry.mTreeMode)) {
+		lNode = new Symlink(this, &pEntry.mOid, pEntry.mName, pEntry.mTreeMode, false);
+	} else if(pEntry.mChunked) {
+		lNode = new ChunkFile(this, &pEntry.mOid, pEntry.mName, pEntry.mTreeMode);
+	} else {
+		lNode = new BlobFile(this, &pEntry.mOid, pEntry.mName, pEntry.mTreeMode);
+	}
+	static_cast<Metadata &>(*lNode) = pEntry.mMetadata;
+	lNode->mMimeType = pEntry.mMimeType;
+	File *lFile = qobject_cast<File *>(lNode);
+	if(lFile != nullptr) {
+		lFile->setCachedSize(pEntry.mSize);
+	}
+	return lNode;
+}
+
+Node *ArchivedDirectory::nodeFromTreeEntry(const git_tree_entry *pTreeEntry, VintStream *pMetadataStream,
+                                           ListingEntry &pEntry) {
+	uint lMode;
+	const git_oid *lOid;
+	QString lName;
+	bool lChunked;
+	getEntryAttributes(pTreeEntry, lMode, lChunked, lOid, lName);
+	if(lName == QStringLiteral(".bupm")) {
+		return nullptr;
+	}
+
+	Node *lSubNode = nullptr;
+	if(S_ISDIR(lMode)) {
+		lSubNode = new ArchivedDirectory(this, lOid, lName, lMode);
+	} else if(S_ISLNK(lMode)) {
+		lSubNode = new Symlink(this, lOid, lName, lMode);
+	} else if(lChunked) {
+		lSubNode = new ChunkFile(this, lOid, lName, lMode);
+	} else {
+		lSubNode = new BlobFile(this, lOid, lName, lMode);
+	}
+	bool lHasMetadata = S_ISDIR(lMode);
+	if(!S_ISDIR(lMode) && pMetadataStream != nullptr) {
+		lHasMetadata = 0 == lSubNode->readMetadata(*pMetadataStream);
+	}
+
+	pEntry.mName = lName;
+	pEntry.mTreeMode = lMode;
+	pEntry.mOid = *lOid;
+	pEntry.mChunked = lChunked;
+	pEntry.mHasMetadata = lHasMetadata;
+	pEntry.mMetadata = *lSubNode;
+	pEntry.mMimeType = lSubNode->mMimeType;
+	File *lFile = qobject_cast<File *>(lSubNode);
+	pEntry.mSize = lFile != nullptr ? lFile->size() : 0;
+	return lSubNode;
 }
 
 void ArchivedDirectory::generateSubNodes() {
+	TraceSpan lSpan("ArchivedDirectory::generateSubNodes", "kio");
+	ListingEntryList lEntries;
+	if(mListingCache != nullptr && mListingCache->lookup(&mOid, LISTING_FULL, lEntries)) {
+		foreach(const ListingEntry &lEntry, lEntries) {
+			mSubNodes->insert(lEntry.mName, nodeFromListing(lEntry));
+		}
+	} else {
+		if(mTree == nullptr) {
+			openTree(false);
+		}
+		if(mTree == nullptr) {
+			return;
+		}
+		uint lEntryCount = git_tree_entrycount(mTree);
+		lEntries.reserve(static_cast<int>(lEntryCount));
+		for(uint i = 0; i < lEntryCount; ++i) {
+			ListingEntry lEntry;
+			Node *lSubNode = nodeFromTreeEntry(git_tree_entry_byindex(mTree, i), mMetadataStream, lEntry);
+			if(lSubNode != nullptr) {
+				mSubNodes->insert(lEntry.mName, lSubNode);
+				lEntries.append(lEntry);
+			}
+		}
+		if(mListingCache != nullptr) {
+			mListingCache->store(&mOid, LISTING_FULL, lEntries);
+		}
+	}
+	closeTree();
+	NodeMapIterator i(mResolvedNodes);
+	while(i.hasNext()) {
+		i.next();
+		Node *lListedNode = mSubNodes->value(i.key(), nullptr);
+		if(lListedNode != nullptr) {
+			delete lListedNode;
+			mSubNodes->insert(i.key(), i.value());
+		}
+	}
+	mResolvedNodes.clear();
+	touchBudget();
+}
+
+bool ArchivedDirectory::streamSubNodes(NodeVisitor &pVisitor) {
+	TraceSpan lSpan("ArchivedDirectory::streamSubNodes", "kio");
+	if(mSubNodes != nullptr) {
+		foreach(Node *lSubNode, *mSubNodes) {
+			pVisitor.visitNode(lSubNode);
+		}
+		return true;
+	}
+	ListingEntryList lEntries;
+	if(mListingCache != nullptr && mListingCache->lookup(&mOid, LISTING_FULL, lEntries)) {
+		foreach(const ListingEntry &lEntry, lEntries) {
+			Node *lSubNode = nodeFromListing(lEntry);
+			pVisitor.visitNode(lSubNode);
+			delete lSubNode;
+		}
+		return true;
+	}
 	if(mTree == nullptr) {
-		return;
+		openTree(false);
+	}
+	if(mTree == nullptr) {
+		return false;
+	}
+	// A stream of its own, mMetadataStream must stay where generateSubNodes()
+	// expects it.
+	VintStream *lMetadataStream = nullptr;
+	if(mMetadataBlob != nullptr) {
+		lMetadataStream = new VintStream(git_blob_rawcontent(mMetadataBlob), git_blob_rawsize(mMetadataBlob), this);
+		if(0 != skipMetadata(*lMetadataStream, 1)) {
+			delete lMetadataStream;
+			lMetadataStream = nullptr;
+		}
+	}
+	// Only small folders go to the listing cache, the point here is to not
+	// hold all of a big folder at once.
+	const uint lEntryCount = git_tree_entrycount(mTree);
+	const bool lStoreListing = mListingCache != nullptr && lEntryCount <= STREAMED_LISTING_CACHE_LIMIT;
+	if(lStoreListing) {
+		lEntries.reserve(static_cast<int>(lEntryCount));
 	}
-	uint lEntryCount = git_tree_entrycount(mTree);
 	for(uint i = 0; i < lEntryCount; ++i) {
+		ListingEntry lEntry;
+		Node *lSubNode = nodeFromTreeEntry(git_tree_entry_byindex(mTree, i), lMetadataStream, lEntry);
+		if(lSubNode == nullptr) {
+			continue;
+		}
+		pVisitor.visitNode(lSubNode);
+		delete lSubNode;
+		if(lStoreListing) {
+			lEntries.append(lEntry);
+		}
+	}
+	delete lMetadataStream;
+	if(lStoreListing) {
+		mListingCache->store(&mOid, LISTING_FULL, lEntries);
+	}
+	closeTree();
+	return true;
+}
+
+void ArchivedDirectory::closeTree() {
+	if(mMetadataStream != nullptr) {
+		delete mMetadataStream;
+		mMetadataStream = nullptr;
+	}
+	if(mMetadataBlob != nullptr) {
+		git_blob_free(mMetadataBlob);
+		mMetadataBlob = nullptr;
+	}
+	if(mTree != nullptr) {
+		git_tree_free(mTree);
+		mTree = nullptr;
+	}
+}
+
+static quint64 tarPaddedSize(quint64 pSize) {
+	return (pSize + 511) & ~static_cast<quint64>(511);
+}
+
+static bool fitsTarField(quint64 pValue, int pWidth) {
+	return pValue < (Q_UINT64_C(1) << (3 * (pWidth - 1)));
+}
+
+static void writeTarField(char *pField, int pWidth, quint64 pValue) {
+	if(!fitsTarField(pValue, pWidth)) {
+		pValue = 0; // the real value is in the pax header
+	}
+	pField[pWidth - 1] = '\0';
+	for(int i = pWidth - 2; i >= 0; --i) {
+		pField[i] = static_cast<char>('0' + (pValue & 7));
+		pValue >>= 3;
+	}
+}
+
+static void addPaxRecord(QByteArray &pRecords, const char *pKey, const QByteArray &pValue) {
+	// the length at the start of the record counts its own digits too.
+	const int lLength = static_cast<int>(strlen(pKey)) + pValue.size() + 3;
+	int lTotal = lLength + QByteArray::number(lLength).size();
+	if(QByteArray::number(lTotal).size() != QByteArray::number(lLength).size()) {
+		++lTotal;
+	}
+	pRecords += QByteArray::number(lTotal) + ' ' + pKey + '=' + pValue + '\n';
+}
+
+static QByteArray ustarHeader(const QByteArray &pPath, const Metadata *pNode, char pType, quint64 pSize,
+                              const QByteArray &pLinkTarget) {
+	QByteArray lHeader(512, '\0');
+	char *lData = lHeader.data();
+	memcpy(lData, pPath.constData(), static_cast<size_t>(qMin(pPath.size(), 100)));
+	writeTarField(lData + 100, 8, static_cast<quint64>(pNode->mMode & 07777));
+	writeTarField(lData + 108, 8, static_cast<quint64>(pNode->mUid));
+	writeTarField(lData + 116, 8, static_cast<quint64>(pNode->mGid));
+	writeTarField(lData + 124, 12, pSize);
+	writeTarField(lData + 136, 12, static_cast<quint64>(qMax(pNode->mMtime, Q_INT64_C(0))));
+	lData[156] = pType;
+	memcpy(lData + 157, pLinkTarget.constData(), static_cast<size_t>(qMin(pLinkTarget.size(), 100)));
+	memcpy(lData + 257, "ustar", 6);
+	memcpy(lData + 263, "00", 2);
+
+	memset(lData + 148, ' ', 8);
+	quint64 lChecksum = 0;
+	for(int i = 0; i < 512; ++i) {
+		lChecksum += static_cast<uchar>(lData[i]);
+	}
+	writeTarField(lData + 148, 7, lChecksum);
+	return lHeader;
+}
+
+// Headers for one archive member, with a pax extended header in front when
+// some value does not fit into the plain ustar fields.
+static QByteArray tarHeader(const QByteArray &pPath, const Metadata *pNode, char pType, quint64 pSize,
+                            const QByteArray &pLinkTarget = QByteArray()) {
+	QByteArray lRecords;
+	if(pPath.size() > 100) {
+		addPaxRecord(lRecords, "path", pPath);
+	}
+	if(pLinkTarget.size() > 100) {
+		addPaxRecord(lRecords, "linkpath", pLinkTarget);
+	}
+	if(!fitsTarField(pSize, 12)) {
+		addPaxRecord(lRecords, "size", QByteArray::number(pSize));
+	}
+	if(!fitsTarField(static_cast<quint64>(pNode->mUid), 8)) {
+		addPaxRecord(lRecords, "uid", QByteArray::number(pNode->mUid));
+	}
+	if(!fitsTarField(static_cast<quint64>(pNode->mGid), 8)) {
+		addPaxRecord(lRecords, "gid", QByteArray::number(pNode->mGid));
+	}
+	if(pNode->mMtime < 0 || !fitsTarField(static_cast<quint64>(pNode->mMtime), 12)) {
+		addPaxRecord(lRecords, "mtime", QByteArray::number(pNode->mMtime));
+	}
+	if(lRecords.isEmpty()) {
+		return ustarHeader(pPath, pNode, pType, pSize, pLinkTarget);
+	}
+	QByteArray lResult = ustarHeader("././@PaxHeader", pNode, 'x', static_cast<quint64>(lRecords.size()), QByteArray());
+	lResult += lRecords;
+	lResult += QByteArray(static_cast<int>(tarPaddedSize(static_cast<quint64>(lRecords.size()))) - lRecords.size(), '\0');
+	lResult += ustarHeader(pPath, pNode, pType, pSize, pLinkTarget);
+	return lResult;
+}
+
+// Walks the trees and .bupm blobs below a backed up folder, giving the tar
+// archive's members in order. No nodes are made, so files are not opened for
+// their MIME type and nothing stays in memory. The archive's size and its
+// content both come from here, so the two always agree.
+class TarWalker {
+public:
+	struct Member {
+		QByteArray mHeader; // with a pax header in front, if one is needed
+		quint64 mSize; // of the content, only regular files have any
+		git_oid mOid;
+		bool mChunked;
+		QString mName;
+		quint64 mMode;
+	};
+
+	TarWalker(git_repository *pRepository, ArchivedDirectory *pDirectory);
+	~TarWalker();
+	// Returns false when there are no more members.
+	bool next(Member &pMember);
+
+protected:
+	struct Level {
+		git_tree *mTree;
+		git_blob *mMetadataBlob;
+		VintStream *mMetadataStream;
+		QByteArray mPath;
+		size_t mIndex;
+	};
+	// pOwnMetadata gets the folder's own metadata from the first .bupm entry.
+	void pushTree(const git_oid *pTreeOid, const QByteArray &pPath, Metadata &pOwnMetadata);
+	void popTree();
+
+	git_repository *mRepository;
+	git_odb *mObjectDatabase;
+	ArchivedDirectory *mDirectory;
+	QVector<Level> mLevels;
+	bool mStarted;
+};
+
+TarWalker::TarWalker(git_repository *pRepository, ArchivedDirectory *pDirectory) {
+	mRepository = pRepository;
+	mDirectory = pDirectory;
+	mStarted = false;
+	if(0 != git_repository_odb(&mObjectDatabase, mRepository)) {
+		mObjectDatabase = nullptr;
+	}
+}
+
+TarWalker::~TarWalker() {
+	while(!mLevels.isEmpty()) {
+		popTree();
+	}
+	if(mObjectDatabase != nullptr) {
+		git_odb_free(mObjectDatabase);
+	}
+}
+
+void TarWalker::pushTree(const git_oid *pTreeOid, const QByteArray &pPath, Metadata &pOwnMetadata) {
+	Level lLevel;
+	lLevel.mMetadataBlob = nullptr;
+	lLevel.mMetadataStream = nullptr;
+	lLevel.mPath = pPath;
+	lLevel.mIndex = 0;
+	// a folder that can not be read is archived empty.
+	if(0 != git_tree_lookup(&lLevel.mTree, mRepository, pTreeOid)) {
+		lLevel.mTree = nullptr;
+	} else {
+		const git_tree_entry *lTreeEntry = git_tree_entry_byname(lLevel.mTree, ".bupm");
+		if(lTreeEntry != nullptr &&
+		   0 == git_blob_lookup(&lLevel.mMetadataBlob, mRepository, git_tree_entry_id(lTreeEntry))) {
+			lLevel.mMetadataStream = new VintStream(git_blob_rawcontent(lLevel.mMetadataBlob),
+			                                        git_blob_rawsize(lLevel.mMetadataBlob), nullptr);
+			// the first entry is metadata for the folder itself
+			::readMetadata(*lLevel.mMetadataStream, pOwnMetadata);
+		} else {
+			lLevel.mMetadataBlob = nullptr;
+		}
+	}
+	mLevels.append(lLevel);
+}
+
+void TarWalker::popTree() {
+	Level &lLevel = mLevels.last();
+	delete lLevel.mMetadataStream;
+	if(lLevel.mMetadataBlob != nullptr) {
+		git_blob_free(lLevel.mMetadataBlob);
+	}
+	if(lLevel.mTree != nullptr) {
+		git_tree_free(lLevel.mTree);
+	}
+	mLevels.removeLast();
+}
+
+bool TarWalker::next(Member &pMember) {
+	pMember.mSize = 0;
+	pMember.mChunked = false;
+	if(!mStarted) {
+		mStarted = true;
+		// the folder's own metadata is already in its node.
+		Metadata lIgnored(static_cast<quint64>(mDirectory->mMode));
+		const QByteArray lPath = QFile::encodeName(mDirectory->objectName()) + '/';
+		pushTree(mDirectory->oid(), lPath, lIgnored);
+		pMember.mHeader = tarHeader(lPath, mDirectory, '5', 0);
+		pMember.mMode = static_cast<quint64>(mDirectory->mMode);
+		return true;
+	}
+	while(!mLevels.isEmpty()) {
+		Level &lLevel = mLevels.last();
+		if(lLevel.mTree == nullptr || lLevel.mIndex >= git_tree_entrycount(lLevel.mTree)) {
+			popTree();
+			continue;
+		}
 		uint lMode;
 		const git_oid *lOid;
 		QString lName;
-		bool lChunked;
-		const git_tree_entry *lTreeEntry = git_tree_entry_byindex(mTree, i);
-		getEntryAttributes(lTreeEntry, lMode, lChunked, lOid, lName);
+		getEntryAttributes(git_tree_entry_byindex(lLevel.mTree, lLevel.mIndex++), lMode, pMember.mChunked,
+		                   lOid, lName);
 		if(lName == QStringLiteral(".bupm")) {
 			continue;
 		}
-
-		Node *lSubNode = nullptr;
+		const QByteArray lPath = lLevel.mPath + QFile::encodeName(lName);
 		if(S_ISDIR(lMode)) {
-			lSubNode = new ArchivedDirectory(this, lOid, lName, lMode);
-		} else if(S_ISLNK(lMode)) {
-			lSubNode = new Symlink(this, lOid, lName, lMode);
-		} else if(lChunked) {
-			lSubNode = new ChunkFile(this, lOid, lName, lMode);
-		} else {
-			lSubNode = new BlobFile(this, lOid, lName, lMode);
+			Metadata lOwnMetadata(lMode);
+			pushTree(lOid, lPath + '/', lOwnMetadata); // invalidates lLevel
+			pMember.mHeader = tarHeader(lPath + '/', &lOwnMetadata, '5', 0);
+			pMember.mMode = static_cast<quint64>(lOwnMetadata.mMode);
+			return true;
+		}
+		Metadata lMetadata(lMode);
+		if(S_ISLNK(lMode)) {
+			git_blob *lBlob;
+			if(0 == git_blob_lookup(&lBlob, mRepository, lOid)) {
+				lMetadata.mSymlinkTarget = QString::fromUtf8(static_cast<const char *>(git_blob_rawcontent(lBlob)),
+				                                             static_cast<int>(git_blob_rawsize(lBlob)));
+				git_blob_free(lBlob);
+			}
+		}
+		if(lLevel.mMetadataStream != nullptr) {
+			::readMetadata(*lLevel.mMetadataStream, lMetadata);
 		}
-		mSubNodes->insert(lName, lSubNode);
-		if(!S_ISDIR(lMode) && mMetadataStream != nullptr) {
-			lSubNode->readMetadata(*mMetadataStream);
+		pMember.mOid = *lOid;
+		pMember.mName = lName;
+		pMember.mMode = static_cast<quint64>(lMetadata.mMode);
+		if(S_ISLNK(lMetadata.mMode)) {
+			pMember.mChunked = false;
+			pMember.mHeader = tarHeader(lPath, &lMetadata, '2', 0, QFile::encodeName(lMetadata.mSymlinkTarget));
+			return true;
+		} else if(S_ISREG(lMetadata.mMode)) {
+			if(pMember.mChunked) {
+				pMember.mSize = calculateChunkFileSize(lOid, mRepository);
+			} else {
+				size_t lBlobSize;
+				git_otype lType;
+				// only the object header is read, not the content.
+				if(mObjectDatabase != nullptr &&
+				   0 == git_odb_read_header(&lBlobSize, &lType, mObjectDatabase, lOid)) {
+					pMember.mSize = lBlobSize;
+				}
+			}
+			pMember.mHeader = tarHeader(lPath, &lMetadata, '0', pMember.mSize);
+			return true;
 		}
+		// sockets, fifos and devices are left out.
 	}
-	if(mMetadataStream != nullptr) {
-		delete mMetadataStream;
-		mMetadataStream = nullptr;
-		git_blob_free(mMetadataBlob);
-		mMetadataBlob = nullptr;
+	return false;
+}
+
+TarFile::TarFile(ArchivedDirectory *pDirectory)
+   : File(pDirectory, pDirectory->objectName() + QStringLiteral(".tar"), DEFAULT_MODE_FILE)
+{
+	mDirectory = pDirectory;
+	mUid = pDirectory->mUid;
+	mGid = pDirectory->mGid;
+	mAtime = pDirectory->mAtime;
+	mMtime = pDirectory->mMtime;
+	mMimeType = QStringLiteral("application/x-tar");
+	mWalker = nullptr;
+	mCurrentFile = nullptr;
+	mCurrentSize = 0;
+	mCurrentWritten = 0;
+	mFinished = false;
+}
+
+TarFile::~TarFile() {
+	delete mWalker;
+}
+
+int TarFile::seek(quint64 pOffset) {
+	// members are produced one after the other, only a restart is possible.
+	if(pOffset != 0) {
+		return KIO::ERR_COULD_NOT_SEEK;
 	}
-	git_tree_free(mTree);
-	mTree = nullptr;
+	delete mWalker;
+	mWalker = nullptr;
+	delete mCurrentFile;
+	mCurrentFile = nullptr;
+	mPending.clear();
+	mFinished = false;
+	mOffset = 0;
+	return 0;
+}
+
+int TarFile::read(QByteArray &pChunk, int pReadSize) {
+	if(mPending.isEmpty()) {
+		int lRetVal = nextPiece(mPending);
+		if(lRetVal != 0) {
+			return lRetVal;
+		}
+	}
+	if(pReadSize <= 0 || pReadSize >= mPending.size()) {
+		pChunk = mPending;
+		mPending.clear();
+	} else {
+		pChunk = mPending.left(pReadSize);
+		mPending.remove(0, pReadSize);
+	}
+	mOffset += static_cast<quint64>(pChunk.size());
+	return 0;
+}
+
+int TarFile::nextPiece(QByteArray &pPiece) {
+	if(mCurrentFile != nullptr) {
+		int lRetVal = mCurrentFile->read(pPiece);
+		if(lRetVal == 0) {
+			mCurrentWritten += static_cast<quint64>(pPiece.size());
+			return 0;
+		}
+		if(lRetVal != KIO::ERR_NO_CONTENT) {
+			return lRetVal;
+		}
+		// the header promised this size, anything else breaks the archive.
+		if(mCurrentWritten != mCurrentSize) {
+			return KIO::ERR_COULD_NOT_READ;
+		}
+		delete mCurrentFile;
+		mCurrentFile = nullptr;
+		const quint64 lPadding = tarPaddedSize(mCurrentWritten) - mCurrentWritten;
+		if(lPadding > 0) {
+			pPiece = QByteArray(static_cast<int>(lPadding), '\0');
+			return 0;
+		}
+	}
+	if(mFinished) {
+		return KIO::ERR_NO_CONTENT;
+	}
+	if(mWalker == nullptr) {
+		mWalker = new TarWalker(mRepository, mDirectory);
+	}
+	TarWalker::Member lMember;
+	if(mWalker->next(lMember)) {
+		pPiece = lMember.mHeader;
+		if(lMember.mSize > 0) {
+			// only the member being written has a node.
+			if(lMember.mChunked) {
+				mCurrentFile = new ChunkFile(this, &lMember.mOid, lMember.mName, lMember.mMode);
+			} else {
+				mCurrentFile = new BlobFile(this, &lMember.mOid, lMember.mName, lMember.mMode);
+			}
+			mCurrentFile->setCachedSize(lMember.mSize);
+			mCurrentSize = lMember.mSize;
+			mCurrentWritten = 0;
+		}
+		return 0;
+	}
+	delete mWalker;
+	mWalker = nullptr;
+	mFinished = true;
+	pPiece = QByteArray(1024, '\0');
+	return 0;
+}
+
+quint64 TarFile::calculateSize() {
+	TraceSpan lSpan("TarFile::calculateSize", "kio");
+	quint64 lSize = 1024;
+	TarWalker lWalker(mRepository, mDirectory);
+	TarWalker::Member lMember;
+	while(lWalker.next(lMember)) {
+		lSize += static_cast<quint64>(lMember.mHeader.size()) + tarPaddedSize(lMember.mSize);
+	}
+	return lSize;
 }
 
 Branch::Branch(Node *pParent, const char *pName)
    : Directory(pParent, QString::fromLocal8Bit(pName).remove(0, 11), DEFAULT_MODE_DIRECTORY)
 {
 	mRefName = QByteArray(pName);
+	mDiffs = nullptr;
 	QByteArray lPath = parent()->objectName().toLocal8Bit();
 	lPath.append(mRefName);
 	struct stat lStat;
@@ -422,6 +1179,18 @@ Branch::Branch(Node *pParent, const char *pName)
 	}
 }
 
+Node *Branch::subNode(const QString &pName) {
+	// Listing it would make recursive copies and size calculations of the
+	// branch walk every diff, counting changed files once more for each.
+	if(pName == QStringLiteral(".diff")) {
+		if(mDiffs == nullptr) {
+			mDiffs = new SnapshotDiffs(this);
+		}
+		return mDiffs;
+	}
+	return Directory::subNode(pName);
+}
+
 void Branch::reload() {
 	if(mSubNodes == nullptr) {
 		mSubNodes = new NodeMap();
@@ -432,26 +1201,134 @@ void Branch::reload() {
 }
 
 void Branch::generateSubNodes() {
-	if(0 != git_revwalk_push_ref(mRevisionWalker, mRefName)) {
+	CommitMetadataList lCommits;
+	if(!readBranchCommits(mRepository, mRefName, lCommits)) {
 		return;
 	}
-	git_oid lOid;
-	while(0 == git_revwalk_next(&lOid, mRevisionWalker)) {
-		git_commit *lCommit;
-		if(0 != git_commit_lookup(&lCommit, mRepository, &lOid)) {
-			continue;
-		}
-		QString lCommitTimeLocal = vfsTimeToString(git_commit_time(lCommit));
+	foreach(const CommitMetadata &lCommit, lCommits) {
+		QString lCommitTimeLocal = vfsTimeToString(lCommit.mCommitTime);
 		if(!mSubNodes->contains(lCommitTimeLocal)) {
-			Directory * lDirectory = new ArchivedDirectory(this, git_commit_tree_id(lCommit),
+			Directory * lDirectory = new ArchivedDirectory(this, &lCommit.mTreeOid,
 			                                               lCommitTimeLocal, DEFAULT_MODE_DIRECTORY);
-			lDirectory->mMtime = git_commit_time(lCommit);
+			lDirectory->mMtime = lCommit.mCommitTime;
 			mSubNodes->insert(lCommitTimeLocal, lDirectory);
 		}
-		git_commit_free(lCommit);
 	}
 }
 
+VirtualDirectory *VirtualDirectory::subDirectory(const QString &pName) {
+	VirtualDirectory *lDirectory = qobject_cast<VirtualDirectory *>(mSubNodes->value(pName, nullptr));
+	if(lDirectory == nullptr) {
+		lDirectory = new VirtualDirectory(this, pName);
+		lDirectory->mMtime = mMtime;
+		addSubNode(lDirectory);
+	}
+	return lDirectory;
+}
+
+SnapshotDiff::SnapshotDiff(Node *pParent, const QString &pName, ArchivedDirectory *pOldSnapshot,
+                           ArchivedDirectory *pNewSnapshot)
+   : Directory(pParent, pName, DEFAULT_MODE_DIRECTORY)
+{
+	mOldSnapshot = pOldSnapshot;
+	mNewSnapshot = pNewSnapshot;
+	mMtime = pNewSnapshot->mMtime;
+	// the changed nodes listed here belong to the snapshots.
+	if(mNodeBudget != nullptr) {
+		mNodeBudget->addDependent(this);
+	}
+}
+
+SnapshotDiff::~SnapshotDiff() {
+	if(mNodeBudget != nullptr) {
+		mNodeBudget->removeDependent(this);
+	}
+}
+
+void SnapshotDiff::generateSubNodes() {
+	VirtualDirectory *lAdded = new VirtualDirectory(this, QStringLiteral("added"));
+	VirtualDirectory *lModified = new VirtualDirectory(this, QStringLiteral("modified"));
+	VirtualDirectory *lRemoved = new VirtualDirectory(this, QStringLiteral("removed"));
+	foreach(VirtualDirectory *lDirectory, QList<VirtualDirectory *>() << lAdded << lModified << lRemoved) {
+		lDirectory->mMtime = mMtime;
+		mSubNodes->insert(lDirectory->objectName(), lDirectory);
+	}
+
+	TreeChangeList lChanges;
+	if(mListingCache == nullptr || !diffTrees(mListingCache, mOldSnapshot->oid(), mNewSnapshot->oid(), lChanges)) {
+		return;
+	}
+	foreach(const TreeChange &lChange, lChanges) {
+		VirtualDirectory *lDirectory = lAdded;
+		ArchivedDirectory *lSnapshot = mNewSnapshot;
+		if(lChange.mType == TREE_CHANGE_MODIFIED) {
+			lDirectory = lModified;
+		} else if(lChange.mType == TREE_CHANGE_REMOVED) {
+			lDirectory = lRemoved;
+			lSnapshot = mOldSnapshot;
+		}
+		Node *lNode = lSnapshot->resolve(lChange.mPath);
+		if(lNode == nullptr) {
+			continue;
+		}
+		for(int i = 0; i < lChange.mPath.count() - 1; ++i) {
+			lDirectory = lDirectory->subDirectory(lChange.mPath.at(i));
+		}
+		lDirectory->addSubNode(lNode);
+	}
+}
+
+SnapshotDiffs::SnapshotDiffs(Branch *pParent)
+   : Directory(pParent, QStringLiteral(".diff"), DEFAULT_MODE_DIRECTORY)
+{
+	mBranch = pParent;
+	mMtime = pParent->mMtime;
+}
+
+Node *SnapshotDiffs::subNode(const QString &pName) {
+	Node *lNode = subNodes().value(pName, nullptr);
+	if(lNode == nullptr) {
+		lNode = createDiff(pName);
+		if(lNode != nullptr) {
+			mSubNodes->insert(pName, lNode);
+		}
+	}
+	return lNode;
+}
+
+void SnapshotDiffs::generateSubNodes() {
+	QStringList lNames;
+	NodeMapIterator i(mBranch->subNodes());
+	while(i.hasNext()) {
+		if(qobject_cast<ArchivedDirectory *>(i.next().value()) != nullptr) {
+			lNames.append(i.key());
+		}
+	}
+	// snapshot names are times, sorting them as strings gives the right order.
+	lNames.sort();
+	for(int j = 1; j < lNames.count(); ++j) {
+		const QString lName = lNames.at(j - 1) + QStringLiteral("..") + lNames.at(j);
+		SnapshotDiff *lDiff = createDiff(lName);
+		if(lDiff != nullptr) {
+			mSubNodes->insert(lName, lDiff);
+		}
+	}
+}
+
+SnapshotDiff *SnapshotDiffs::createDiff(const QString &pName) {
+	const QStringList lNames = pName.split(QStringLiteral(".."));
+	if(lNames.count() != 2) {
+		return nullptr;
+	}
+	NodeMap lSnapshots = mBranch->subNodes();
+	ArchivedDirectory *lOldSnapshot = qobject_cast<ArchivedDirectory *>(lSnapshots.value(lNames.at(0), nullptr));
+	ArchivedDirectory *lNewSnapshot = qobject_cast<ArchivedDirectory *>(lSnapshots.value(lNames.at(1), nullptr));
+	if(lOldSnapshot == nullptr || lNewSnapshot == nullptr) {
+		return nullptr;
+	}
+	return new SnapshotDiff(this, pName, lOldSnapshot, lNewSnapshot);
+}
+
 Repository::Repository(QObject *pParent, const QString &pRepositoryPath)
    : Directory(pParent, pRepositoryPath, DEFAULT_MODE_DIRECTORY)
 {
@@ -463,6 +1340,7 @@ Repository::Repository(QObject *pParent, const QString &pRepositoryPath)
 		mRepository = nullptr;
 		return;
 	}
+	mListingCache = new ListingCache(mRepository);
 	git_strarray lBranchNames;
 	git_reference_list(&lBranchNames, mRepository);
 	for(uint i = 0; i < lBranchNames.count; ++i) {
@@ -481,20 +1359,27 @@ Repository::Repository(QObject *pParent, const QString &pRepositoryPath)
 		}
 	}
 	git_strarray_free(&lBranchNames);
-
-	if(0 != git_revwalk_new(&mRevisionWalker, mRepository)) {
-		qCWarning(KUPKIO) << "could not create a revision walker in repository " << pRepositoryPath;
-		mRevisionWalker = nullptr;
-		return;
-	}
 }
 
 Repository::~Repository() {
+	// child nodes hold blobs and trees from this repository, release them first.
+	const QObjectList lChildren = children();
+	qDeleteAll(lChildren);
+	delete mListingCache;
+	delete mNodeBudget;
 	if(mRepository != nullptr) {
 		git_repository_free(mRepository);
 	}
-	if(mRevisionWalker != nullptr) {
-		git_revwalk_free(mRevisionWalker);
+}
+
+void Repository::setMemoryBudget(quint64 pBytes) {
+	delete mNodeBudget;
+	mNodeBudget = new NodeBudget(pBytes);
+}
+
+void Repository::trimMemory(const Node *pKeep) {
+	if(mNodeBudget != nullptr) {
+		mNodeBudget->trim(pKeep);
 	}
 }
 
@@ -22,11 +22,18 @@
 
 #include <QHash>
 #include <QObject>
+#include <QStringList>
 #include <kio/global.h>
 #include <sys/types.h>
 
 #include "vfshelpers.h"
 
+class ArchivedDirectory;
+class Directory;
+class ListingCache;
+class NodeBudget;
+struct ListingEntry;
+
 class Node: public QObject, public Metadata {
 	Q_OBJECT
 public:
@@ -38,11 +45,23 @@ public:
 	QString completePath();
 	Node *parentCommit();
 //	Node *parentRepository();
+	// Git object holding the content, equal ids mean equal content.
+	virtual const git_oid *oid() const {
+		return nullptr;
+	}
+	git_repository *repository() const {
+		return mRepository;
+	}
 	QString mMimeType;
 
 protected:
-	static git_revwalk *mRevisionWalker;
-	static git_repository *mRepository;
+	// Handle of the repository this node belongs to, owned by the Repository
+	// node at the root of the tree. Never shared between threads.
+	git_repository *mRepository;
+	// Shared listing cache of that repository, also owned by the Repository node.
+	ListingCache *mListingCache;
+	// Owned by the Repository node too, nullptr when nodes are kept forever.
+	NodeBudget *mNodeBudget;
 };
 
 typedef QHash<QString, Node*> NodeMap;
@@ -58,13 +77,50 @@ public:
 		}
 	}
 	virtual NodeMap subNodes();
+	// Used when resolving paths, may find nodes that are not listed.
+	virtual Node *subNode(const QString &pName) {
+		return subNodes().value(pName, nullptr);
+	}
 	virtual void reload() {}
+	// Deletes the sub nodes, they are generated again when needed. Only for
+	// folders that own all their sub nodes.
+	virtual void releaseSubNodes();
 
 protected:
 	virtual void generateSubNodes() {}
 	NodeMap *mSubNodes;
 };
 
+// Keeps the nodes built for archived folders within a memory budget. They can
+// always be built again from the tree ids, so when over budget the folders
+// used least recently drop their sub nodes. Trimming is only safe between
+// operations, when nothing but pKeep is pointed to from the outside.
+class NodeBudget {
+public:
+	explicit NodeBudget(quint64 pBudget);
+	void touch(ArchivedDirectory *pDirectory, int pNodeCount);
+	void forget(ArchivedDirectory *pDirectory);
+	// Folders listing nodes owned by others, they are cleared whenever
+	// anything is evicted.
+	void addDependent(Directory *pDirectory);
+	void removeDependent(Directory *pDirectory);
+	void trim(const Node *pKeep);
+	quint64 usedMemory() const {
+		return mUsed;
+	}
+
+protected:
+	struct Usage {
+		quint64 mLastUse;
+		quint64 mSize;
+	};
+	QHash<ArchivedDirectory *, Usage> mUsage;
+	QList<Directory *> mDependents;
+	quint64 mBudget;
+	quint64 mUsed;
+	quint64 mClock;
+};
+
 class File: public Node {
 	Q_OBJECT
 public:
@@ -80,6 +136,9 @@ public:
 		}
 		return mCachedSize;
 	}
+	void setCachedSize(quint64 pSize) {
+		mCachedSize = pSize;
+	}
 	virtual int seek(quint64 pOffset) {
 		if(pOffset >= size()) {
 			return KIO::ERR_COULD_NOT_SEEK;
@@ -102,6 +161,9 @@ public:
 	BlobFile(Node *pParent, const git_oid *pOid, const QString &pName, quint64 pMode);
 	virtual ~BlobFile();
 	virtual int read(QByteArray &pChunk, int pReadSize = -1);
+	virtual const git_oid *oid() const {
+		return &mOid;
+	}
 
 protected:
 	git_blob *cachedBlob();
@@ -113,11 +175,11 @@ protected:
 class Symlink: public BlobFile {
 	Q_OBJECT
 public:
-	Symlink(Node *pParent, const git_oid *pOid, const QString &pName, quint64 pMode)
+	Symlink(Node *pParent, const git_oid *pOid, const QString &pName, quint64 pMode, bool pReadTarget = true)
 	   : BlobFile(pParent, pOid, pName, pMode)
 	{
 		QByteArray lArray;
-		if(0 == read(lArray)) {
+		if(pReadTarget && 0 == read(lArray)) {
 			mSymlinkTarget = QString::fromUtf8(lArray.data(), lArray.size());
 			seek(0);
 		}
@@ -131,6 +193,9 @@ public:
 	virtual ~ChunkFile();
 	virtual int seek(quint64 pOffset);
 	virtual int read(QByteArray &pChunk, int pReadSize = -1);
+	virtual const git_oid *oid() const {
+		return &mOid;
+	}
 
 protected:
 	virtual quint64 calculateSize();
@@ -149,39 +214,151 @@ protected:
 	bool mValidSeekPosition;
 };
 
+// Gets the nodes of a streamed listing, one at a time.
+class NodeVisitor {
+public:
+	virtual ~NodeVisitor() {}
+	virtual void visitNode(Node *pNode) = 0;
+};
+
 class ArchivedDirectory: public Directory {
 	Q_OBJECT
 public:
-	ArchivedDirectory(Node *pParent, const git_oid *pOid, const QString &pName, quint64 pMode);
+	// Without pReadMetadata the caller fills in the metadata, like from a cached listing.
+	ArchivedDirectory(Node *pParent, const git_oid *pOid, const QString &pName, quint64 pMode,
+	                  bool pReadMetadata = true);
+	virtual ~ArchivedDirectory();
+	virtual const git_oid *oid() const {
+		return &mOid;
+	}
+	// Finds a single entry without building nodes for all the others.
+	virtual Node *subNode(const QString &pName);
+	virtual void releaseSubNodes();
+	// Hands every entry to pVisitor in tree order, decoding the tree and the
+	// metadata as it goes, without building all nodes first. Such nodes are
+	// deleted after their visit, unless the folder was already listed in full.
+	// Returns false if the folder could not be read.
+	bool streamSubNodes(NodeVisitor &pVisitor);
 
 protected:
 	virtual void generateSubNodes();
+	void openTree(bool pReadMetadata);
+	void closeTree();
+	Node *nodeFromListing(const ListingEntry &pEntry);
+	Node *nodeFromTree(const QString &pName);
+	Node *nodeFromOpenTree(const QString &pName);
+	// Returns nullptr for the .bupm entry, pEntry is filled in for the listing cache.
+	Node *nodeFromTreeEntry(const git_tree_entry *pTreeEntry, VintStream *pMetadataStream, ListingEntry &pEntry);
+	void touchBudget();
 	git_oid mOid;
 	git_blob *mMetadataBlob;
 	git_tree *mTree;
 	VintStream *mMetadataStream;
+	// Nodes given out by subNode() before the full listing was made, they are
+	// reused in it.
+	NodeMap mResolvedNodes;
 };
 
+class TarWalker;
+
+// Virtual file with a tar archive of a backed up folder, built from the
+// folder's trees while it is being read. Can only be read from the start.
+class TarFile: public File {
+	Q_OBJECT
+public:
+	TarFile(ArchivedDirectory *pDirectory);
+	virtual ~TarFile();
+	virtual int seek(quint64 pOffset);
+	virtual int read(QByteArray &pChunk, int pReadSize = -1);
+
+protected:
+	virtual quint64 calculateSize();
+	int nextPiece(QByteArray &pPiece);
+
+	ArchivedDirectory *mDirectory;
+	TarWalker *mWalker;
+	File *mCurrentFile;
+	quint64 mCurrentSize;
+	quint64 mCurrentWritten;
+	QByteArray mPending;
+	bool mFinished;
+};
+
+class SnapshotDiffs;
+
 class Branch: public Directory {
 	Q_OBJECT
 public:
 	Branch(Node *pParent, const char *pName);
+	virtual Node *subNode(const QString &pName);
 	virtual void reload();
 
 protected:
 	virtual void generateSubNodes();
 	QByteArray mRefName;
+	SnapshotDiffs *mDiffs;
 };
 
 
+// Folder made up by kio_bup, its content is added from the outside.
+class VirtualDirectory: public Directory {
+	Q_OBJECT
+public:
+	VirtualDirectory(QObject *pParent, const QString &pName)
+	   : Directory(pParent, pName, DEFAULT_MODE_DIRECTORY)
+	{
+		mSubNodes = new NodeMap();
+	}
+	void addSubNode(Node *pNode) {
+		mSubNodes->insert(pNode->objectName(), pNode);
+	}
+	VirtualDirectory *subDirectory(const QString &pName);
+};
+
+// What changed between two snapshots, in the folders "added", "modified" and
+// "removed". They mirror the snapshot folders but only hold what changed, the
+// files in them are the real files of the newer (or for removed files, the
+// older) snapshot.
+class SnapshotDiff: public Directory {
+	Q_OBJECT
+public:
+	SnapshotDiff(Node *pParent, const QString &pName, ArchivedDirectory *pOldSnapshot,
+	             ArchivedDirectory *pNewSnapshot);
+	virtual ~SnapshotDiff();
+
+protected:
+	virtual void generateSubNodes();
+	ArchivedDirectory *mOldSnapshot;
+	ArchivedDirectory *mNewSnapshot;
+};
+
+// The ".diff" folder of a branch. Lists each snapshot compared to the one
+// before, "<older>..<newer>" resolves for any two snapshots. It is not listed
+// in the branch, only found by name.
+class SnapshotDiffs: public Directory {
+	Q_OBJECT
+public:
+	SnapshotDiffs(Branch *pParent);
+	virtual Node *subNode(const QString &pName);
+
+protected:
+	virtual void generateSubNodes();
+	SnapshotDiff *createDiff(const QString &pName);
+	Branch *mBranch;
+};
+
 class Repository: public Directory {
 	Q_OBJECT
 public:
 	Repository(QObject *pParent, const QString &pRepositoryPath);
 	virtual ~Repository();
 	bool isValid() {
-		return mRepository != nullptr && mRevisionWalker != nullptr;
+		return mRepository != nullptr;
 	}
+	// Call before anything is listed, nodes created earlier do not count.
+	void setMemoryBudget(quint64 pBytes);
+	// Keeps pKeep and the folders leading to it.
+	void trimMemory(const Node *pKeep);
 
 protected:
 	virtual void generateSubNodes();
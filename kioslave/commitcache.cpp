@@ -0,0 +1,183 @@
+/***************************************************************************
+ *   Copyright Simon Persson                                               *
+ *   simonpersson1@gmail.com                                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "commitcache.h"
+
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+#include <QLockFile>
+#include <QStandardPaths>
+#include <QtEndian>
+
+#include <git2/graph.h>
+
+#include <string.h>
+
+// File layout: the magic string followed by fixed size rows, oldest commit first.
+// Each row is commit oid, first parent oid, tree oid and commit time (64 bit,
+// little endian).
+#define COMMIT_CACHE_MAGIC "KUPCMT01"
+#define COMMIT_CACHE_MAGIC_SIZE 8
+#define COMMIT_CACHE_ROW_SIZE (3 * GIT_OID_RAWSZ + 8)
+
+static QString commitCachePath(git_repository *pRepository, const QByteArray &pRefName) {
+	QByteArray lKey = QDir::cleanPath(QString::fromLocal8Bit(git_repository_path(pRepository))).toUtf8();
+	lKey.append('\0');
+	lKey.append(pRefName);
+	QString lDir = QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation);
+	lDir.append(QStringLiteral("/kup/commits/"));
+	QDir().mkpath(lDir);
+	return lDir + QString::fromLatin1(QCryptographicHash::hash(lKey, QCryptographicHash::Sha1).toHex());
+}
+
+// Returns false if the file is not a complete cache file, it then needs to be rewritten.
+static bool readRows(QFile &pFile, CommitMetadataList &pRows) {
+	QByteArray lData = pFile.readAll();
+	if(!lData.startsWith(COMMIT_CACHE_MAGIC) ||
+	      (lData.size() - COMMIT_CACHE_MAGIC_SIZE) % COMMIT_CACHE_ROW_SIZE != 0) {
+		return false;
+	}
+	int lRowCount = (lData.size() - COMMIT_CACHE_MAGIC_SIZE) / COMMIT_CACHE_ROW_SIZE;
+	pRows.resize(lRowCount);
+	const uchar *lRowData = reinterpret_cast<const uchar *>(lData.constData()) + COMMIT_CACHE_MAGIC_SIZE;
+	for(int i = 0; i < lRowCount; ++i) {
+		CommitMetadata &lRow = pRows[i];
+		memcpy(lRow.mCommitOid.id, lRowData, GIT_OID_RAWSZ);
+		memcpy(lRow.mParentOid.id, lRowData + GIT_OID_RAWSZ, GIT_OID_RAWSZ);
+		memcpy(lRow.mTreeOid.id, lRowData + 2 * GIT_OID_RAWSZ, GIT_OID_RAWSZ);
+		lRow.mCommitTime = qFromLittleEndian<qint64>(lRowData + 3 * GIT_OID_RAWSZ);
+		lRowData += COMMIT_CACHE_ROW_SIZE;
+	}
+	return true;
+}
+
+static void appendRow(QByteArray &pData, const CommitMetadata &pRow) {
+	uchar lTime[8];
+	qToLittleEndian<qint64>(pRow.mCommitTime, lTime);
+	pData.append(reinterpret_cast<const char *>(pRow.mCommitOid.id), GIT_OID_RAWSZ);
+	pData.append(reinterpret_cast<const char *>(pRow.mParentOid.id), GIT_OID_RAWSZ);
+	pData.append(reinterpret_cast<const char *>(pRow.mTreeOid.id), GIT_OID_RAWSZ);
+	pData.append(reinterpret_cast<const char *>(lTime), sizeof(lTime));
+}
+
+// Looks up all commits reachable from pHead but not from pStopAt (if given), newest first.
+static bool walkNewCommits(git_repository *pRepository, const git_oid *pHead, const git_oid *pStopAt,
+                           CommitMetadataList &pNewCommits) {
+	git_revwalk *lRevisionWalker;
+	if(0 != git_revwalk_new(&lRevisionWalker, pRepository)) {
+		return false;
+	}
+	git_revwalk_sorting(lRevisionWalker, GIT_SORT_TIME);
+	if(0 != git_revwalk_push(lRevisionWalker, pHead) ||
+	      (pStopAt != nullptr && 0 != git_revwalk_hide(lRevisionWalker, pStopAt))) {
+		git_revwalk_free(lRevisionWalker);
+		return false;
+	}
+	git_oid lOid;
+	while(0 == git_revwalk_next(&lOid, lRevisionWalker)) {
+		git_commit *lCommit;
+		if(0 != git_commit_lookup(&lCommit, pRepository, &lOid)) {
+			continue;
+		}
+		CommitMetadata lRow;
+		lRow.mCommitOid = lOid;
+		if(git_commit_parentcount(lCommit) > 0) {
+			lRow.mParentOid = *git_commit_parent_id(lCommit, 0);
+		} else {
+			memset(lRow.mParentOid.id, 0, GIT_OID_RAWSZ);
+		}
+		lRow.mTreeOid = *git_commit_tree_id(lCommit);
+		lRow.mCommitTime = git_commit_time(lCommit);
+		pNewCommits.append(lRow);
+		git_commit_free(lCommit);
+	}
+	git_revwalk_free(lRevisionWalker);
+	return true;
+}
+
+bool readBranchCommits(git_repository *pRepository, const QByteArray &pRefName, CommitMetadataList &pCommits) {
+	pCommits.clear();
+	git_oid lHeadOid;
+	if(0 != git_reference_name_to_id(&lHeadOid, pRepository, pRefName.constData())) {
+		return false;
+	}
+
+	QString lCachePath = commitCachePath(pRepository, pRefName);
+	// Several kio slaves and filedigger may update the same file, only append while
+	// holding the lock. Without it the cache is still read but left untouched.
+	QLockFile lLock(lCachePath + QStringLiteral(".lock"));
+	bool lLocked = lLock.tryLock(2000);
+
+	CommitMetadataList lKnownCommits; // oldest first
+	bool lRewrite = true;
+	QFile lCacheFile(lCachePath);
+	if(lCacheFile.open(QIODevice::ReadOnly)) {
+		lRewrite = !readRows(lCacheFile, lKnownCommits);
+		lCacheFile.close();
+	}
+	if(lRewrite) {
+		lKnownCommits.clear();
+	}
+	if(!lKnownCommits.isEmpty() && !git_oid_equal(&lKnownCommits.last().mCommitOid, &lHeadOid)) {
+		// The branch must have moved forward from the newest commit we know about,
+		// otherwise history was rewritten (like after pruning old backups).
+		size_t lAhead, lBehind;
+		if(0 != git_graph_ahead_behind(&lAhead, &lBehind, pRepository, &lHeadOid,
+		                               &lKnownCommits.last().mCommitOid) || lBehind != 0) {
+			lKnownCommits.clear();
+			lRewrite = true;
+		}
+	}
+
+	CommitMetadataList lNewCommits; // newest first
+	if(lKnownCommits.isEmpty() || !git_oid_equal(&lKnownCommits.last().mCommitOid, &lHeadOid)) {
+		const git_oid *lStopAt = lKnownCommits.isEmpty() ? nullptr : &lKnownCommits.last().mCommitOid;
+		if(!walkNewCommits(pRepository, &lHeadOid, lStopAt, lNewCommits)) {
+			return false;
+		}
+	}
+
+	if(lLocked && !lNewCommits.isEmpty()) {
+		QByteArray lData;
+		lData.reserve(COMMIT_CACHE_MAGIC_SIZE + lNewCommits.count() * COMMIT_CACHE_ROW_SIZE);
+		if(lRewrite) {
+			lData.append(COMMIT_CACHE_MAGIC, COMMIT_CACHE_MAGIC_SIZE);
+		}
+		for(int i = lNewCommits.count() - 1; i >= 0; --i) {
+			appendRow(lData, lNewCommits.at(i));
+		}
+		if(lRewrite) {
+			lCacheFile.open(QIODevice::WriteOnly | QIODevice::Truncate);
+		} else {
+			lCacheFile.open(QIODevice::WriteOnly | QIODevice::Append);
+		}
+		if(lCacheFile.isOpen()) {
+			lCacheFile.write(lData);
+			lCacheFile.close();
+		}
+	}
+
+	pCommits.reserve(lNewCommits.count() + lKnownCommits.count());
+	pCommits += lNewCommits;
+	for(int i = lKnownCommits.count() - 1; i >= 0; --i) {
+		pCommits.append(lKnownCommits.at(i));
+	}
+	return true;
+}
@@ -0,0 +1,43 @@
+/***************************************************************************
+ *   Copyright Simon Persson                                               *
+ *   simonpersson1@gmail.com                                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef COMMITCACHE_H
+#define COMMITCACHE_H
+
+#include <QByteArray>
+#include <QVector>
+
+#include <git2.h>
+
+// The little we need to know about a commit to list it as a snapshot.
+struct CommitMetadata {
+	git_oid mCommitOid;
+	git_oid mParentOid; // all zeros for a root commit
+	git_oid mTreeOid;
+	qint64 mCommitTime;
+};
+
+typedef QVector<CommitMetadata> CommitMetadataList;
+
+// Fills pCommits with the commits reachable from pRefName, newest first.
+// Results are kept in a sidecar file per repository and branch in ~/.cache/kup,
+// only commits added since the last call are looked up in the repository.
+bool readBranchCommits(git_repository *pRepository, const QByteArray &pRefName, CommitMetadataList &pCommits);
+
+#endif // COMMITCACHE_H
@@ -0,0 +1,391 @@
+/***************************************************************************
+ *   Copyright Simon Persson                                               *
+ *   simonpersson1@gmail.com                                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "listingcache.h"
+
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QLockFile>
+#include <QStandardPaths>
+#include <QtEndian>
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// File layout: a header of LISTING_CACHE_HEADER_SIZE bytes with the magic
+// string, a "retired" flag (32 bit) and the end of the committed records
+// (64 bit). Then records, each with its length (32 bit), kind (32 bit), tree
+// oid and the listing serialized with QDataStream. Numbers are little endian,
+// the flag and the end are only accessed atomically.
+#define LISTING_CACHE_MAGIC "KUPLST01"
+#define LISTING_CACHE_MAGIC_SIZE 8
+#define LISTING_CACHE_RETIRED_OFFSET 8
+#define LISTING_CACHE_END_OFFSET 16
+#define LISTING_CACHE_HEADER_SIZE 64
+#define LISTING_CACHE_RECORD_HEADER_SIZE (8 + GIT_OID_RAWSZ)
+#define LISTING_CACHE_MAX_SIZE (64 * 1024 * 1024)
+
+#define LISTING_FLAG_CHUNKED 1
+#define LISTING_FLAG_METADATA 2
+
+static QByteArray oidKey(const git_oid *pOid) {
+	return QByteArray(reinterpret_cast<const char *>(pOid->id), GIT_OID_RAWSZ);
+}
+
+static quint64 committedEnd(const uchar *pMap) {
+	return qFromLittleEndian(__atomic_load_n(reinterpret_cast<const quint64 *>(pMap + LISTING_CACHE_END_OFFSET),
+	                                         __ATOMIC_ACQUIRE));
+}
+
+static bool isRetired(const uchar *pMap) {
+	return __atomic_load_n(reinterpret_cast<const quint32 *>(pMap + LISTING_CACHE_RETIRED_OFFSET),
+	                       __ATOMIC_ACQUIRE) != 0;
+}
+
+static QByteArray serializeEntries(ListingKind pKind, const ListingEntryList &pEntries) {
+	QByteArray lData;
+	QDataStream lStream(&lData, QIODevice::WriteOnly);
+	lStream << static_cast<quint32>(pEntries.count());
+	foreach(const ListingEntry &lEntry, pEntries) {
+		quint8 lFlags = 0;
+		if(lEntry.mChunked) {
+			lFlags |= LISTING_FLAG_CHUNKED;
+		}
+		if(lEntry.mHasMetadata) {
+			lFlags |= LISTING_FLAG_METADATA;
+		}
+		lStream << lEntry.mName.toUtf8() << static_cast<quint32>(lEntry.mTreeMode) << lFlags;
+		lStream.writeRawData(reinterpret_cast<const char *>(lEntry.mOid.id), GIT_OID_RAWSZ);
+		lStream << lEntry.mMetadata.mMode << lEntry.mMetadata.mUid << lEntry.mMetadata.mGid
+		        << lEntry.mMetadata.mAtime << lEntry.mMetadata.mMtime << lEntry.mMetadata.mSymlinkTarget.toUtf8();
+		if(pKind == LISTING_FULL) {
+			lStream << lEntry.mMimeType.toUtf8() << lEntry.mSize;
+		}
+	}
+	return lData;
+}
+
+static bool deserializeEntries(ListingKind pKind, const QByteArray &pData, ListingEntryList &pEntries) {
+	QDataStream lStream(pData);
+	quint32 lCount;
+	lStream >> lCount;
+	if(lStream.status() != QDataStream::Ok || lCount > static_cast<quint32>(pData.size())) {
+		return false;
+	}
+	pEntries.resize(static_cast<int>(lCount));
+	for(quint32 i = 0; i < lCount; ++i) {
+		ListingEntry &lEntry = pEntries[static_cast<int>(i)];
+		QByteArray lName, lSymlinkTarget;
+		quint32 lTreeMode;
+		quint8 lFlags;
+		lStream >> lName >> lTreeMode >> lFlags;
+		lStream.readRawData(reinterpret_cast<char *>(lEntry.mOid.id), GIT_OID_RAWSZ);
+		lStream >> lEntry.mMetadata.mMode >> lEntry.mMetadata.mUid >> lEntry.mMetadata.mGid
+		        >> lEntry.mMetadata.mAtime >> lEntry.mMetadata.mMtime >> lSymlinkTarget;
+		lEntry.mName = QString::fromUtf8(lName);
+		lEntry.mTreeMode = lTreeMode;
+		lEntry.mChunked = (lFlags & LISTING_FLAG_CHUNKED) != 0;
+		lEntry.mHasMetadata = (lFlags & LISTING_FLAG_METADATA) != 0;
+		lEntry.mMetadata.mSymlinkTarget = QString::fromUtf8(lSymlinkTarget);
+		lEntry.mSize = 0;
+		if(pKind == LISTING_FULL) {
+			QByteArray lMimeType;
+			lStream >> lMimeType >> lEntry.mSize;
+			lEntry.mMimeType = QString::fromUtf8(lMimeType);
+		}
+	}
+	return lStream.status() == QDataStream::Ok;
+}
+
+ListingCache::ListingCache(git_repository *pRepository) {
+	mRepository = pRepository;
+	mFileDescriptor = -1;
+	mMap = nullptr;
+	mIndexedEnd = LISTING_CACHE_HEADER_SIZE;
+
+	QByteArray lKey = QDir::cleanPath(QString::fromLocal8Bit(git_repository_path(pRepository))).toUtf8();
+	QString lDir = QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation);
+	lDir.append(QStringLiteral("/kup/listings/"));
+	QDir().mkpath(lDir);
+	mPath = lDir + QString::fromLatin1(QCryptographicHash::hash(lKey, QCryptographicHash::Sha1).toHex());
+
+	if(!fileIsValid()) {
+		QLockFile lLock(mPath + QStringLiteral(".lock"));
+		if(!lLock.tryLock(2000) || (!fileIsValid() && !createFile())) {
+			return;
+		}
+	}
+	openFile();
+}
+
+ListingCache::~ListingCache() {
+	closeFile();
+}
+
+bool ListingCache::fileIsValid() {
+	QFile lFile(mPath);
+	return lFile.open(QIODevice::ReadOnly) && lFile.size() >= LISTING_CACHE_HEADER_SIZE &&
+	      lFile.read(LISTING_CACHE_MAGIC_SIZE) == QByteArray(LISTING_CACHE_MAGIC);
+}
+
+// Puts an empty file in place, must be called while holding the lock.
+bool ListingCache::createFile() {
+	QByteArray lHeader(LISTING_CACHE_HEADER_SIZE, '\0');
+	memcpy(lHeader.data(), LISTING_CACHE_MAGIC, LISTING_CACHE_MAGIC_SIZE);
+	qToLittleEndian<quint64>(LISTING_CACHE_HEADER_SIZE, reinterpret_cast<uchar *>(lHeader.data()) + LISTING_CACHE_END_OFFSET);
+	// Others may have the old file mapped, it must never shrink under them.
+	// Replace it instead and tell them with the retired flag.
+	const QString lNewPath = mPath + QStringLiteral(".new");
+	QFile lNewFile(lNewPath);
+	if(!lNewFile.open(QIODevice::WriteOnly | QIODevice::Truncate) || lNewFile.write(lHeader) != lHeader.size()) {
+		return false;
+	}
+	lNewFile.close();
+	if(0 != ::rename(QFile::encodeName(lNewPath).constData(), QFile::encodeName(mPath).constData())) {
+		QFile::remove(lNewPath);
+		return false;
+	}
+	return true;
+}
+
+bool ListingCache::openFile() {
+	mFileDescriptor = ::open(QFile::encodeName(mPath).constData(), O_RDWR | O_CLOEXEC);
+	if(mFileDescriptor < 0) {
+		return false;
+	}
+	// The mapping is as large as the file may ever get, so it never needs to be
+	// redone when others append. Only committed records are ever touched.
+	void *lMap = mmap(nullptr, LISTING_CACHE_MAX_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, mFileDescriptor, 0);
+	if(lMap == MAP_FAILED) {
+		::close(mFileDescriptor);
+		mFileDescriptor = -1;
+		return false;
+	}
+	mMap = static_cast<uchar *>(lMap);
+	// Reading even the header of a truncated file would raise SIGBUS.
+	struct stat lStat;
+	if(0 != fstat(mFileDescriptor, &lStat) || lStat.st_size < LISTING_CACHE_HEADER_SIZE) {
+		closeFile();
+		return false;
+	}
+	mIndexedEnd = LISTING_CACHE_HEADER_SIZE;
+	mIndex.clear();
+	return true;
+}
+
+void ListingCache::closeFile() {
+	if(mMap != nullptr) {
+		munmap(mMap, LISTING_CACHE_MAX_SIZE);
+		mMap = nullptr;
+	}
+	if(mFileDescriptor >= 0) {
+		::close(mFileDescriptor);
+		mFileDescriptor = -1;
+	}
+	mIndex.clear();
+}
+
+// Pages of the mapping past the end of the file raise SIGBUS when touched, so
+// the committed end is only trusted when the file really reaches that far.
+bool ListingCache::readEnd(quint64 &pEnd) {
+	struct stat lStat;
+	if(0 != fstat(mFileDescriptor, &lStat) || lStat.st_size < LISTING_CACHE_HEADER_SIZE) {
+		return false;
+	}
+	pEnd = committedEnd(mMap);
+	return pEnd >= LISTING_CACHE_HEADER_SIZE &&
+	      pEnd <= qMin(static_cast<quint64>(lStat.st_size), static_cast<quint64>(LISTING_CACHE_MAX_SIZE));
+}
+
+// Puts an empty file in place of the mapped one unless someone already did,
+// and maps the new one. Must be called while holding the lock.
+bool ListingCache::replaceFile() {
+	struct stat lMapped, lCurrent;
+	if(0 == fstat(mFileDescriptor, &lMapped) && 0 == ::stat(QFile::encodeName(mPath).constData(), &lCurrent) &&
+	      lMapped.st_dev == lCurrent.st_dev && lMapped.st_ino == lCurrent.st_ino) {
+		if(!createFile()) {
+			closeFile();
+			return false;
+		}
+		if(lMapped.st_size >= LISTING_CACHE_HEADER_SIZE) {
+			__atomic_store_n(reinterpret_cast<quint32 *>(mMap + LISTING_CACHE_RETIRED_OFFSET),
+			                 qToLittleEndian<quint32>(1), __ATOMIC_RELEASE);
+		}
+	}
+	closeFile();
+	return openFile();
+}
+
+// The file is shorter than its header claims, it was truncated or damaged.
+void ListingCache::retireFile() {
+	QLockFile lLock(mPath + QStringLiteral(".lock"));
+	if(!lLock.tryLock(2000)) {
+		closeFile();
+		return;
+	}
+	replaceFile();
+}
+
+void ListingCache::updateIndex() {
+	quint64 lEnd;
+	const bool lValid = readEnd(lEnd);
+	if(!lValid || isRetired(mMap)) {
+		if(lValid) {
+			closeFile();
+			openFile();
+		} else {
+			retireFile();
+		}
+		if(mMap == nullptr || !readEnd(lEnd)) {
+			closeFile();
+			return;
+		}
+	}
+	while(mIndexedEnd + LISTING_CACHE_RECORD_HEADER_SIZE <= lEnd) {
+		const uchar *lRecord = mMap + mIndexedEnd;
+		const quint32 lLength = qFromLittleEndian<quint32>(lRecord);
+		const quint32 lKind = qFromLittleEndian<quint32>(lRecord + 4);
+		if(lLength < LISTING_CACHE_RECORD_HEADER_SIZE || mIndexedEnd + lLength > lEnd) {
+			break;
+		}
+		const QByteArray lKey(reinterpret_cast<const char *>(lRecord + 8), GIT_OID_RAWSZ);
+		const quint64 lKnownOffset = mIndex.value(lKey, 0);
+		if(lKnownOffset == 0 || qFromLittleEndian<quint32>(mMap + lKnownOffset + 4) <= lKind) {
+			mIndex.insert(lKey, mIndexedEnd);
+		}
+		mIndexedEnd += lLength;
+	}
+}
+
+bool ListingCache::lookup(const git_oid *pTreeOid, ListingKind pKind, ListingEntryList &pEntries) {
+	if(mMap == nullptr) {
+		return false;
+	}
+	updateIndex();
+	if(mMap == nullptr) {
+		return false;
+	}
+	const quint64 lOffset = mIndex.value(oidKey(pTreeOid), 0);
+	if(lOffset == 0) {
+		return false;
+	}
+	const uchar *lRecord = mMap + lOffset;
+	const quint32 lKind = qFromLittleEndian<quint32>(lRecord + 4);
+	if(lKind < static_cast<quint32>(pKind)) {
+		return false;
+	}
+	const quint32 lLength = qFromLittleEndian<quint32>(lRecord);
+	if(lOffset + lLength > mIndexedEnd) {
+		return false;
+	}
+	const QByteArray lData = QByteArray::fromRawData(reinterpret_cast<const char *>(lRecord) + LISTING_CACHE_RECORD_HEADER_SIZE,
+	                                                 static_cast<int>(lLength - LISTING_CACHE_RECORD_HEADER_SIZE));
+	return deserializeEntries(static_cast<ListingKind>(lKind), lData, pEntries);
+}
+
+void ListingCache::store(const git_oid *pTreeOid, ListingKind pKind, const ListingEntryList &pEntries) {
+	if(mMap == nullptr) {
+		return;
+	}
+	QByteArray lRecord(LISTING_CACHE_RECORD_HEADER_SIZE, '\0');
+	lRecord.append(serializeEntries(pKind, pEntries));
+	if(lRecord.size() > LISTING_CACHE_MAX_SIZE - LISTING_CACHE_HEADER_SIZE) {
+		return;
+	}
+	uchar *lRecordData = reinterpret_cast<uchar *>(lRecord.data());
+	qToLittleEndian<quint32>(static_cast<quint32>(lRecord.size()), lRecordData);
+	qToLittleEndian<quint32>(static_cast<quint32>(pKind), lRecordData + 4);
+	memcpy(lRecordData + 8, pTreeOid->id, GIT_OID_RAWSZ);
+
+	// Readers don't take the lock, without it the listing is just not stored.
+	QLockFile lLock(mPath + QStringLiteral(".lock"));
+	if(!lLock.tryLock(2000)) {
+		return;
+	}
+	quint64 lEnd;
+	bool lValid = readEnd(lEnd);
+	if(lValid && isRetired(mMap)) {
+		closeFile();
+		if(!openFile()) {
+			return;
+		}
+		lValid = readEnd(lEnd);
+	}
+	if(!lValid || lEnd + static_cast<quint64>(lRecord.size()) > LISTING_CACHE_MAX_SIZE) {
+		// Full or damaged, start over with an empty file.
+		if(!replaceFile() || !readEnd(lEnd)) {
+			return;
+		}
+	}
+	if(pwrite(mFileDescriptor, lRecord.constData(), static_cast<size_t>(lRecord.size()), static_cast<off_t>(lEnd)) !=
+	      static_cast<ssize_t>(lRecord.size())) {
+		return;
+	}
+	// Publish the record only once it is completely written.
+	__atomic_store_n(reinterpret_cast<quint64 *>(mMap + LISTING_CACHE_END_OFFSET),
+	                 qToLittleEndian<quint64>(lEnd + static_cast<quint64>(lRecord.size())), __ATOMIC_RELEASE);
+}
+
+bool ListingCache::basicListing(const git_oid *pTreeOid, ListingEntryList &pEntries) {
+	if(lookup(pTreeOid, LISTING_BASIC, pEntries)) {
+		return true;
+	}
+	git_tree *lTree;
+	if(0 != git_tree_lookup(&lTree, mRepository, pTreeOid)) {
+		return false;
+	}
+	git_blob *lMetadataBlob = nullptr;
+	VintStream *lMetadataStream = nullptr;
+	const git_tree_entry *lMetadataEntry = git_tree_entry_byname(lTree, ".bupm");
+	if(lMetadataEntry != nullptr && 0 == git_blob_lookup(&lMetadataBlob, mRepository, git_tree_entry_id(lMetadataEntry))) {
+		lMetadataStream = new VintStream(git_blob_rawcontent(lMetadataBlob), static_cast<int>(git_blob_rawsize(lMetadataBlob)), nullptr);
+		Metadata lMetadata;
+		readMetadata(*lMetadataStream, lMetadata); // the first entry is metadata for the directory itself, discard it.
+	}
+
+	pEntries.clear();
+	const size_t lEntryCount = git_tree_entrycount(lTree);
+	pEntries.reserve(static_cast<int>(lEntryCount));
+	for(size_t i = 0; i < lEntryCount; ++i) {
+		ListingEntry lEntry;
+		const git_oid *lOid;
+		getEntryAttributes(git_tree_entry_byindex(lTree, i), lEntry.mTreeMode, lEntry.mChunked, lOid, lEntry.mName);
+		if(lEntry.mName == QStringLiteral(".bupm")) {
+			continue;
+		}
+		lEntry.mOid = *lOid;
+		lEntry.mMetadata = Metadata(lEntry.mTreeMode);
+		lEntry.mHasMetadata = !S_ISDIR(lEntry.mTreeMode) && lMetadataStream != nullptr &&
+		                      0 == readMetadata(*lMetadataStream, lEntry.mMetadata);
+		lEntry.mSize = 0;
+		pEntries.append(lEntry);
+	}
+	delete lMetadataStream;
+	if(lMetadataBlob != nullptr) {
+		git_blob_free(lMetadataBlob);
+	}
+	git_tree_free(lTree);
+	store(pTreeOid, LISTING_BASIC, pEntries);
+	return true;
+}
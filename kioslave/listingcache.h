@@ -0,0 +1,87 @@
+/***************************************************************************
+ *   Copyright Simon Persson                                               *
+ *   simonpersson1@gmail.com                                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef LISTINGCACHE_H
+#define LISTINGCACHE_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QString>
+#include <QVector>
+
+#include <git2.h>
+
+#include "vfshelpers.h"
+
+// One entry of a backed up folder, decoded from the tree and its .bupm file.
+struct ListingEntry {
+	QString mName;
+	uint mTreeMode; // as returned by getEntryAttributes()
+	git_oid mOid;
+	bool mChunked;
+	bool mHasMetadata; // mMetadata was read from .bupm, not made up
+	Metadata mMetadata;
+	QString mMimeType; // full listings only
+	quint64 mSize; // full listings only, 0 for folders
+};
+
+typedef QVector<ListingEntry> ListingEntryList;
+
+enum ListingKind {
+	// Names, modes, ids and modification times, what filedigger needs.
+	LISTING_BASIC = 1,
+	// Everything kio_bup shows, including metadata of sub folders, MIME types and sizes.
+	LISTING_FULL = 2
+};
+
+// Decoded folder listings by tree id, shared by all kio_bup slaves, kup-mount
+// and filedigger through one file per repository in ~/.cache/kup. Readers map
+// the file and never lock, writers append under a lock file. When the file
+// reaches its size limit, or is shorter than its header claims, it is replaced
+// by an empty one.
+class ListingCache {
+public:
+	ListingCache(git_repository *pRepository);
+	~ListingCache();
+	// Finds a listing of at least the given kind.
+	bool lookup(const git_oid *pTreeOid, ListingKind pKind, ListingEntryList &pEntries);
+	void store(const git_oid *pTreeOid, ListingKind pKind, const ListingEntryList &pEntries);
+	// Looks up a basic listing, reads and stores it if it was not there.
+	bool basicListing(const git_oid *pTreeOid, ListingEntryList &pEntries);
+
+protected:
+	bool fileIsValid();
+	bool createFile();
+	bool openFile();
+	void closeFile();
+	bool readEnd(quint64 &pEnd);
+	bool replaceFile();
+	void retireFile();
+	void updateIndex();
+
+	git_repository *mRepository;
+	QString mPath;
+	int mFileDescriptor;
+	uchar *mMap;
+	quint64 mIndexedEnd;
+	QHash<QByteArray, quint64> mIndex; // tree oid to record offset
+};
+
+#endif // LISTINGCACHE_H
@@ -0,0 +1,98 @@
+/***************************************************************************
+ *   Copyright Simon Persson                                               *
+ *   simonpersson1@gmail.com                                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "thumbnailcache.h"
+#include "kuptrace.h"
+#include "vfshelpers.h"
+
+#include <QBuffer>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QImage>
+#include <QImageReader>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+// Bigger files are not decoded just for a thumbnail, the decoded image of one
+// can take many times the file size.
+#define THUMBNAIL_MAX_FILE_SIZE (16 * 1024 * 1024)
+
+int thumbnailBucketSize(int pSize) {
+	if(pSize <= 128) {
+		return 128;
+	} else if(pSize <= 256) {
+		return 256;
+	}
+	return 512;
+}
+
+QString thumbnailPath(const git_oid *pOid, int pSize) {
+	QString lPath = QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation);
+	lPath.append(QStringLiteral("/kup/thumbnails/%1/").arg(thumbnailBucketSize(pSize)));
+	lPath.append(oidToString(pOid));
+	lPath.append(QStringLiteral(".png"));
+	return lPath;
+}
+
+bool findThumbnail(const git_oid *pOid, int pSize, QByteArray &pPngData) {
+	QFile lFile(thumbnailPath(pOid, pSize));
+	if(!lFile.open(QIODevice::ReadOnly)) {
+		return false;
+	}
+	pPngData = lFile.readAll();
+	return !pPngData.isEmpty();
+}
+
+bool makeThumbnail(QIODevice *pDevice, const git_oid *pOid, int pSize, QByteArray &pPngData) {
+	TraceSpan lSpan("makeThumbnail", "kio");
+	if(pOid == nullptr || pDevice->size() > THUMBNAIL_MAX_FILE_SIZE) {
+		return false;
+	}
+	QImageReader lReader(pDevice);
+	const int lBucketSize = thumbnailBucketSize(pSize);
+	QSize lImageSize = lReader.size();
+	if(lImageSize.isValid() && (lImageSize.width() > lBucketSize || lImageSize.height() > lBucketSize)) {
+		// lets decoders like the JPEG one skip most of the work.
+		lReader.setScaledSize(lImageSize.scaled(lBucketSize, lBucketSize, Qt::KeepAspectRatio));
+	}
+	QImage lImage = lReader.read();
+	if(lImage.isNull()) {
+		return false;
+	}
+	if(lImage.width() > lBucketSize || lImage.height() > lBucketSize) {
+		lImage = lImage.scaled(lBucketSize, lBucketSize, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+	}
+
+	pPngData.clear();
+	QBuffer lPngBuffer(&pPngData);
+	lPngBuffer.open(QIODevice::WriteOnly);
+	if(!lImage.save(&lPngBuffer, "PNG")) {
+		return false;
+	}
+
+	const QString lPath = thumbnailPath(pOid, pSize);
+	QDir().mkpath(QFileInfo(lPath).absolutePath());
+	QSaveFile lFile(lPath);
+	if(lFile.open(QIODevice::WriteOnly)) {
+		lFile.write(pPngData);
+		lFile.commit();
+	}
+	return true;
+}
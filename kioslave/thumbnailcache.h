@@ -0,0 +1,46 @@
+/***************************************************************************
+ *   Copyright Simon Persson                                               *
+ *   simonpersson1@gmail.com                                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef THUMBNAILCACHE_H
+#define THUMBNAILCACHE_H
+
+#include <QByteArray>
+#include <QString>
+
+#include <git2.h>
+
+class QIODevice;
+
+// Thumbnails keyed by the id of the git object holding a file's content,
+// stored as PNG files in ~/.cache/kup/thumbnails/<size>/. Identical files in
+// all snapshots and repositories share one thumbnail, it is only made once.
+// kio_bup makes them for its thumbnail special() command and filedigger's
+// preview pane uses the same files.
+
+// Sizes are rounded up to 128, 256 or 512 pixels.
+int thumbnailBucketSize(int pSize);
+QString thumbnailPath(const git_oid *pOid, int pSize);
+bool findThumbnail(const git_oid *pOid, int pSize, QByteArray &pPngData);
+// Decodes the image from pDevice, which must be open for reading, and scales
+// it down. The decoder reads from the device as it goes, the content is not
+// loaded into memory first. Returns false if it is not an image.
+bool makeThumbnail(QIODevice *pDevice, const git_oid *pOid, int pSize, QByteArray &pPngData);
+
+#endif // THUMBNAILCACHE_H
@@ -0,0 +1,104 @@
+/***************************************************************************
+ *   Copyright Simon Persson                                               *
+ *   simonpersson1@gmail.com                                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "treediff.h"
+#include "kuptrace.h"
+#include "listingcache.h"
+
+#include <QHash>
+#include <QtAlgorithms>
+
+#include <sys/stat.h>
+
+static void addChange(TreeChangeList &pChanges, const QStringList &pParentPath, const ListingEntry &pEntry,
+                      TreeChangeType pType) {
+	TreeChange lChange;
+	lChange.mPath = pParentPath;
+	lChange.mPath.append(pEntry.mName);
+	lChange.mType = pType;
+	lChange.mMode = pEntry.mTreeMode;
+	lChange.mOid = pEntry.mOid;
+	pChanges.append(lChange);
+}
+
+static bool diffTreesRecursive(ListingCache *pListingCache, const git_oid *pOldTree, const git_oid *pNewTree,
+                               const QStringList &pPath, TreeChangeList &pChanges) {
+	ListingEntryList lOldEntries, lNewEntries;
+	if(!pListingCache->basicListing(pOldTree, lOldEntries) || !pListingCache->basicListing(pNewTree, lNewEntries)) {
+		return false;
+	}
+	QHash<QString, int> lOldIndexes;
+	lOldIndexes.reserve(lOldEntries.count());
+	for(int i = 0; i < lOldEntries.count(); ++i) {
+		lOldIndexes.insert(lOldEntries.at(i).mName, i);
+	}
+	QVector<bool> lOldSeen(lOldEntries.count(), false);
+
+	foreach(const ListingEntry &lNewEntry, lNewEntries) {
+		const int lOldIndex = lOldIndexes.value(lNewEntry.mName, -1);
+		if(lOldIndex < 0) {
+			addChange(pChanges, pPath, lNewEntry, TREE_CHANGE_ADDED);
+			continue;
+		}
+		lOldSeen[lOldIndex] = true;
+		const ListingEntry &lOldEntry = lOldEntries.at(lOldIndex);
+		if(git_oid_equal(&lOldEntry.mOid, &lNewEntry.mOid) && lOldEntry.mTreeMode == lNewEntry.mTreeMode) {
+			continue; // the whole sub tree is unchanged
+		}
+		if(S_ISDIR(lOldEntry.mTreeMode) != S_ISDIR(lNewEntry.mTreeMode)) {
+			addChange(pChanges, pPath, lOldEntry, TREE_CHANGE_REMOVED);
+			addChange(pChanges, pPath, lNewEntry, TREE_CHANGE_ADDED);
+		} else if(S_ISDIR(lNewEntry.mTreeMode)) {
+			QStringList lSubPath = pPath;
+			lSubPath.append(lNewEntry.mName);
+			if(!diffTreesRecursive(pListingCache, &lOldEntry.mOid, &lNewEntry.mOid, lSubPath, pChanges)) {
+				return false;
+			}
+		} else {
+			addChange(pChanges, pPath, lNewEntry, TREE_CHANGE_MODIFIED);
+		}
+	}
+	for(int i = 0; i < lOldEntries.count(); ++i) {
+		if(!lOldSeen.at(i)) {
+			addChange(pChanges, pPath, lOldEntries.at(i), TREE_CHANGE_REMOVED);
+		}
+	}
+	return true;
+}
+
+static bool changeLessThan(const TreeChange &a, const TreeChange &b) {
+	if(a.mPath != b.mPath) {
+		return a.mPath.join(QLatin1Char('/')) < b.mPath.join(QLatin1Char('/'));
+	}
+	return a.mType < b.mType;
+}
+
+bool diffTrees(ListingCache *pListingCache, const git_oid *pOldTree, const git_oid *pNewTree,
+               TreeChangeList &pChanges) {
+	TraceSpan lSpan("diffTrees", "vfs");
+	pChanges.clear();
+	if(git_oid_equal(pOldTree, pNewTree)) {
+		return true;
+	}
+	if(!diffTreesRecursive(pListingCache, pOldTree, pNewTree, QStringList(), pChanges)) {
+		return false;
+	}
+	qSort(pChanges.begin(), pChanges.end(), changeLessThan);
+	return true;
+}
@@ -0,0 +1,53 @@
+/***************************************************************************
+ *   Copyright Simon Persson                                               *
+ *   simonpersson1@gmail.com                                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef TREEDIFF_H
+#define TREEDIFF_H
+
+#include <QStringList>
+#include <QVector>
+
+#include <git2.h>
+
+class ListingCache;
+
+enum TreeChangeType {
+	TREE_CHANGE_ADDED,
+	TREE_CHANGE_REMOVED,
+	TREE_CHANGE_MODIFIED
+};
+
+struct TreeChange {
+	QStringList mPath;
+	TreeChangeType mType;
+	uint mMode; // of the new version, or of the old one if removed
+	git_oid mOid; // same here
+};
+
+typedef QVector<TreeChange> TreeChangeList;
+
+// Walks both trees together and lists what differs, sorted by path. Sub trees
+// with the same id are skipped, so the cost follows the size of the change.
+// Added or removed folders are listed once, not file by file. A folder that
+// became a file (or the other way around) is listed as removed and added.
+bool diffTrees(ListingCache *pListingCache, const git_oid *pOldTree, const git_oid *pNewTree,
+               TreeChangeList &pChanges);
+
+#endif // TREEDIFF_H
@@ -0,0 +1,171 @@
+/***************************************************************************
+ *   Copyright Simon Persson                                               *
+ *   simonpersson1@gmail.com                                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "treesizecache.h"
+#include "kuptrace.h"
+#include "vfshelpers.h"
+
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+#include <QLockFile>
+#include <QStandardPaths>
+#include <QtEndian>
+
+#include <sys/stat.h>
+
+// File layout: the magic string followed by fixed size rows, each a tree oid
+// and the size of everything below it (64 bit, little endian).
+#define TREE_SIZE_CACHE_MAGIC "KUPTSZ01"
+#define TREE_SIZE_CACHE_MAGIC_SIZE 8
+#define TREE_SIZE_CACHE_ROW_SIZE (GIT_OID_RAWSZ + 8)
+
+static QString treeSizeCachePath(git_repository *pRepository) {
+	QByteArray lKey = QDir::cleanPath(QString::fromLocal8Bit(git_repository_path(pRepository))).toUtf8();
+	QString lDir = QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation);
+	lDir.append(QStringLiteral("/kup/treesizes/"));
+	QDir().mkpath(lDir);
+	return lDir + QString::fromLatin1(QCryptographicHash::hash(lKey, QCryptographicHash::Sha1).toHex());
+}
+
+static QByteArray oidKey(const git_oid *pOid) {
+	return QByteArray(reinterpret_cast<const char *>(pOid->id), GIT_OID_RAWSZ);
+}
+
+TreeSizeCache::TreeSizeCache(git_repository *pRepository) {
+	mRepository = pRepository;
+	mObjectDatabase = nullptr;
+	git_repository_odb(&mObjectDatabase, mRepository);
+	mCachePath = treeSizeCachePath(mRepository);
+	mRewrite = true;
+
+	QFile lCacheFile(mCachePath);
+	if(!lCacheFile.open(QIODevice::ReadOnly)) {
+		return;
+	}
+	const QByteArray lData = lCacheFile.readAll();
+	if(!lData.startsWith(TREE_SIZE_CACHE_MAGIC) ||
+	      (lData.size() - TREE_SIZE_CACHE_MAGIC_SIZE) % TREE_SIZE_CACHE_ROW_SIZE != 0) {
+		return;
+	}
+	mRewrite = false;
+	const int lRowCount = (lData.size() - TREE_SIZE_CACHE_MAGIC_SIZE) / TREE_SIZE_CACHE_ROW_SIZE;
+	mSizes.reserve(lRowCount);
+	const char *lRowData = lData.constData() + TREE_SIZE_CACHE_MAGIC_SIZE;
+	for(int i = 0; i < lRowCount; ++i) {
+		mSizes.insert(QByteArray(lRowData, GIT_OID_RAWSZ),
+		              qFromLittleEndian<quint64>(reinterpret_cast<const uchar *>(lRowData) + GIT_OID_RAWSZ));
+		lRowData += TREE_SIZE_CACHE_ROW_SIZE;
+	}
+}
+
+TreeSizeCache::~TreeSizeCache() {
+	saveNewRows();
+	if(mObjectDatabase != nullptr) {
+		git_odb_free(mObjectDatabase);
+	}
+}
+
+bool TreeSizeCache::treeSize(const git_oid *pTreeOid, quint64 &pSize) {
+	TraceSpan lSpan("TreeSizeCache::treeSize", "kio");
+	bool lResult = calculateTreeSize(pTreeOid, pSize);
+	saveNewRows();
+	return lResult;
+}
+
+bool TreeSizeCache::knownTreeSize(const git_oid *pTreeOid, quint64 &pSize) const {
+	QHash<QByteArray, quint64>::const_iterator lIter = mSizes.constFind(oidKey(pTreeOid));
+	if(lIter == mSizes.constEnd()) {
+		return false;
+	}
+	pSize = lIter.value();
+	return true;
+}
+
+bool TreeSizeCache::calculateTreeSize(const git_oid *pTreeOid, quint64 &pSize) {
+	if(knownTreeSize(pTreeOid, pSize)) {
+		return true;
+	}
+	git_tree *lTree;
+	if(mObjectDatabase == nullptr || 0 != git_tree_lookup(&lTree, mRepository, pTreeOid)) {
+		return false;
+	}
+	bool lResult = true;
+	pSize = 0;
+	const size_t lEntryCount = git_tree_entrycount(lTree);
+	for(size_t i = 0; i < lEntryCount && lResult; ++i) {
+		uint lMode;
+		const git_oid *lOid;
+		QString lName;
+		bool lChunked;
+		const git_tree_entry *lTreeEntry = git_tree_entry_byindex(lTree, i);
+		getEntryAttributes(lTreeEntry, lMode, lChunked, lOid, lName);
+		if(lName == QStringLiteral(".bupm")) {
+			continue;
+		}
+		quint64 lSize = 0;
+		if(S_ISDIR(lMode)) {
+			lResult = calculateTreeSize(lOid, lSize);
+		} else if(lChunked) {
+			lSize = calculateChunkFileSize(lOid, mRepository);
+		} else if(S_ISREG(lMode)) {
+			// only the object header is needed, not the content.
+			size_t lBlobSize;
+			git_otype lType;
+			lResult = 0 == git_odb_read_header(&lBlobSize, &lType, mObjectDatabase, lOid);
+			lSize = lBlobSize;
+		}
+		pSize += lSize;
+	}
+	git_tree_free(lTree);
+	if(lResult) {
+		mSizes.insert(oidKey(pTreeOid), pSize);
+		uchar lSize[8];
+		qToLittleEndian<quint64>(pSize, lSize);
+		mNewRows.append(oidKey(pTreeOid));
+		mNewRows.append(reinterpret_cast<const char *>(lSize), sizeof(lSize));
+	}
+	return lResult;
+}
+
+void TreeSizeCache::saveNewRows() {
+	if(mNewRows.isEmpty()) {
+		return;
+	}
+	// Others may append to the same file, without the lock the rows are kept
+	// in memory and tried again next time.
+	QLockFile lLock(mCachePath + QStringLiteral(".lock"));
+	if(!lLock.tryLock(2000)) {
+		return;
+	}
+	QFile lCacheFile(mCachePath);
+	if(mRewrite) {
+		if(!lCacheFile.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+			return;
+		}
+		lCacheFile.write(TREE_SIZE_CACHE_MAGIC, TREE_SIZE_CACHE_MAGIC_SIZE);
+	} else if(!lCacheFile.open(QIODevice::WriteOnly | QIODevice::Append)) {
+		return;
+	}
+	if(lCacheFile.write(mNewRows) == mNewRows.size()) {
+		mNewRows.clear();
+		mRewrite = false;
+	}
+	lCacheFile.close();
+}
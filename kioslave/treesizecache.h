@@ -0,0 +1,54 @@
+/***************************************************************************
+ *   Copyright Simon Persson                                               *
+ *   simonpersson1@gmail.com                                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef TREESIZECACHE_H
+#define TREESIZECACHE_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QString>
+
+#include <git2.h>
+
+// Total size of the files below backed up folders, by tree id. A tree never
+// changes, so sizes are kept in a sidecar file per repository in ~/.cache/kup
+// and the next snapshot only needs to look at the folders that changed.
+class TreeSizeCache {
+public:
+	TreeSizeCache(git_repository *pRepository);
+	~TreeSizeCache();
+	// Looks up or calculates the size, false if the tree could not be read.
+	bool treeSize(const git_oid *pTreeOid, quint64 &pSize);
+	// Only looks up sizes that are already known.
+	bool knownTreeSize(const git_oid *pTreeOid, quint64 &pSize) const;
+
+protected:
+	bool calculateTreeSize(const git_oid *pTreeOid, quint64 &pSize);
+	void saveNewRows();
+
+	git_repository *mRepository;
+	git_odb *mObjectDatabase;
+	QString mCachePath;
+	QHash<QByteArray, quint64> mSizes;
+	QByteArray mNewRows;
+	bool mRewrite;
+};
+
+#endif // TREESIZECACHE_H
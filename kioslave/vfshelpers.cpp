@@ -18,10 +18,14 @@
  *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
  ***************************************************************************/
 #include "vfshelpers.h"
+#include "kuptrace.h"
 
 #include <QBuffer>
 #include <QByteArray>
 #include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QStandardPaths>
 
 #include <unistd.h>
 #include <sys/stat.h>
@@ -169,6 +173,23 @@ int readMetadata(VintStream &pMetadataStream, Metadata &pMetadata) {
 	return 0; // success
 }
 
+int skipMetadata(VintStream &pMetadataStream, int pCount) {
+	try {
+		for(int i = 0; i < pCount; ++i) {
+			quint64 lTag;
+			// every record is a tag followed by its data with a length in front.
+			pMetadataStream >> lTag;
+			while(lTag != RECORD_END) {
+				QByteArray lNotUsed;
+				pMetadataStream >> lNotUsed >> lTag;
+			}
+		}
+	} catch(int) {
+		return 1;
+	}
+	return 0; // success
+}
+
 quint64 calculateChunkFileSize(const git_oid *pOid, git_repository *pRepository) {
 	quint64 lLastChunkOffset = 0;
 	quint64 lLastChunkSize = 0;
@@ -227,3 +248,42 @@ QString vfsTimeToString(git_time_t pTime) {
 	lDateTime.setTime_t(pTime);
 	return lDateTime.toLocalTime().toString(QStringLiteral("yyyy-MM-dd hh:mm"));
 }
+
+QString oidToString(const git_oid *pOid) {
+	char lHex[GIT_OID_HEXSZ + 1];
+	git_oid_tostr(lHex, sizeof(lHex), pOid);
+	return QString::fromLatin1(lHex);
+}
+
+#ifdef BUNDLED_LIBGIT2
+static void traceObjectRead(const git_oid *pOid, int pDone, void *pPayload) {
+	Q_UNUSED(pOid)
+	Q_UNUSED(pPayload)
+	static thread_local qint64 sStartTime;
+	if(pDone) {
+		traceSpan("git_odb_read", "git", sStartTime);
+	} else {
+		sStartTime = traceTime();
+	}
+}
+#endif
+
+void traceRepositoryReads() {
+#ifdef BUNDLED_LIBGIT2
+	if(traceEnabled()) {
+		git_libgit2_opts(GIT_OPT_SET_ODB_READ_TRACE, &traceObjectRead, nullptr);
+	}
+#endif
+}
+
+void usePackIndexCache() {
+#ifdef BUNDLED_LIBGIT2
+	// bup repositories can have thousands of packs and bup only sometimes
+	// writes its own .midx files, which libgit2 can't read anyway.
+	QString lDir = QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation);
+	lDir.append(QStringLiteral("/kup/packindex"));
+	if(QDir().mkpath(lDir)) {
+		git_libgit2_opts(GIT_OPT_SET_MIDX_CACHE_DIR, QFile::encodeName(lDir).constData());
+	}
+#endif
+}
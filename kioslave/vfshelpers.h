@@ -61,9 +61,16 @@ struct Metadata {
 };
 
 int readMetadata(VintStream &pMetadataStream, Metadata &pMetadata);
+// Moves past the next pCount metadata entries without decoding them.
+int skipMetadata(VintStream &pMetadataStream, int pCount);
 quint64 calculateChunkFileSize(const git_oid *pOid, git_repository *pRepository);
 bool offsetFromName(const git_tree_entry *pEntry, quint64 &pUint);
 void getEntryAttributes(const git_tree_entry *pTreeEntry, uint &pMode, bool &pChunked, const git_oid *&pOid, QString &pName);
 QString vfsTimeToString(git_time_t pTime);
+QString oidToString(const git_oid *pOid);
+// Add spans for object database reads to the trace, if tracing is enabled.
+void traceRepositoryReads();
+// Let libgit2 keep a merged index of each repository's packs in ~/.cache/kup.
+void usePackIndexCache();
 
 #endif // VFSHELPERS_H
@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+/*
+ * Reads every object of a repository through the object database and
+ * prints how many objects per second that gives. The object cache is
+ * turned off, so each round inflates every object again.
+ *
+ * Usage: readobjects <repository> [rounds]
+ */
+
+#include <git2.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+typedef struct {
+	git_oid *oids;
+	size_t count;
+	size_t allocated;
+} oid_list;
+
+static int collect_oid(const git_oid *id, void *payload)
+{
+	oid_list *list = payload;
+
+	if (list->count == list->allocated) {
+		size_t allocated = list->allocated ? list->allocated * 2 : 1024;
+		git_oid *oids = realloc(list->oids, allocated * sizeof(git_oid));
+		if (oids == NULL)
+			return -1;
+		list->oids = oids;
+		list->allocated = allocated;
+	}
+
+	git_oid_cpy(&list->oids[list->count++], id);
+	return 0;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+	git_repository *repo;
+	git_odb *odb;
+	oid_list list = { NULL, 0, 0 };
+	int rounds = argc > 2 ? atoi(argv[2]) : 10;
+	int round;
+	double best = 0.0;
+
+	if (argc < 2 || rounds <= 0) {
+		fprintf(stderr, "Usage: readobjects <repository> [rounds]\n");
+		return 1;
+	}
+
+	git_threads_init();
+	git_libgit2_opts(GIT_OPT_ENABLE_CACHING, 0);
+
+	if (git_repository_open(&repo, argv[1]) < 0 ||
+		git_repository_odb(&odb, repo) < 0 ||
+		git_odb_foreach(odb, collect_oid, &list) < 0) {
+		fprintf(stderr, "readobjects: %s\n", giterr_last() ? giterr_last()->message : "out of memory");
+		return 1;
+	}
+
+	for (round = 1; round <= rounds; ++round) {
+		size_t i, bytes = 0;
+		double start = now(), elapsed, rate;
+
+		for (i = 0; i < list.count; ++i) {
+			git_odb_object *obj;
+			if (git_odb_read(&obj, odb, &list.oids[i]) < 0) {
+				fprintf(stderr, "readobjects: %s\n", giterr_last()->message);
+				return 1;
+			}
+			bytes += git_odb_object_size(obj);
+			git_odb_object_free(obj);
+		}
+
+		elapsed = now() - start;
+		rate = list.count / elapsed;
+		printf("round %d: %zu objects, %zu bytes, %.0f objects/s\n", round, list.count, bytes, rate);
+		if (rate > best)
+			best = rate;
+	}
+	printf("best: %.0f objects/s\n", best);
+
+	free(list.oids);
+	git_odb_free(odb);
+	git_repository_free(repo);
+	git_threads_shutdown();
+	return 0;
+}
@@ -135,9 +135,41 @@ typedef enum {
 	GIT_OPT_SET_CACHE_OBJECT_LIMIT,
 	GIT_OPT_SET_CACHE_MAX_SIZE,
 	GIT_OPT_ENABLE_CACHING,
-	GIT_OPT_GET_CACHED_MEMORY
+	GIT_OPT_GET_CACHED_MEMORY,
+	GIT_OPT_SET_CACHE_TYPE_BUDGET,
+	GIT_OPT_SET_CACHE_ADMISSION,
+	GIT_OPT_SET_ODB_READ_TRACE,
+	GIT_OPT_SET_MIDX_CACHE_DIR
 } git_libgit2_opt_t;
 
+/**
+ * Callback for GIT_OPT_SET_ODB_READ_TRACE, called with `done` set to 0
+ * before an object that is not in the cache gets read from the backends
+ * and with `done` set to 1 when that read has finished.
+ */
+struct git_oid;
+typedef void (*git_odb_read_trace_cb)(const struct git_oid *id, int done, void *payload);
+
+/**
+ * Admission policies for the object cache, see GIT_OPT_SET_CACHE_ADMISSION.
+ *
+ * - GIT_CACHE_ADMIT_SIZE_LIMIT
+ *   Cache every object smaller than the type's object limit (default).
+ *
+ * - GIT_CACHE_ADMIT_NEVER
+ *   Never cache objects of this type.
+ *
+ * - GIT_CACHE_ADMIT_REUSED
+ *   Only cache an object (still subject to the size limit) the second
+ *   time it is loaded. Data that is streamed through once, like the
+ *   chunks of a large file, then never pushes anything out of the cache.
+ */
+typedef enum {
+	GIT_CACHE_ADMIT_SIZE_LIMIT = 0,
+	GIT_CACHE_ADMIT_NEVER,
+	GIT_CACHE_ADMIT_REUSED
+} git_cache_admission_t;
+
 /**
  * Set or query a library global option
  *
@@ -209,6 +241,30 @@ typedef enum {
  *		> Get the current bytes in cache and the maximum that would be
  *		> allowed in the cache.
  *
+ *	* opts(GIT_OPT_SET_CACHE_TYPE_BUDGET, git_otype type, ssize_t bytes)
+ *
+ *		> Set the maximum total size of objects of the given type that
+ *		> each cache may hold. When a new object would exceed it, older
+ *		> objects of the same type are evicted first. Zero (the default)
+ *		> means the type is only bounded by GIT_OPT_SET_CACHE_MAX_SIZE.
+ *
+ *	* opts(GIT_OPT_SET_CACHE_ADMISSION, git_otype type, int policy)
+ *
+ *		> Set which objects of the given type get stored in the cache.
+ *		> `policy` is one of the `git_cache_admission_t` values.
+ *
+ *	* opts(GIT_OPT_SET_ODB_READ_TRACE, git_odb_read_trace_cb cb, void *payload)
+ *
+ *		> Set a callback that brackets every object database read which
+ *		> misses the cache, or NULL to remove it. It may be called from
+ *		> several threads at once, so set it before starting any.
+ *
+ *	* opts(GIT_OPT_SET_MIDX_CACHE_DIR, const char *path)
+ *
+ *		> Keep a merged index of each repository's packs in the existing
+ *		> folder `path`, so that finding an object does not search every
+ *		> pack index. Pass NULL (the default) to not use one.
+ *
  * @param option Option key
  * @param ... value to set the option
  * @return 0 on success, <0 on failure
@@ -21,7 +21,7 @@ bool git_cache__enabled = true;
 ssize_t git_cache__max_storage = (256 * 1024 * 1024);
 git_atomic_ssize git_cache__current_storage = {0};
 
-static size_t git_cache__max_object_size[8] = {
+static size_t git_cache__max_object_size[GIT_CACHE_TYPES] = {
 	0,     /* GIT_OBJ__EXT1 */
 	4096,  /* GIT_OBJ_COMMIT */
 	4096,  /* GIT_OBJ_TREE */
@@ -32,17 +32,61 @@ static size_t git_cache__max_object_size[8] = {
 	0      /* GIT_OBJ_REF_DELTA */
 };
 
-int git_cache_set_max_object_size(git_otype type, size_t size)
+/* per cache byte budget for each type, zero means only the global limit applies */
+static ssize_t git_cache__type_budget[GIT_CACHE_TYPES] = { 0 };
+
+static int git_cache__admission[GIT_CACHE_TYPES] = {
+	GIT_CACHE_ADMIT_SIZE_LIMIT,
+	GIT_CACHE_ADMIT_SIZE_LIMIT,
+	GIT_CACHE_ADMIT_SIZE_LIMIT,
+	GIT_CACHE_ADMIT_SIZE_LIMIT,
+	GIT_CACHE_ADMIT_SIZE_LIMIT,
+	GIT_CACHE_ADMIT_SIZE_LIMIT,
+	GIT_CACHE_ADMIT_SIZE_LIMIT,
+	GIT_CACHE_ADMIT_SIZE_LIMIT
+};
+
+static bool cache_type_in_range(git_otype type)
 {
-	if (type < 0 || (size_t)type >= ARRAY_SIZE(git_cache__max_object_size)) {
+	if (type < 0 || (size_t)type >= GIT_CACHE_TYPES) {
 		giterr_set(GITERR_INVALID, "type out of range");
-		return -1;
+		return false;
 	}
+	return true;
+}
+
+int git_cache_set_max_object_size(git_otype type, size_t size)
+{
+	if (!cache_type_in_range(type))
+		return -1;
 
 	git_cache__max_object_size[type] = size;
 	return 0;
 }
 
+int git_cache_set_type_budget(git_otype type, ssize_t budget)
+{
+	if (!cache_type_in_range(type))
+		return -1;
+
+	git_cache__type_budget[type] = budget;
+	return 0;
+}
+
+int git_cache_set_admission(git_otype type, int policy)
+{
+	if (!cache_type_in_range(type))
+		return -1;
+
+	if (policy < GIT_CACHE_ADMIT_SIZE_LIMIT || policy > GIT_CACHE_ADMIT_REUSED) {
+		giterr_set(GITERR_INVALID, "unknown cache admission policy");
+		return -1;
+	}
+
+	git_cache__admission[type] = policy;
+	return 0;
+}
+
 void git_cache_dump_stats(git_cache *cache)
 {
 	git_cached_obj *object;
@@ -90,6 +134,9 @@ static void clear_cache(git_cache *cache)
 	kh_clear(oid, cache->map);
 	git_atomic_ssize_add(&git_cache__current_storage, -cache->used_memory);
 	cache->used_memory = 0;
+	memset(cache->used_by_type, 0, sizeof(cache->used_by_type));
+	cache->clock_size = 0;
+	cache->clock_hand = 0;
 }
 
 void git_cache_clear(git_cache *cache)
@@ -106,45 +153,121 @@ void git_cache_free(git_cache *cache)
 {
 	git_cache_clear(cache);
 	git_oidmap_free(cache->map);
+	git__free(cache->clock);
 	git_mutex_free(&cache->lock);
 	git__memzero(cache, sizeof(*cache));
 }
 
 /* Called with lock */
-static void cache_evict_entries(git_cache *cache)
+static int clock_append(git_cache *cache, git_cached_obj *entry)
 {
-	uint32_t seed = rand();
-	size_t evict_count = 8;
-	ssize_t evicted_memory = 0;
+	if (cache->clock_size == cache->clock_alloc) {
+		size_t new_alloc = cache->clock_alloc ? cache->clock_alloc * 2 : 64;
+		git_cached_obj **new_clock =
+			git__realloc(cache->clock, new_alloc * sizeof(git_cached_obj *));
+		GITERR_CHECK_ALLOC(new_clock);
+
+		cache->clock = new_clock;
+		cache->clock_alloc = new_alloc;
+	}
 
-	/* do not infinite loop if there's not enough entries to evict  */
-	if (evict_count > kh_size(cache->map)) {
-		clear_cache(cache);
-		return;
+	entry->clock_slot = cache->clock_size;
+	entry->referenced = 0;
+	cache->clock[cache->clock_size++] = entry;
+	return 0;
+}
+
+/* Called with lock; drops the cache's reference to the entry under the hand */
+static void clock_evict_hand(git_cache *cache)
+{
+	git_cached_obj *evict = cache->clock[cache->clock_hand];
+	khiter_t pos = kh_get(oid, cache->map, &evict->oid);
+
+	if (pos != kh_end(cache->map))
+		kh_del(oid, cache->map, pos);
+
+	/* fill the hole with the last entry; the hand stays where it is so
+	 * the moved entry gets inspected next */
+	cache->clock_size--;
+	if (cache->clock_hand != cache->clock_size) {
+		cache->clock[cache->clock_hand] = cache->clock[cache->clock_size];
+		cache->clock[cache->clock_hand]->clock_slot = cache->clock_hand;
 	}
 
-	while (evict_count > 0) {
-		khiter_t pos = seed++ % kh_end(cache->map);
+	cache->used_memory -= evict->size;
+	cache->used_by_type[evict->type] -= evict->size;
+	git_atomic_ssize_add(&git_cache__current_storage, -(ssize_t)evict->size);
+	git_cached_obj_decref(evict);
+}
 
-		if (kh_exist(cache->map, pos)) {
-			git_cached_obj *evict = kh_val(cache->map, pos);
+/* Called with lock
+ *
+ * Sweeps the clock hand, giving every recently used entry a second
+ * chance, until `needed` bytes of objects of `type` have been freed.
+ * GIT_OBJ_ANY matches objects of every type.
+ */
+static void cache_evict_entries(git_cache *cache, git_otype type, ssize_t needed)
+{
+	size_t steps = 2 * cache->clock_size;
+
+	while (needed > 0 && cache->clock_size > 0 && steps-- > 0) {
+		git_cached_obj *entry;
 
-			evict_count--;
-			evicted_memory += evict->size;
-			git_cached_obj_decref(evict);
+		if (cache->clock_hand >= cache->clock_size)
+			cache->clock_hand = 0;
 
-			kh_del(oid, cache->map, pos);
+		entry = cache->clock[cache->clock_hand];
+		if (type != GIT_OBJ_ANY && entry->type != type) {
+			cache->clock_hand++;
+		} else if (entry->referenced) {
+			entry->referenced = 0;
+			cache->clock_hand++;
+		} else {
+			needed -= (ssize_t)entry->size;
+			clock_evict_hand(cache);
 		}
 	}
+}
 
-	cache->used_memory -= evicted_memory;
-	git_atomic_ssize_add(&git_cache__current_storage, -evicted_memory);
+/* Called with lock */
+static bool cache_admit(git_cache *cache, git_cached_obj *entry)
+{
+	uint32_t slot, tag;
+
+	switch (git_cache__admission[entry->type]) {
+	case GIT_CACHE_ADMIT_NEVER:
+		return false;
+
+	case GIT_CACHE_ADMIT_REUSED:
+		/* only keep objects that are asked for a second time, so
+		 * that data streamed through once does not flush the cache.
+		 * A lookup stores the raw object right before the parsed one,
+		 * often in this same cache, so only parsed stores count. */
+		if (entry->flags != GIT_CACHE_STORE_PARSED)
+			return false;
+
+		memcpy(&slot, entry->oid.id, sizeof(slot));
+		memcpy(&tag, entry->oid.id + sizeof(slot), sizeof(tag));
+		slot %= GIT_CACHE_GHOSTS;
+		tag |= 1; /* zero marks an empty slot */
+
+		if (cache->ghosts[slot] == tag) {
+			cache->ghosts[slot] = 0;
+			return true;
+		}
+		cache->ghosts[slot] = tag;
+		return false;
+
+	default:
+		return true;
+	}
 }
 
 static bool cache_should_store(git_otype object_type, size_t object_size)
 {
 	size_t max_size = git_cache__max_object_size[object_type];
-	return git_cache__enabled && object_size < max_size;
+	return git_cache__enabled && object_size < max_size &&
+		git_cache__admission[object_type] != GIT_CACHE_ADMIT_NEVER;
 }
 
 static void *cache_get(git_cache *cache, const git_oid *oid, unsigned int flags)
@@ -162,6 +285,7 @@ static void *cache_get(git_cache *cache, const git_oid *oid, unsigned int flags)
 		if (flags && entry->flags != flags) {
 			entry = NULL;
 		} else {
+			entry->referenced = 1;
 			git_cached_obj_incref(entry);
 		}
 	}
@@ -188,23 +312,43 @@ static void *cache_store(git_cache *cache, git_cached_obj *entry)
 	if (git_mutex_lock(&cache->lock) < 0)
 		return entry;
 
-	/* soften the load on the cache */
-	if (git_cache__current_storage.val > git_cache__max_storage)
-		cache_evict_entries(cache);
-
 	pos = kh_get(oid, cache->map, &entry->oid);
 
 	/* not found */
 	if (pos == kh_end(cache->map)) {
+		ssize_t budget = git_cache__type_budget[entry->type];
 		int rval;
 
+		if (!cache_admit(cache, entry)) {
+			git_mutex_unlock(&cache->lock);
+			return entry;
+		}
+
+		/* soften the load on the cache */
+		if (git_cache__current_storage.val > git_cache__max_storage)
+			cache_evict_entries(cache, GIT_OBJ_ANY,
+				git_cache__current_storage.val - git_cache__max_storage);
+
+		if (budget > 0 &&
+			cache->used_by_type[entry->type] + (ssize_t)entry->size > budget)
+			cache_evict_entries(cache, (git_otype)entry->type,
+				cache->used_by_type[entry->type] + (ssize_t)entry->size - budget);
+
+		if (clock_append(cache, entry) < 0) {
+			git_mutex_unlock(&cache->lock);
+			return entry;
+		}
+
 		pos = kh_put(oid, cache->map, &entry->oid, &rval);
 		if (rval >= 0) {
 			kh_key(cache->map, pos) = &entry->oid;
 			kh_val(cache->map, pos) = entry;
 			git_cached_obj_incref(entry);
 			cache->used_memory += entry->size;
+			cache->used_by_type[entry->type] += entry->size;
 			git_atomic_ssize_add(&git_cache__current_storage, (ssize_t)entry->size);
+		} else {
+			cache->clock_size--;
 		}
 	}
 	/* found */
@@ -217,6 +361,10 @@ static void *cache_store(git_cache *cache, git_cached_obj *entry)
 			entry = stored_entry;
 		} else if (stored_entry->flags == GIT_CACHE_STORE_RAW &&
 			entry->flags == GIT_CACHE_STORE_PARSED) {
+			entry->clock_slot = stored_entry->clock_slot;
+			entry->referenced = 1;
+			cache->clock[entry->clock_slot] = entry;
+
 			git_cached_obj_decref(stored_entry);
 			git_cached_obj_incref(entry);
 
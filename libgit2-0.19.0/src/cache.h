@@ -20,11 +20,16 @@ enum {
 	GIT_CACHE_STORE_PARSED = 2
 };
 
+#define GIT_CACHE_TYPES 8
+#define GIT_CACHE_GHOSTS 1024
+
 typedef struct {
 	git_oid    oid;
 	int16_t    type;  /* git_otype value */
 	uint16_t   flags; /* GIT_CACHE_STORE value */
 	size_t     size;
+	size_t     clock_slot; /* position in the owning cache's clock ring */
+	int        referenced; /* second chance bit for the clock hand */
 	git_atomic refcount;
 } git_cached_obj;
 
@@ -32,6 +37,16 @@ typedef struct {
 	git_oidmap *map;
 	git_mutex   lock;
 	ssize_t     used_memory;
+	ssize_t     used_by_type[GIT_CACHE_TYPES];
+
+	/* clock (second chance) eviction order */
+	git_cached_obj **clock;
+	size_t      clock_size;
+	size_t      clock_alloc;
+	size_t      clock_hand;
+
+	/* oids refused once under GIT_CACHE_ADMIT_REUSED */
+	uint32_t    ghosts[GIT_CACHE_GHOSTS];
 } git_cache;
 
 extern bool git_cache__enabled;
@@ -39,6 +54,8 @@ extern ssize_t git_cache__max_storage;
 extern git_atomic_ssize git_cache__current_storage;
 
 int git_cache_set_max_object_size(git_otype type, size_t size);
+int git_cache_set_type_budget(git_otype type, ssize_t budget);
+int git_cache_set_admission(git_otype type, int policy);
 
 int git_cache_init(git_cache *cache);
 void git_cache_free(git_cache *cache);
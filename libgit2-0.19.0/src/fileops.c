@@ -652,6 +652,18 @@ int git_futils_dirs_get(const git_buf **out, git_futils_dir_t which)
 	return 0;
 }
 
+int git_futils_dirs_global_init(void)
+{
+	git_futils_dir_t i;
+	const git_buf *path;
+	int error = 0;
+
+	for (i = 0; !error && i < GIT_FUTILS_DIR__MAX; i++)
+		error = git_futils_dirs_get(&path, i);
+
+	return error;
+}
+
 int git_futils_dirs_get_str(char *out, size_t outlen, git_futils_dir_t which)
 {
 	const git_buf *path = NULL;
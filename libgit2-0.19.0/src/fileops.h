@@ -342,6 +342,16 @@ extern int git_futils_dirs_get_str(
  */
 extern int git_futils_dirs_set(git_futils_dir_t which, const char *paths);
 
+/**
+ * Guess all search paths up front
+ *
+ * The paths are otherwise guessed lazily on first use, which is not safe
+ * when several threads open repositories at the same time.
+ *
+ * @return 0 on success, <0 on failure
+ */
+extern int git_futils_dirs_global_init(void);
+
 /**
  * Release / reset all search paths
  */
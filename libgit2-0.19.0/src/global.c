@@ -11,9 +11,20 @@
 #include "git2/threads.h"
 #include "thread-utils.h"
 
+#include <zlib.h>
+
 
 git_mutex git__mwindow_mutex;
 
+static void global_state_clear(git_global_st *st)
+{
+	if (st->inflate_stream != NULL) {
+		inflateEnd(st->inflate_stream);
+		git__free(st->inflate_stream);
+		st->inflate_stream = NULL;
+	}
+}
+
 /**
  * Handle the global state with TLS
  *
@@ -65,7 +76,8 @@ int git_threads_init(void)
 		return -1;
 
 	/* Initialize any other subsystems that have global state */
-	if ((error = git_hash_global_init()) >= 0)
+	if ((error = git_hash_global_init()) >= 0 &&
+		(error = git_futils_dirs_global_init()) >= 0)
 		_tls_init = 1;
 
 	if (error == 0)
@@ -78,6 +90,11 @@ int git_threads_init(void)
 
 void git_threads_shutdown(void)
 {
+	void *ptr = TlsGetValue(_tls_index);
+	if (ptr != NULL) {
+		global_state_clear(ptr);
+		git__free(ptr);
+	}
 	TlsFree(_tls_index);
 	_tls_init = 0;
 	git_mutex_free(&git__mwindow_mutex);
@@ -112,6 +129,7 @@ static int _tls_init = 0;
 
 static void cb__free_status(void *st)
 {
+	global_state_clear(st);
 	git__free(st);
 }
 
@@ -127,7 +145,8 @@ int git_threads_init(void)
 	pthread_key_create(&_tls_key, &cb__free_status);
 
 	/* Initialize any other subsystems that have global state */
-	if ((error = git_hash_global_init()) >= 0)
+	if ((error = git_hash_global_init()) >= 0 &&
+		(error = git_futils_dirs_global_init()) >= 0)
 		_tls_init = 1;
 
 	GIT_MEMORY_BARRIER;
@@ -140,6 +159,8 @@ void git_threads_shutdown(void)
 	if (_tls_init) {
 		void *ptr = pthread_getspecific(_tls_key);
 		pthread_setspecific(_tls_key, NULL);
+		if (ptr != NULL)
+			global_state_clear(ptr);
 		git__free(ptr);
 	}
 
@@ -182,6 +203,8 @@ int git_threads_init(void)
 
 void git_threads_shutdown(void)
 {
+	global_state_clear(&__state);
+
 	/* Shut down any subsystems that have global state */
 	git_hash_global_shutdown();
 	git_futils_dirs_free();
@@ -13,6 +13,8 @@
 typedef struct {
 	git_error *last_error;
 	git_error error_t;
+	/* reused by every small pack object inflated on this thread */
+	struct z_stream_s *inflate_stream;
 } git_global_st;
 
 git_global_st *git__global_state(void);
@@ -0,0 +1,340 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "common.h"
+#include "midx.h"
+#include "filebuf.h"
+#include "fileops.h"
+#include "hash.h"
+#include "pack.h"
+#include "pqueue.h"
+
+#define MIDX_MAGIC "KUPMIDX1"
+#define MIDX_MAGIC_LEN 8
+#define MIDX_RECORD_LEN 32
+#define MIDX_FANOUT_LEN (256 * 4)
+#define MIDX_FOOTER_LEN 8
+
+/* a lock older than this was left behind by a writer that died */
+#define MIDX_STALE_LOCK_SECONDS 3600
+
+static char *midx_cache_dir;
+
+int git_midx__set_cache_dir(const char *path)
+{
+	char *dir = NULL;
+
+	if (path != NULL) {
+		dir = git__strdup(path);
+		GITERR_CHECK_ALLOC(dir);
+	}
+
+	git__free(midx_cache_dir);
+	midx_cache_dir = dir;
+	return 0;
+}
+
+int git_midx__path(git_buf *out, const char *pack_folder)
+{
+	git_oid id;
+	char name[GIT_OID_HEXSZ + 1];
+
+	if (midx_cache_dir == NULL)
+		return GIT_ENOTFOUND;
+
+	if (git_hash_buf(&id, pack_folder, strlen(pack_folder)) < 0)
+		return -1;
+
+	git_oid_tostr(name, sizeof(name), &id);
+	if (git_buf_joinpath(out, midx_cache_dir, name) < 0)
+		return -1;
+
+	return git_buf_puts(out, ".midx");
+}
+
+static uint32_t read_be32(const unsigned char *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+		((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static void write_be32(unsigned char *p, uint32_t value)
+{
+	p[0] = (unsigned char)(value >> 24);
+	p[1] = (unsigned char)(value >> 16);
+	p[2] = (unsigned char)(value >> 8);
+	p[3] = (unsigned char)value;
+}
+
+int git_midx_open(git_midx_file **out, const char *path)
+{
+	git_midx_file *midx;
+	const unsigned char *data, *names, *end;
+	size_t size;
+	uint32_t i, count = 0;
+	int error;
+
+	*out = NULL;
+
+	midx = git__calloc(1, sizeof(git_midx_file));
+	GITERR_CHECK_ALLOC(midx);
+
+	if ((error = git_futils_mmap_ro_file(&midx->map, path)) < 0) {
+		git__free(midx);
+		return error;
+	}
+
+	data = midx->map.data;
+	size = midx->map.len;
+
+	if (size < MIDX_MAGIC_LEN + MIDX_FANOUT_LEN + MIDX_FOOTER_LEN ||
+		memcmp(data, MIDX_MAGIC, MIDX_MAGIC_LEN) != 0)
+		goto invalid;
+
+	midx->num_packs = read_be32(data + size - 8);
+	midx->num_objects = read_be32(data + size - 4);
+
+	if (midx->num_objects > (size - MIDX_MAGIC_LEN - MIDX_FANOUT_LEN -
+			MIDX_FOOTER_LEN) / MIDX_RECORD_LEN)
+		goto invalid;
+
+	midx->records = data + MIDX_MAGIC_LEN;
+	midx->fanout = (const uint32_t *)(midx->records +
+		(size_t)midx->num_objects * MIDX_RECORD_LEN);
+
+	for (i = 0; i < 256; i++) {
+		uint32_t n = ntohl(midx->fanout[i]);
+		if (n < count || n > midx->num_objects)
+			goto invalid;
+		count = n;
+	}
+	if (count != midx->num_objects)
+		goto invalid;
+
+	names = (const unsigned char *)midx->fanout + MIDX_FANOUT_LEN;
+	end = data + size - MIDX_FOOTER_LEN;
+
+	if (midx->num_packs > (size_t)(end - names) / 2)
+		goto invalid;
+
+	midx->pack_names = git__calloc(midx->num_packs + 1, sizeof(char *));
+	if (midx->pack_names == NULL) {
+		git_midx_free(midx);
+		return -1;
+	}
+
+	for (i = 0; i < midx->num_packs; i++) {
+		const unsigned char *nul = memchr(names, '\0', end - names);
+		if (nul == NULL || nul == names)
+			goto invalid;
+		midx->pack_names[i] = (const char *)names;
+		names = nul + 1;
+	}
+	if (names != end)
+		goto invalid;
+
+	*out = midx;
+	return 0;
+
+invalid:
+	giterr_set(GITERR_ODB, "Invalid multi-pack index '%s'", path);
+	git_midx_free(midx);
+	return -1;
+}
+
+void git_midx_free(git_midx_file *midx)
+{
+	if (midx == NULL)
+		return;
+
+	git_futils_mmap_free(&midx->map);
+	git__free(midx->pack_names);
+	git__free(midx);
+}
+
+int git_midx_find(
+	uint32_t *pack_id, git_off_t *offset,
+	const git_midx_file *midx, const git_oid *oid)
+{
+	uint32_t lo, hi;
+	int first = oid->id[0];
+
+	lo = first ? ntohl(midx->fanout[first - 1]) : 0;
+	hi = ntohl(midx->fanout[first]);
+
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		const unsigned char *record = midx->records + (size_t)mid * MIDX_RECORD_LEN;
+		int cmp = memcmp(oid->id, record, GIT_OID_RAWSZ);
+
+		if (!cmp) {
+			*pack_id = read_be32(record + 20);
+			/* records are not checked on open, the file may be corrupt */
+			if (*pack_id >= midx->num_packs) {
+				giterr_set(GITERR_ODB, "Invalid pack id in multi-pack index");
+				return -1;
+			}
+			*offset = (git_off_t)(((uint64_t)read_be32(record + 24) << 32) |
+				read_be32(record + 28));
+			return 0;
+		}
+
+		if (cmp < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	return GIT_ENOTFOUND;
+}
+
+/* Either the old midx or one pack index, walked in oid order */
+typedef struct {
+	const unsigned char *oid;
+	uint32_t pos, count;
+	uint32_t pack_id;
+	struct git_pack_file *pack; /* NULL for the old midx */
+	const git_midx_file *midx;
+} midx_source;
+
+static const unsigned char *midx_source_oid(const midx_source *s)
+{
+	if (s->pack != NULL)
+		return git_pack_nth_oid(s->pack, s->pos)->id;
+	return s->midx->records + (size_t)s->pos * MIDX_RECORD_LEN;
+}
+
+/* the queue pops its greatest element, make that the smallest oid */
+static int midx_source_cmp(void *a, void *b)
+{
+	return memcmp(((midx_source *)a)->oid, ((midx_source *)b)->oid,
+		GIT_OID_RAWSZ) > 0;
+}
+
+static void midx_source_record(unsigned char *record, const midx_source *s)
+{
+	uint64_t offset;
+
+	if (s->pack == NULL) {
+		memcpy(record, s->oid, MIDX_RECORD_LEN);
+		return;
+	}
+
+	offset = (uint64_t)git_pack_nth_offset(s->pack, s->pos);
+	memcpy(record, s->oid, GIT_OID_RAWSZ);
+	write_be32(record + 20, s->pack_id);
+	write_be32(record + 24, (uint32_t)(offset >> 32));
+	write_be32(record + 28, (uint32_t)offset);
+}
+
+static void midx_remove_stale_lock(const char *path)
+{
+	git_buf lock_path = GIT_BUF_INIT;
+	struct stat st;
+
+	if (git_buf_join(&lock_path, 0, path, GIT_FILELOCK_EXTENSION) == 0 &&
+		p_stat(git_buf_cstr(&lock_path), &st) == 0 &&
+		st.st_mtime + MIDX_STALE_LOCK_SECONDS < time(NULL))
+		p_unlink(git_buf_cstr(&lock_path));
+
+	git_buf_free(&lock_path);
+}
+
+int git_midx_write(const char *path, const git_midx_file *old, git_vector *packs)
+{
+	git_filebuf file = GIT_FILEBUF_INIT;
+	git_pqueue queue;
+	midx_source *sources, *s;
+	unsigned char record[MIDX_RECORD_LEN], last[GIT_OID_RAWSZ];
+	unsigned char fanout[MIDX_FANOUT_LEN], footer[MIDX_FOOTER_LEN];
+	uint32_t counts[256] = {0}, num_packs, count = 0, i;
+	size_t nsources = 0;
+	struct git_pack_file *p;
+	int error;
+
+	num_packs = (old ? old->num_packs : 0) + (uint32_t)packs->length;
+
+	sources = git__calloc(packs->length + 1, sizeof(midx_source));
+	GITERR_CHECK_ALLOC(sources);
+
+	if (git_pqueue_init(&queue, packs->length + 1, midx_source_cmp) < 0) {
+		git__free(sources);
+		return -1;
+	}
+
+	midx_remove_stale_lock(path);
+	if ((error = git_filebuf_open(&file, path, 0)) < 0)
+		goto cleanup;
+
+	if (old != NULL && old->num_objects > 0) {
+		s = &sources[nsources++];
+		s->midx = old;
+		s->count = old->num_objects;
+		s->oid = midx_source_oid(s);
+		git_pqueue_insert(&queue, s);
+	}
+
+	git_vector_foreach(packs, i, p) {
+		if ((error = git_pack_index_load(p)) < 0)
+			goto cleanup;
+		if (p->num_objects == 0)
+			continue;
+
+		s = &sources[nsources++];
+		s->pack = p;
+		s->pack_id = (old ? old->num_packs : 0) + i;
+		s->count = p->num_objects;
+		s->oid = midx_source_oid(s);
+		git_pqueue_insert(&queue, s);
+	}
+
+	git_filebuf_write(&file, MIDX_MAGIC, MIDX_MAGIC_LEN);
+
+	while ((s = git_pqueue_pop(&queue)) != NULL) {
+		/* an object in several packs only needs to be found once */
+		if (count == 0 || memcmp(last, s->oid, GIT_OID_RAWSZ) != 0) {
+			midx_source_record(record, s);
+			git_filebuf_write(&file, record, MIDX_RECORD_LEN);
+			memcpy(last, s->oid, GIT_OID_RAWSZ);
+			counts[last[0]]++;
+			count++;
+		}
+
+		if (++s->pos < s->count) {
+			s->oid = midx_source_oid(s);
+			git_pqueue_insert(&queue, s);
+		}
+	}
+
+	for (i = 1; i < 256; i++)
+		counts[i] += counts[i - 1];
+	for (i = 0; i < 256; i++)
+		write_be32(fanout + 4 * i, counts[i]);
+	git_filebuf_write(&file, fanout, MIDX_FANOUT_LEN);
+
+	for (i = 0; old != NULL && i < old->num_packs; i++)
+		git_filebuf_write(&file, old->pack_names[i], strlen(old->pack_names[i]) + 1);
+
+	git_vector_foreach(packs, i, p) {
+		const char *name = strrchr(p->pack_name, '/');
+		name = name ? name + 1 : p->pack_name;
+		git_filebuf_write(&file, name, strlen(name) + 1);
+	}
+
+	write_be32(footer, num_packs);
+	write_be32(footer + 4, count);
+	git_filebuf_write(&file, footer, MIDX_FOOTER_LEN);
+
+	error = git_filebuf_commit(&file, GIT_PACK_FILE_MODE);
+
+cleanup:
+	if (error < 0)
+		git_filebuf_cleanup(&file);
+	git_pqueue_free(&queue);
+	git__free(sources);
+	return error;
+}
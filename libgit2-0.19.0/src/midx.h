@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#ifndef INCLUDE_midx_h__
+#define INCLUDE_midx_h__
+
+#include "git2/oid.h"
+
+#include "common.h"
+#include "buffer.h"
+#include "map.h"
+#include "vector.h"
+
+/*
+ * A merged index of all objects in a pack folder, kept outside of the
+ * repository in a cache folder set with GIT_OPT_SET_MIDX_CACHE_DIR.
+ * It is not git's multi-pack-index format. The file is mapped and
+ * holds, in this order:
+ *
+ *	"KUPMIDX1"
+ *	one 32 byte record per object, sorted by oid: the raw oid, then the
+ *	  pack id as a network order uint32 and the offset as two of them
+ *	256 cumulative object counts by first oid byte, like a pack index
+ *	the pack file names, NUL terminated, in pack id order
+ *	the number of packs and the number of objects
+ */
+typedef struct {
+	git_map map;
+	uint32_t num_packs;
+	uint32_t num_objects;
+	const unsigned char *records;
+	const uint32_t *fanout;
+	const char **pack_names;
+} git_midx_file;
+
+int git_midx__set_cache_dir(const char *path);
+
+/* Path of the midx for a pack folder, GIT_ENOTFOUND if there is no cache dir */
+int git_midx__path(git_buf *out, const char *pack_folder);
+
+int git_midx_open(git_midx_file **out, const char *path);
+void git_midx_free(git_midx_file *midx);
+
+/* GIT_ENOTFOUND if the oid is not in it, -1 for a corrupt record */
+int git_midx_find(
+	uint32_t *pack_id, git_off_t *offset,
+	const git_midx_file *midx, const git_oid *oid);
+
+/*
+ * Write a midx holding the objects of `old` (may be NULL) and of the
+ * `git_pack_file`s in `packs`. New packs get the ids following the old.
+ */
+int git_midx_write(const char *path, const git_midx_file *old, git_vector *packs);
+
+#endif
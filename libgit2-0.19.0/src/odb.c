@@ -695,7 +695,16 @@ int git_odb__read_header_or_object(
 	return 0;
 }
 
-int git_odb_read(git_odb_object **out, git_odb *db, const git_oid *id)
+static git_odb_read_trace_cb odb_read_trace;
+static void *odb_read_trace_payload;
+
+void git_odb__set_read_trace(git_odb_read_trace_cb cb, void *payload)
+{
+	odb_read_trace_payload = payload;
+	odb_read_trace = cb;
+}
+
+static int odb_read_backends(git_odb_object **out, git_odb *db, const git_oid *id)
 {
 	size_t i, reads = 0;
 	int error;
@@ -703,12 +712,6 @@ int git_odb_read(git_odb_object **out, git_odb *db, const git_oid *id)
 	git_rawobj raw;
 	git_odb_object *object;
 
-	assert(out && db && id);
-
-	*out = git_cache_get_raw(odb_cache(db), id);
-	if (*out != NULL)
-		return 0;
-
 attempt_lookup:
 	error = GIT_ENOTFOUND;
 
@@ -743,6 +746,27 @@ attempt_lookup:
 	return 0;
 }
 
+int git_odb_read(git_odb_object **out, git_odb *db, const git_oid *id)
+{
+	git_odb_read_trace_cb trace = odb_read_trace;
+	int error;
+
+	assert(out && db && id);
+
+	*out = git_cache_get_raw(odb_cache(db), id);
+	if (*out != NULL)
+		return 0;
+
+	if (trace == NULL)
+		return odb_read_backends(out, db, id);
+
+	trace(id, 0, odb_read_trace_payload);
+	error = odb_read_backends(out, db, id);
+	trace(id, 1, odb_read_trace_payload);
+
+	return error;
+}
+
 int git_odb_read_prefix(
 	git_odb_object **out, git_odb *db, const git_oid *short_id, size_t len)
 {
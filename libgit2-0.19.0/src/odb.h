@@ -96,6 +96,9 @@ int git_odb__read_header_or_object(
 	git_odb_object **out, size_t *len_p, git_otype *type_p,
 	git_odb *db, const git_oid *id);
 
+/* set the callback that brackets reads which miss the cache */
+void git_odb__set_read_trace(git_odb_read_trace_cb cb, void *payload);
+
 /* fully free the object; internal method, DO NOT EXPORT */
 void git_odb_object__free(void *object);
 
@@ -7,6 +7,9 @@
 
 #include "common.h"
 #include <zlib.h>
+#ifndef GIT_WIN32
+#include <sys/time.h>
+#endif
 #include "git2/repository.h"
 #include "git2/indexer.h"
 #include "git2/sys/odb_backend.h"
@@ -15,16 +18,41 @@
 #include "odb.h"
 #include "delta-apply.h"
 #include "sha1_lookup.h"
+#include "midx.h"
 #include "mwindow.h"
 #include "pack.h"
+#include "strmap.h"
 
 #include "git2/odb_backend.h"
 
+GIT__USE_STRMAP;
+
+/*
+ * Object misses refresh the pack list. When the folder looks unchanged but
+ * was scanned in the second of its mtime, don't rescan it more often.
+ */
+#define GIT_PACK_REFRESH_INTERVAL_MS 250
+
+/* Rewrite the midx once this many packs are missing from it */
+#define GIT_PACK_MIDX_MIN_NEW_PACKS 16
+
 struct pack_backend {
 	git_odb_backend parent;
 	git_vector packs;
+	git_strmap *pack_names; /* pack_name of every loaded pack */
 	struct git_pack_file *last_found;
 	char *pack_folder;
+
+	/* merged index of the packs that have `in_midx` set, if any */
+	git_midx_file *midx;
+	struct git_pack_file **midx_packs; /* by pack id */
+
+	/* state of the pack folder when it was last scanned */
+	time_t folder_mtime;
+	ino_t folder_ino;
+	git_off_t folder_size;
+	unsigned folder_scanned:1;
+	unsigned long refreshed_ms;
 };
 
 struct pack_writepack {
@@ -59,9 +87,10 @@ struct pack_writepack {
  *	 |-# packfile_load__cb
  *	 | | This callback is called from `dirent` with every single file
  *	 | | inside the pack folder. We find the packs by actually locating
- *	 | | their index (ends in ".idx"). From that index, we verify that
- *	 | | the corresponding packfile exists and is valid, and if so, we
- *	| | add it to the pack list.
+ *	 | | their index (ends in ".idx"). Packs that are already loaded are
+ *	 | | skipped by looking them up in `pack_names`. From a new index, we
+ *	 | | verify that the corresponding packfile exists and is valid, and
+ *	| | if so, we add it to the pack list.
  *	 | |
  *	 | |-# packfile_check
  *	 |		Make sure that there's a packfile to back this index, and store
@@ -86,9 +115,10 @@ struct pack_writepack {
  * | that have been loaded for our ODB.
  * |
  * |-# pack_entry_find
- *	| Iterate through all the packs that have been preloaded
- *	| (starting by the pack where the latest object was found)
- *	| to try to find the OID in one of them.
+ *	| Look the OID up in the midx, if the backend has one. Then
+ *	| iterate through all the preloaded packs that the midx does
+ *	| not cover (starting by the pack where the latest object was
+ *	| found) to try to find the OID in one of them.
  *	|
  *	|-# pack_entry_find1
  *		| Check the index of an individual pack to see if the SHA1
@@ -140,6 +170,8 @@ static int packfile_load__cb(void *_data, git_buf *path);
 static int pack_entry_find(struct git_pack_entry *e,
 	struct pack_backend *backend, const git_oid *oid);
 
+static void pack_backend__drop_midx(struct pack_backend *backend);
+
 /* Can find the offset of an object given
  * a prefix of an identifier.
  * Sets GIT_EAMBIGUOUS if short oid is ambiguous.
@@ -195,17 +227,20 @@ static int packfile_load__cb(void *_data, git_buf *path)
 {
 	struct pack_backend *backend = (struct pack_backend *)_data;
 	struct git_pack_file *pack;
-	int error;
-	size_t i;
+	git_buf pack_name = GIT_BUF_INIT;
+	int error, loaded;
 
 	if (git__suffixcmp(path->ptr, ".idx") != 0)
 		return 0; /* not an index */
 
-	for (i = 0; i < backend->packs.length; ++i) {
-		struct git_pack_file *p = git_vector_get(&backend->packs, i);
-		if (memcmp(p->pack_name, git_buf_cstr(path), git_buf_len(path) - strlen(".idx")) == 0)
-			return 0;
-	}
+	if (git_buf_put(&pack_name, path->ptr, git_buf_len(path) - strlen(".idx")) < 0 ||
+		git_buf_puts(&pack_name, ".pack") < 0)
+		return -1;
+
+	loaded = git_strmap_exists(backend->pack_names, git_buf_cstr(&pack_name));
+	git_buf_free(&pack_name);
+	if (loaded)
+		return 0;
 
 	error = git_packfile_alloc(&pack, path->ptr);
 	if (error == GIT_ENOTFOUND)
@@ -214,7 +249,13 @@ static int packfile_load__cb(void *_data, git_buf *path)
 	else if (error < 0)
 		return error;
 
-	return git_vector_insert(&backend->packs, pack);
+	if (git_vector_insert(&backend->packs, pack) < 0) {
+		git_packfile_free(pack);
+		return -1;
+	}
+
+	git_strmap_insert(backend->pack_names, pack->pack_name, pack, error);
+	return error < 0 ? -1 : 0;
 }
 
 static int pack_entry_find_inner(
@@ -233,7 +274,7 @@ static int pack_entry_find_inner(
 		struct git_pack_file *p;
 
 		p = git_vector_get(&backend->packs, i);
-		if (p == last_found)
+		if (p == last_found || p->in_midx)
 			continue;
 
 		if (git_pack_entry_find(e, p, oid, GIT_OID_HEXSZ) == 0) {
@@ -249,10 +290,26 @@ static int pack_entry_find(struct git_pack_entry *e, struct pack_backend *backen
 {
 	struct git_pack_file *last_found = backend->last_found;
 
+	uint32_t pack_id;
+	git_off_t offset;
+	int error;
+
 	if (backend->last_found &&
 		git_pack_entry_find(e, backend->last_found, oid, GIT_OID_HEXSZ) == 0)
 		return 0;
 
+	if (backend->midx != NULL) {
+		error = git_midx_find(&pack_id, &offset, backend->midx, oid);
+		if (error == 0 &&
+			git_pack_entry_at(e, backend->midx_packs[pack_id], oid, offset) == 0) {
+			backend->last_found = e->p;
+			return 0;
+		}
+		/* a corrupt midx: every pack is searched one by one below */
+		if (error < 0 && error != GIT_ENOTFOUND)
+			pack_backend__drop_midx(backend);
+	}
+
 	if (!pack_entry_find_inner(e, backend, oid, last_found))
 		return 0;
 
@@ -323,23 +380,161 @@ static int pack_entry_find_prefix(
  * Implement the git_odb_backend API calls
  *
  ***********************************************************/
+static void pack_backend__unload_midx(struct pack_backend *backend)
+{
+	size_t i;
+
+	for (i = 0; i < backend->packs.length; ++i) {
+		struct git_pack_file *p = git_vector_get(&backend->packs, i);
+		p->in_midx = 0;
+	}
+
+	git_midx_free(backend->midx);
+	backend->midx = NULL;
+	git__free(backend->midx_packs);
+	backend->midx_packs = NULL;
+}
+
+/*
+ * Stop using a midx found to be corrupt and remove it from the cache
+ * folder, the next refresh writes a new one from the pack indexes.
+ */
+static void pack_backend__drop_midx(struct pack_backend *backend)
+{
+	git_buf path = GIT_BUF_INIT;
+
+	pack_backend__unload_midx(backend);
+
+	if (git_midx__path(&path, backend->pack_folder) == 0)
+		p_unlink(git_buf_cstr(&path));
+
+	giterr_clear();
+	git_buf_free(&path);
+}
+
+/*
+ * Map the midx at `path` to the loaded packs. Returns how many of its
+ * packs are gone; the midx is not used then, as it would hide objects.
+ */
+static uint32_t pack_backend__load_midx(struct pack_backend *backend, const char *path)
+{
+	git_buf pack_path = GIT_BUF_INIT;
+	uint32_t i, missing = 0;
+	khiter_t pos;
+
+	if (git_midx_open(&backend->midx, path) < 0)
+		return 0;
+
+	backend->midx_packs = git__calloc(
+		backend->midx->num_packs + 1, sizeof(struct git_pack_file *));
+	if (backend->midx_packs == NULL) {
+		pack_backend__unload_midx(backend);
+		return 0;
+	}
+
+	for (i = 0; i < backend->midx->num_packs; ++i) {
+		if (git_buf_joinpath(&pack_path, backend->pack_folder,
+				backend->midx->pack_names[i]) < 0)
+			break;
+
+		pos = git_strmap_lookup_index(backend->pack_names, git_buf_cstr(&pack_path));
+		if (git_strmap_valid_index(backend->pack_names, pos)) {
+			struct git_pack_file *p = git_strmap_value_at(backend->pack_names, pos);
+			p->in_midx = 1;
+			backend->midx_packs[i] = p;
+		} else {
+			missing++;
+		}
+	}
+
+	git_buf_free(&pack_path);
+
+	if (missing > 0 || i < backend->midx->num_packs)
+		pack_backend__unload_midx(backend);
+
+	return missing;
+}
+
+/*
+ * Bring the midx in the cache folder up to date with the loaded packs.
+ * A few packs that are not in it yet get searched one by one; it is
+ * rewritten once there are more of them, or from scratch when packs
+ * it lists are gone.
+ */
+static void pack_backend__update_midx(struct pack_backend *backend)
+{
+	git_buf path = GIT_BUF_INIT;
+	git_vector new_packs = GIT_VECTOR_INIT;
+	uint32_t missing = 0;
+	size_t i;
+
+	if (git_midx__path(&path, backend->pack_folder) < 0)
+		goto done;
+
+	if (backend->midx == NULL)
+		missing = pack_backend__load_midx(backend, git_buf_cstr(&path));
+
+	for (i = 0; i < backend->packs.length; ++i) {
+		struct git_pack_file *p = git_vector_get(&backend->packs, i);
+		if (!p->in_midx && git_vector_insert(&new_packs, p) < 0)
+			goto done;
+	}
+
+	if (new_packs.length >= GIT_PACK_MIDX_MIN_NEW_PACKS ||
+		(missing > 0 && new_packs.length > 0)) {
+		if (git_midx_write(git_buf_cstr(&path), backend->midx, &new_packs) == 0) {
+			pack_backend__unload_midx(backend);
+			pack_backend__load_midx(backend, git_buf_cstr(&path));
+		}
+	}
+
+done:
+	/* the midx is only a cache, failing to use it is not an error */
+	giterr_clear();
+	git_vector_free(&new_packs);
+	git_buf_free(&path);
+}
+
 static int pack_backend__refresh(git_odb_backend *_backend)
 {
 	struct pack_backend *backend = (struct pack_backend *)_backend;
 
-	int error;
+	int error, unchanged;
 	struct stat st;
+	struct timeval now;
+	unsigned long now_ms;
+	size_t pack_count = backend->packs.length;
 	git_buf path = GIT_BUF_INIT;
 
 	if (backend->pack_folder == NULL)
 		return 0;
 
+	/*
+	 * Always stat, it is cheap. A pack written just before its ref is
+	 * updated must be found by the first miss after that.
+	 */
 	if (p_stat(backend->pack_folder, &st) < 0 || !S_ISDIR(st.st_mode))
 		return git_odb__error_notfound("failed to refresh packfiles", NULL);
 
+	/* adding or removing a file updates the folder's mtime */
+	unchanged = backend->folder_mtime == st.st_mtime &&
+		backend->folder_ino == st.st_ino &&
+		backend->folder_size == (git_off_t)st.st_size;
+	if (unchanged && backend->folder_scanned)
+		return 0;
+
+	/* a changed folder is always scanned, only the uncertain case is limited */
+	p_gettimeofday(&now, NULL);
+	now_ms = (unsigned long)now.tv_sec * 1000 + now.tv_usec / 1000;
+	if (unchanged && backend->refreshed_ms != 0 &&
+		now_ms - backend->refreshed_ms < GIT_PACK_REFRESH_INTERVAL_MS)
+		return 0;
+
+	backend->refreshed_ms = now_ms;
+
 	git_buf_sets(&path, backend->pack_folder);
 
-	/* reload all packs */
+	/* load the packs we don't know yet */
 	error = git_path_direach(&path, packfile_load__cb, (void *)backend);
 
 	git_buf_free(&path);
@@ -347,7 +542,20 @@ static int pack_backend__refresh(git_odb_backend *_backend)
 	if (error < 0)
 		return error;
 
-	git_vector_sort(&backend->packs);
+	backend->folder_mtime = st.st_mtime;
+	backend->folder_ino = st.st_ino;
+	backend->folder_size = (git_off_t)st.st_size;
+	/*
+	 * The mtime only has a resolution of a second. A pack added in
+	 * the second we scanned in might not change it, so only trust the
+	 * folder to be unchanged once that second has passed.
+	 */
+	backend->folder_scanned = st.st_mtime < now.tv_sec;
+
+	if (backend->packs.length != pack_count)
+		git_vector_sort(&backend->packs);
+
+	pack_backend__update_midx(backend);
 	return 0;
 }
 
@@ -536,7 +744,10 @@ static void pack_backend__free(git_odb_backend *_backend)
 		git_packfile_free(p);
 	}
 
+	git_midx_free(backend->midx);
+	git__free(backend->midx_packs);
 	git_vector_free(&backend->packs);
+	git_strmap_free(backend->pack_names);
 	git__free(backend->pack_folder);
 	git__free(backend);
 }
@@ -551,6 +762,13 @@ static int pack_backend__alloc(struct pack_backend **out, size_t initial_size)
 		return -1;
 	}
 
+	backend->pack_names = git_strmap_alloc();
+	if (backend->pack_names == NULL) {
+		git_vector_free(&backend->packs);
+		git__free(backend);
+		return -1;
+	}
+
 	backend->parent.version = GIT_ODB_BACKEND_VERSION;
 
 	backend->parent.read = &pack_backend__read;
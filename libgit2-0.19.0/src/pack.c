@@ -13,6 +13,7 @@
 #include "mwindow.h"
 #include "fileops.h"
 #include "oid.h"
+#include "global.h"
 
 #include <zlib.h>
 
@@ -678,6 +679,90 @@ void git_packfile_stream_free(git_packfile_stream *obj)
 	inflateEnd(&obj->zstream);
 }
 
+/*
+ * The calling thread's inflate state, reset and ready for a new object,
+ * or NULL if it could not be set up.
+ */
+static z_stream *packfile_thread_stream(void)
+{
+	git_global_st *global = GIT_GLOBAL;
+	z_stream *stream;
+
+	if (global == NULL)
+		return NULL;
+
+	if (global->inflate_stream != NULL) {
+		if (inflateReset(global->inflate_stream) != Z_OK)
+			return NULL;
+		return global->inflate_stream;
+	}
+
+	stream = git__calloc(1, sizeof(z_stream));
+	if (stream == NULL) {
+		giterr_clear();
+		return NULL;
+	}
+
+	stream->zalloc = use_git_alloc;
+	stream->zfree = use_git_free;
+	if (inflateInit(stream) != Z_OK) {
+		git__free(stream);
+		return NULL;
+	}
+
+	global->inflate_stream = stream;
+	return stream;
+}
+
+/*
+ * Inflate an object whose compressed data lies entirely in the window
+ * at `curpos` with a single Z_FINISH call, reusing the thread's inflate
+ * state. Setting up and tearing down a z_stream costs about as much as
+ * inflating one of bup's small chunks or trees.
+ *
+ * Returns GIT_PASSTHROUGH when the fast path does not apply and the
+ * object has to be inflated window by window.
+ */
+static int packfile_unpack_oneshot(
+	unsigned char *buffer,
+	struct git_pack_file *p,
+	git_mwindow **w_curs,
+	git_off_t *curpos,
+	size_t size)
+{
+	int st;
+	unsigned int avail_in;
+	unsigned char *in;
+	z_stream *stream = packfile_thread_stream();
+
+	if (stream == NULL)
+		return GIT_PASSTHROUGH;
+
+	in = pack_window_open(p, w_curs, *curpos, &avail_in);
+	if (in == NULL)
+		return GIT_PASSTHROUGH;
+
+	stream->next_in = in;
+	stream->avail_in = avail_in;
+	stream->next_out = buffer;
+	stream->avail_out = (uInt)size + 1;
+
+	st = inflate(stream, Z_FINISH);
+	git_mwindow_close(w_curs);
+
+	if (st == Z_STREAM_END && stream->total_out == size) {
+		*curpos += stream->next_in - in;
+		return 0;
+	}
+
+	/* the stream continues past the end of this window */
+	if ((st == Z_OK || st == Z_BUF_ERROR) && stream->avail_out)
+		return GIT_PASSTHROUGH;
+
+	giterr_set(GITERR_ZLIB, "Failed to inflate packfile");
+	return -1;
+}
+
 int packfile_unpack_compressed(
 	git_rawobj *obj,
 	struct git_pack_file *p,
@@ -690,8 +775,23 @@ int packfile_unpack_compressed(
 	z_stream stream;
 	unsigned char *buffer, *in;
 
-	buffer = git__calloc(1, size + 1);
+	/* every byte but the terminator is written by inflate */
+	buffer = git__malloc(size + 1);
 	GITERR_CHECK_ALLOC(buffer);
+	buffer[size] = '\0';
+
+	st = packfile_unpack_oneshot(buffer, p, w_curs, curpos, size);
+	if (st != GIT_PASSTHROUGH) {
+		if (st < 0) {
+			git__free(buffer);
+			return st;
+		}
+
+		obj->type = type;
+		obj->len = size;
+		obj->data = buffer;
+		return 0;
+	}
 
 	memset(&stream, 0, sizeof(stream));
 	stream.next_out = buffer;
@@ -996,6 +1096,25 @@ static git_off_t nth_packed_object_offset(const struct git_pack_file *p, uint32_
 	}
 }
 
+int git_pack_index_load(struct git_pack_file *p)
+{
+	return pack_index_open(p);
+}
+
+const git_oid *git_pack_nth_oid(const struct git_pack_file *p, uint32_t n)
+{
+	const unsigned char *index = p->index_map.data;
+	index += 4 * 256;
+	if (p->index_version == 1)
+		return (const git_oid *)(index + 24 * n + 4);
+	return (const git_oid *)(index + 8 + 20 * n);
+}
+
+git_off_t git_pack_nth_offset(const struct git_pack_file *p, uint32_t n)
+{
+	return nth_packed_object_offset(p, n);
+}
+
 static int git__memcmp4(const void *a, const void *b) {
 	return memcmp(a, b, 4);
 }
@@ -1190,3 +1309,27 @@ int git_pack_entry_find(
 	git_oid_cpy(&e->sha1, &found_oid);
 	return 0;
 }
+
+int git_pack_entry_at(
+		struct git_pack_entry *e,
+		struct git_pack_file *p,
+		const git_oid *oid,
+		git_off_t offset)
+{
+	unsigned i;
+	int error;
+
+	for (i = 0; i < p->num_bad_objects; i++)
+		if (git_oid__cmp(oid, &p->bad_object_sha1[i]) == 0)
+			return packfile_error("bad object found in packfile");
+
+	/* make sure the packfile still exists on disk */
+	if (p->mwf.fd == -1 && (error = packfile_open(p)) < 0)
+		return error;
+
+	e->offset = offset;
+	e->p = p;
+
+	git_oid_cpy(&e->sha1, oid);
+	return 0;
+}
@@ -88,6 +88,7 @@ struct git_pack_file {
 	int index_version;
 	git_time_t mtime;
 	unsigned pack_local:1, pack_keep:1, has_cache:1;
+	unsigned in_midx:1; /* all objects are listed in the backend's midx */
 	git_oid sha1;
 	git_oidmap *idx_cache;
 	git_oid **oids;
@@ -155,4 +156,16 @@ int git_pack_foreach_entry(
 		git_odb_foreach_cb cb,
 		void *data);
 
+/* Fill in an entry whose offset is already known, e.g. from a midx */
+int git_pack_entry_at(
+		struct git_pack_entry *e,
+		struct git_pack_file *p,
+		const git_oid *oid,
+		git_off_t offset);
+
+/* Access to the index in oid order, for building a midx */
+int git_pack_index_load(struct git_pack_file *p);
+const git_oid *git_pack_nth_oid(const struct git_pack_file *p, uint32_t n);
+git_off_t git_pack_nth_offset(const struct git_pack_file *p, uint32_t n);
+
 #endif
@@ -12,6 +12,8 @@
 #include "posix.h"
 #include "fileops.h"
 #include "cache.h"
+#include "odb.h"
+#include "midx.h"
 
 #ifdef _MSC_VER
 # include <Shlwapi.h>
@@ -114,6 +116,34 @@ int git_libgit2_opts(int key, ...)
 		*(va_arg(ap, ssize_t *)) = git_cache__current_storage.val;
 		*(va_arg(ap, ssize_t *)) = git_cache__max_storage;
 		break;
+
+	case GIT_OPT_SET_CACHE_TYPE_BUDGET:
+		{
+			git_otype type = (git_otype)va_arg(ap, int);
+			ssize_t budget = va_arg(ap, ssize_t);
+			error = git_cache_set_type_budget(type, budget);
+			break;
+		}
+
+	case GIT_OPT_SET_CACHE_ADMISSION:
+		{
+			git_otype type = (git_otype)va_arg(ap, int);
+			int policy = va_arg(ap, int);
+			error = git_cache_set_admission(type, policy);
+			break;
+		}
+
+	case GIT_OPT_SET_ODB_READ_TRACE:
+		{
+			git_odb_read_trace_cb cb = va_arg(ap, git_odb_read_trace_cb);
+			void *payload = va_arg(ap, void *);
+			git_odb__set_read_trace(cb, payload);
+			break;
+		}
+
+	case GIT_OPT_SET_MIDX_CACHE_DIR:
+		error = git_midx__set_cache_dir(va_arg(ap, const char *));
+		break;
 	}
 
 	va_end(ap);
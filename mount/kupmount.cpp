@@ -0,0 +1,385 @@
+/***************************************************************************
+ *   Copyright Simon Persson                                               *
+ *   simonpersson1@gmail.com                                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+// Read-only FUSE filesystem showing a bup repository the same way as the
+// bup:// kioslave: branches at the top, one folder per snapshot below.
+
+#define FUSE_USE_VERSION 26
+
+#include "bupvfs.h"
+#include "kuptrace.h"
+
+#include <QCoreApplication>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QQueue>
+#include <QThread>
+#include <QVector>
+#include <QWaitCondition>
+
+#include <atomic>
+#include <errno.h>
+#include <fcntl.h>
+#include <functional>
+#include <fuse.h>
+#include <stdio.h>
+#include <string.h>
+
+// libgit2 handles can't be shared between threads, so requests are spread
+// over a few independent node trees, each with its own repository handle.
+// Nodes are QObjects and Qt refuses parents living on another thread, while
+// fuse starts and stops its worker threads as it likes. Every tree is
+// therefore created, used and deleted by one long-lived thread of its own and
+// the fuse threads hand their requests over to it.
+class RepositorySlot: public QThread {
+public:
+	RepositorySlot();
+	// Runs pJob on the slot's thread and waits for it to finish.
+	void call(const std::function<void (Repository *)> &pJob);
+	// Finishes the queued jobs, deletes the tree and ends the thread.
+	void stop();
+
+protected:
+	virtual void run();
+
+	struct Job {
+		std::function<void (Repository *)> mFunction;
+		bool mDone;
+	};
+	QMutex mMutex;
+	QWaitCondition mJobQueued;
+	QWaitCondition mJobDone;
+	QQueue<Job *> mJobs;
+	bool mStopping;
+};
+
+// Open files are kept by path, the node itself may be trimmed away between
+// two reads and is then resolved again.
+struct OpenFile {
+	RepositorySlot *mSlot;
+	QByteArray mPath;
+};
+
+// Shared by all the slots, a tree only gets its part of it.
+#define MOUNT_NODE_MEMORY_BUDGET (256 * 1024 * 1024)
+
+static QString sRepositoryPath;
+static QVector<RepositorySlot *> sSlots;
+static std::atomic<int> sNextSlot(0);
+
+RepositorySlot::RepositorySlot() {
+	mStopping = false;
+}
+
+void RepositorySlot::call(const std::function<void (Repository *)> &pJob) {
+	Job lJob;
+	lJob.mFunction = pJob;
+	lJob.mDone = false;
+	QMutexLocker lLock(&mMutex);
+	mJobs.enqueue(&lJob);
+	mJobQueued.wakeOne();
+	while(!lJob.mDone) {
+		mJobDone.wait(&mMutex);
+	}
+}
+
+void RepositorySlot::stop() {
+	mMutex.lock();
+	mStopping = true;
+	mJobQueued.wakeOne();
+	mMutex.unlock();
+	wait();
+}
+
+void RepositorySlot::run() {
+	// created here, so that this thread owns every node of the tree.
+	Repository *lRepository = new Repository(nullptr, sRepositoryPath);
+	if(lRepository->isValid()) {
+		lRepository->setMemoryBudget(MOUNT_NODE_MEMORY_BUDGET / static_cast<quint64>(sSlots.count()));
+	}
+	QMutexLocker lLock(&mMutex);
+	forever {
+		while(mJobs.isEmpty() && !mStopping) {
+			mJobQueued.wait(&mMutex);
+		}
+		if(mJobs.isEmpty()) {
+			break;
+		}
+		Job *lJob = mJobs.dequeue();
+		lLock.unlock();
+		lJob->mFunction(lRepository);
+		// jobs keep no node pointers once done, so the whole tree may be trimmed.
+		lRepository->trimMemory(nullptr);
+		lLock.relock();
+		lJob->mDone = true;
+		mJobDone.wakeAll();
+	}
+	lLock.unlock();
+	delete lRepository;
+}
+
+static RepositorySlot *threadSlot() {
+	static thread_local int sSlotIndex = sNextSlot++ % sSlots.count();
+	return sSlots.at(sSlotIndex);
+}
+
+// Must be called on the slot's thread.
+static Node *resolveNode(Repository *pRepository, const char *pPath) {
+	if(!pRepository->isValid()) {
+		return nullptr;
+	}
+	return pRepository->resolve(QFile::decodeName(pPath).split(QLatin1Char('/'), QString::SkipEmptyParts));
+}
+
+static void fillStat(Node *pNode, struct stat *pStat) {
+	memset(pStat, 0, sizeof(struct stat));
+	pStat->st_mode = static_cast<mode_t>(pNode->mMode);
+	pStat->st_uid = static_cast<uid_t>(pNode->mUid);
+	pStat->st_gid = static_cast<gid_t>(pNode->mGid);
+	pStat->st_atime = pNode->mAtime;
+	pStat->st_mtime = pNode->mMtime;
+	pStat->st_ctime = pNode->mMtime;
+	if(S_ISDIR(pNode->mMode)) {
+		pStat->st_nlink = 2;
+	} else {
+		pStat->st_nlink = 1;
+		if(!pNode->mSymlinkTarget.isEmpty()) {
+			pStat->st_size = QFile::encodeName(pNode->mSymlinkTarget).size();
+		} else {
+			File *lFile = qobject_cast<File *>(pNode);
+			if(lFile != nullptr) {
+				pStat->st_size = static_cast<off_t>(lFile->size());
+			}
+		}
+	}
+	pStat->st_blksize = 64 * 1024;
+	pStat->st_blocks = (pStat->st_size + 511) / 512;
+}
+
+static int kupGetattr(const char *pPath, struct stat *pStat) {
+	int lRetVal = -ENOENT;
+	threadSlot()->call([&](Repository *pRepository) {
+		Node *lNode = resolveNode(pRepository, pPath);
+		if(lNode != nullptr) {
+			fillStat(lNode, pStat);
+			lRetVal = 0;
+		}
+	});
+	return lRetVal;
+}
+
+static int kupReadlink(const char *pPath, char *pBuffer, size_t pSize) {
+	int lRetVal = 0;
+	threadSlot()->call([&](Repository *pRepository) {
+		Node *lNode = resolveNode(pRepository, pPath);
+		if(lNode == nullptr) {
+			lRetVal = -ENOENT;
+			return;
+		}
+		if(lNode->mSymlinkTarget.isEmpty()) {
+			lRetVal = -EINVAL;
+			return;
+		}
+		const QByteArray lTarget = QFile::encodeName(lNode->mSymlinkTarget);
+		const size_t lLength = qMin(pSize - 1, static_cast<size_t>(lTarget.size()));
+		memcpy(pBuffer, lTarget.constData(), lLength);
+		pBuffer[lLength] = '\0';
+	});
+	return lRetVal;
+}
+
+static int kupReaddir(const char *pPath, void *pBuffer, fuse_fill_dir_t pFiller, off_t pOffset,
+                      struct fuse_file_info *pInfo) {
+	Q_UNUSED(pOffset)
+	Q_UNUSED(pInfo)
+	int lRetVal = 0;
+	threadSlot()->call([&](Repository *pRepository) {
+		Directory *lDir = qobject_cast<Directory *>(resolveNode(pRepository, pPath));
+		if(lDir == nullptr) {
+			lRetVal = -ENOTDIR;
+			return;
+		}
+		// a branch gets new snapshots while mounted.
+		lDir->reload();
+
+		pFiller(pBuffer, ".", nullptr, 0);
+		pFiller(pBuffer, "..", nullptr, 0);
+		NodeMapIterator i(lDir->subNodes());
+		while(i.hasNext()) {
+			Node *lNode = i.next().value();
+			struct stat lStat;
+			memset(&lStat, 0, sizeof(lStat));
+			lStat.st_mode = static_cast<mode_t>(lNode->mMode);
+			if(pFiller(pBuffer, QFile::encodeName(lNode->objectName()).constData(), &lStat, 0) != 0) {
+				break;
+			}
+		}
+	});
+	return lRetVal;
+}
+
+static int kupOpen(const char *pPath, struct fuse_file_info *pInfo) {
+	if((pInfo->flags & O_ACCMODE) != O_RDONLY) {
+		return -EROFS;
+	}
+	RepositorySlot *lSlot = threadSlot();
+	int lRetVal = 0;
+	lSlot->call([&](Repository *pRepository) {
+		Node *lNode = resolveNode(pRepository, pPath);
+		if(lNode == nullptr) {
+			lRetVal = -ENOENT;
+		} else if(qobject_cast<File *>(lNode) == nullptr) {
+			lRetVal = -EISDIR;
+		}
+	});
+	if(lRetVal != 0) {
+		return lRetVal;
+	}
+	OpenFile *lOpenFile = new OpenFile;
+	lOpenFile->mSlot = lSlot;
+	lOpenFile->mPath = QByteArray(pPath);
+	pInfo->fh = reinterpret_cast<quintptr>(lOpenFile);
+	// snapshots never change, the kernel may keep cached pages between opens.
+	pInfo->keep_cache = 1;
+	return 0;
+}
+
+static int kupRead(const char *pPath, char *pBuffer, size_t pSize, off_t pOffset, struct fuse_file_info *pInfo) {
+	Q_UNUSED(pPath)
+	TraceSpan lSpan("kupRead", "mount");
+	OpenFile *lOpenFile = reinterpret_cast<OpenFile *>(pInfo->fh);
+	int lRetVal = 0;
+	// the file node is shared by everything using the same tree, seek and
+	// read must happen in the same job.
+	lOpenFile->mSlot->call([&](Repository *pRepository) {
+		File *lFile = qobject_cast<File *>(resolveNode(pRepository, lOpenFile->mPath.constData()));
+		if(lFile == nullptr) {
+			lRetVal = -EIO;
+			return;
+		}
+		if(pOffset < 0 || static_cast<quint64>(pOffset) >= lFile->size()) {
+			return;
+		}
+		if(0 != lFile->seek(static_cast<quint64>(pOffset))) {
+			lRetVal = -EIO;
+			return;
+		}
+		size_t lDone = 0;
+		QByteArray lChunk;
+		while(lDone < pSize) {
+			int lReadResult = lFile->read(lChunk, static_cast<int>(pSize - lDone));
+			if(lReadResult == KIO::ERR_NO_CONTENT) {
+				break;
+			} else if(lReadResult != 0) {
+				lRetVal = -EIO;
+				return;
+			}
+			memcpy(pBuffer + lDone, lChunk.constData(), static_cast<size_t>(lChunk.size()));
+			lDone += static_cast<size_t>(lChunk.size());
+		}
+		lRetVal = static_cast<int>(lDone);
+	});
+	return lRetVal;
+}
+
+static int kupRelease(const char *pPath, struct fuse_file_info *pInfo) {
+	Q_UNUSED(pPath)
+	delete reinterpret_cast<OpenFile *>(pInfo->fh);
+	return 0;
+}
+
+static void *kupInit(struct fuse_conn_info *pConnection) {
+	Q_UNUSED(pConnection)
+	// after fuse has daemonized, so the libgit2 state belongs to this process.
+	git_threads_init();
+	#ifdef BUNDLED_LIBGIT2
+	// Like kio_bup, but several trees share the cache.
+	git_libgit2_opts(GIT_OPT_SET_CACHE_MAX_SIZE, static_cast<ssize_t>(256 * 1024 * 1024));
+	git_libgit2_opts(GIT_OPT_SET_CACHE_OBJECT_LIMIT, GIT_OBJ_TREE, static_cast<size_t>(256 * 1024));
+	git_libgit2_opts(GIT_OPT_SET_CACHE_TYPE_BUDGET, GIT_OBJ_TREE, static_cast<ssize_t>(192 * 1024 * 1024));
+	git_libgit2_opts(GIT_OPT_SET_CACHE_OBJECT_LIMIT, GIT_OBJ_BLOB, static_cast<size_t>(64 * 1024));
+	git_libgit2_opts(GIT_OPT_SET_CACHE_ADMISSION, GIT_OBJ_BLOB, static_cast<int>(GIT_CACHE_ADMIT_REUSED));
+	git_libgit2_opts(GIT_OPT_SET_CACHE_TYPE_BUDGET, GIT_OBJ_BLOB, static_cast<ssize_t>(32 * 1024 * 1024));
+	#endif
+	traceRepositoryReads();
+	usePackIndexCache();
+	// also after daemonizing, threads don't survive the fork.
+	foreach(RepositorySlot *lSlot, sSlots) {
+		lSlot->start();
+	}
+	return nullptr;
+}
+
+static void kupDestroy(void *pData) {
+	Q_UNUSED(pData)
+	foreach(RepositorySlot *lSlot, sSlots) {
+		lSlot->stop();
+		delete lSlot;
+	}
+	sSlots.clear();
+	git_threads_shutdown();
+}
+
+int main(int pArgc, char **pArgv) {
+	QCoreApplication::setApplicationName(QStringLiteral("kup-mount"));
+
+	if(pArgc < 3 || pArgv[1][0] == '-') {
+		fprintf(stderr, "Usage: kup-mount <repository path> <mount point> [fuse options]\n");
+		return 1;
+	}
+	// fuse changes to / when it goes to the background.
+	sRepositoryPath = QFileInfo(QFile::decodeName(pArgv[1])).absoluteFilePath() + QLatin1Char('/');
+	if(!(QFile::exists(sRepositoryPath + QStringLiteral("objects")) &&
+	     QFile::exists(sRepositoryPath + QStringLiteral("refs"))) &&
+	   !(QFile::exists(sRepositoryPath + QStringLiteral(".git/objects")) &&
+	     QFile::exists(sRepositoryPath + QStringLiteral(".git/refs")))) {
+		fprintf(stderr, "kup-mount: %s is not a bup repository\n", pArgv[1]);
+		return 1;
+	}
+
+	for(int i = qMax(QThread::idealThreadCount(), 2); i > 0; --i) {
+		sSlots.append(new RepositorySlot);
+	}
+
+	struct fuse_operations lOperations;
+	memset(&lOperations, 0, sizeof(lOperations));
+	lOperations.getattr = kupGetattr;
+	lOperations.readlink = kupReadlink;
+	lOperations.readdir = kupReaddir;
+	lOperations.open = kupOpen;
+	lOperations.read = kupRead;
+	lOperations.release = kupRelease;
+	lOperations.init = kupInit;
+	lOperations.destroy = kupDestroy;
+
+	// the repository path is ours, fuse gets the mount point and the options.
+	struct fuse_args lArgs = FUSE_ARGS_INIT(0, nullptr);
+	fuse_opt_add_arg(&lArgs, pArgv[0]);
+	for(int i = 2; i < pArgc; ++i) {
+		fuse_opt_add_arg(&lArgs, pArgv[i]);
+	}
+	fuse_opt_add_arg(&lArgs, "-oro,fsname=kup,subtype=bup");
+
+	int lRetVal = fuse_main(lArgs.argc, lArgs.argv, &lOperations, nullptr);
+	fuse_opt_free_args(&lArgs);
+	return lRetVal;
+}
@@ -18,6 +18,9 @@ rm kcm/kcm_kup.desktop.template.h
 intltool-extract --quiet --type=gettext/ini daemon/kupdaemon.notifyrc.template
 cat daemon/kupdaemon.notifyrc.template.h >> ${WDIR}/rc.cpp
 rm daemon/kupdaemon.notifyrc.template.h
+intltool-extract --quiet --type=gettext/ini daemon/kup-checkbackup.desktop.template
+cat daemon/kup-checkbackup.desktop.template.h >> ${WDIR}/rc.cpp
+rm daemon/kup-checkbackup.desktop.template.h
 intltool-extract --quiet --type=gettext/ini dataengine/plasma-dataengine-kup.desktop.template
 cat dataengine/plasma-dataengine-kup.desktop.template.h >> ${WDIR}/rc.cpp
 rm dataengine/plasma-dataengine-kup.desktop.template.h
@@ -52,6 +55,7 @@ done
 cd ${WDIR}
 intltool-merge --quiet --desktop-style ${WDIR} ${BASEDIR}/kcm/kcm_kup.desktop.template ${BASEDIR}/kcm/kcm_kup.desktop
 intltool-merge --quiet --desktop-style ${WDIR} ${BASEDIR}/daemon/kupdaemon.notifyrc.template ${BASEDIR}/daemon/kupdaemon.notifyrc
+intltool-merge --quiet --desktop-style ${WDIR} ${BASEDIR}/daemon/kup-checkbackup.desktop.template ${BASEDIR}/daemon/kup-checkbackup.desktop
 intltool-merge --quiet --desktop-style ${WDIR} ${BASEDIR}/dataengine/plasma-dataengine-kup.desktop.template ${BASEDIR}/dataengine/plasma-dataengine-kup.desktop
 intltool-merge --quiet --desktop-style ${WDIR} ${BASEDIR}/plasmoid/metadata.desktop.template ${BASEDIR}/plasmoid/metadata.desktop
 echo "Done merging translations"
@@ -0,0 +1,152 @@
+/***************************************************************************
+ *   Copyright Simon Persson                                               *
+ *   simonpersson1@gmail.com                                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "kuptrace.h"
+
+#include <QByteArray>
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QMutex>
+#include <QMutexLocker>
+
+#include <atomic>
+#include <stdio.h>
+#include <time.h>
+
+namespace {
+
+class TraceWriter {
+public:
+	TraceWriter() {
+		mThreadCount = 0;
+		mPid = 0;
+		mLastFlushTime = 0;
+		const QByteArray lFolder = qgetenv("KUP_TRACE");
+		if(lFolder.isEmpty()) {
+			return;
+		}
+		QString lProcessName = QCoreApplication::applicationName();
+		if(lProcessName.isEmpty()) {
+			lProcessName = QStringLiteral("kup");
+		}
+		const qint64 lPid = QCoreApplication::applicationPid();
+		mFile.setFileName(QDir(QString::fromLocal8Bit(lFolder)).absoluteFilePath(
+		                     QString(QStringLiteral("%1-%2.json")).arg(lProcessName).arg(lPid)));
+		if(!mFile.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+			return;
+		}
+		// Chrome's array format, the closing bracket is optional so a trace
+		// is still readable if the process gets killed.
+		mBuffer = "[{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" + QByteArray::number(lPid) +
+		          ",\"args\":{\"name\":\"" + lProcessName.toUtf8() + "\"}}";
+		mPid = lPid;
+	}
+
+	~TraceWriter() {
+		if(mFile.isOpen()) {
+			mBuffer.append("]\n");
+			mFile.write(mBuffer);
+			mFile.close();
+		}
+	}
+
+	bool isEnabled() const {
+		return mFile.isOpen();
+	}
+
+	void addSpan(const char *pName, const char *pCategory, qint64 pStartTime, qint64 pEndTime) {
+		static thread_local int sThreadId = ++mThreadCount;
+		char lEvent[256];
+		int lLength = snprintf(lEvent, sizeof(lEvent),
+		                       ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,"
+		                       "\"pid\":%lld,\"tid\":%d}",
+		                       pName, pCategory, static_cast<long long>(pStartTime),
+		                       static_cast<long long>(pEndTime - pStartTime),
+		                       static_cast<long long>(mPid), sThreadId);
+		if(lLength <= 0 || lLength >= static_cast<int>(sizeof(lEvent))) {
+			return;
+		}
+		addEvent(lEvent, lLength, pEndTime);
+	}
+
+	void addCounter(const char *pName, const char *pCategory, qint64 pTime, qint64 pValue) {
+		char lEvent[256];
+		int lLength = snprintf(lEvent, sizeof(lEvent),
+		                       ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"C\",\"ts\":%lld,\"pid\":%lld,"
+		                       "\"args\":{\"value\":%lld}}",
+		                       pName, pCategory, static_cast<long long>(pTime), static_cast<long long>(mPid),
+		                       static_cast<long long>(pValue));
+		if(lLength <= 0 || lLength >= static_cast<int>(sizeof(lEvent))) {
+			return;
+		}
+		addEvent(lEvent, lLength, pTime);
+	}
+
+private:
+	void addEvent(const char *pEvent, int pLength, qint64 pTime) {
+		QMutexLocker lLock(&mMutex);
+		mBuffer.append(pEvent, pLength);
+		// keep what is lost on a crash small, without a write for every event.
+		if(mBuffer.size() > 64*1024 || pTime - mLastFlushTime > 1000000) {
+			mFile.write(mBuffer);
+			mFile.flush();
+			mBuffer.clear();
+			mLastFlushTime = pTime;
+		}
+	}
+
+	QFile mFile;
+	QByteArray mBuffer;
+	QMutex mMutex;
+	qint64 mPid;
+	qint64 mLastFlushTime;
+	std::atomic<int> mThreadCount;
+};
+
+TraceWriter &traceWriter() {
+	static TraceWriter sWriter;
+	return sWriter;
+}
+
+}
+
+bool traceEnabled() {
+	return traceWriter().isEnabled();
+}
+
+qint64 traceTime() {
+	struct timespec lTime;
+	clock_gettime(CLOCK_MONOTONIC, &lTime);
+	return static_cast<qint64>(lTime.tv_sec) * 1000000 + lTime.tv_nsec / 1000;
+}
+
+void traceSpan(const char *pName, const char *pCategory, qint64 pStartTime) {
+	TraceWriter &lWriter = traceWriter();
+	if(lWriter.isEnabled()) {
+		lWriter.addSpan(pName, pCategory, pStartTime, traceTime());
+	}
+}
+
+void traceCounter(const char *pName, const char *pCategory, qint64 pValue) {
+	TraceWriter &lWriter = traceWriter();
+	if(lWriter.isEnabled()) {
+		lWriter.addCounter(pName, pCategory, traceTime(), pValue);
+	}
+}
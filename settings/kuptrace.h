@@ -0,0 +1,63 @@
+/***************************************************************************
+ *   Copyright Simon Persson                                               *
+ *   simonpersson1@gmail.com                                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef KUPTRACE_H
+#define KUPTRACE_H
+
+#include <QtGlobal>
+
+// Scoped timing of the slow paths, written as Chrome trace JSON that can be
+// opened in Perfetto or chrome://tracing. Off unless the KUP_TRACE
+// environment variable names a folder, then each process writes
+// <process name>-<pid>.json there. Names and categories are copied into the
+// trace when an event is recorded, a TraceSpan only keeps the pointers until
+// it ends. They are not escaped, so they must not contain quotes or
+// backslashes.
+
+bool traceEnabled();
+
+// Monotonic clock in microseconds, shared by all processes on the machine.
+qint64 traceTime();
+
+// Record a span that started at pStartTime and ends now.
+void traceSpan(const char *pName, const char *pCategory, qint64 pStartTime);
+
+// Record the current value of something that changes over time, like memory
+// use. Shown as a graph in the trace viewers.
+void traceCounter(const char *pName, const char *pCategory, qint64 pValue);
+
+class TraceSpan {
+public:
+	TraceSpan(const char *pName, const char *pCategory)
+	   : mName(pName), mCategory(pCategory), mStartTime(traceEnabled() ? traceTime() : -1)
+	{}
+	~TraceSpan() {
+		if(mStartTime >= 0) {
+			traceSpan(mName, mCategory, mStartTime);
+		}
+	}
+
+private:
+	Q_DISABLE_COPY(TraceSpan)
+	const char *mName;
+	const char *mCategory;
+	qint64 mStartTime;
+};
+
+#endif // KUPTRACE_H